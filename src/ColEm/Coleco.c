@@ -14,6 +14,27 @@
 #include "Coleco.h"
 #include "Sound.h"
 #include "CRC32.h"
+#include "Movie.h"
+#include "Profile.h"
+
+#ifdef PROFZ80
+#include "ProfZ80.h"
+#endif
+
+#ifdef TRACEZ80
+#include "TraceZ80.h"
+#endif
+
+#ifdef DEBUG
+#include "BreakZ80.h"
+
+/** BRK_RAM() ************************************************/
+/** Breakpoints see 1kB ColecoVision RAM at 7000h..73FFh,   **/
+/** whichever of its mirrors at 6000h..7FFFh is accessed.   **/
+/*************************************************************/
+#define BRK_RAM(A) \
+  ((((A)>>13)==3)&&(ROMPage[3]==RAM_BASE)? (0x7000|((A)&0x03FF)):(A))
+#endif
 
 #ifdef WII
 #include "wii_app_common.h"
@@ -29,6 +50,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <unistd.h>
 
@@ -74,6 +96,13 @@ byte MegaCart;                 /* MegaROM page at 8000h         */
 unsigned int LastCRC;          /* Last computed cartridge CRC   */
          
 byte ExitNow;                  /* 1: Exit the emulator          */
+byte TimedPSG    = 1;          /* 1: Apply PSG writes at exact  */
+                               /* CPU cycles when rendering     */
+byte ThreadedPSG = 0;          /* 1: Audio thread plays frames  */
+                               /* by calling SynthPSG(), needs  */
+                               /* TimedPSG=1                    */
+unsigned int CPUCycles;        /* CPU cycles at period start    */
+byte AheadFrames = 0;          /* Frames to run ahead, 0=off    */
 byte AdamROMs;                 /* 1: All Adam ROMs are loaded   */ 
 
 byte JoyMode;                  /* Joystick controller mode      */
@@ -82,6 +111,11 @@ unsigned int SpinCount;        /* Spinner counters              */
 unsigned int SpinStep;         /* Spinner steps                 */
 unsigned int SpinState;        /* Spinner bit states            */
 
+byte DirtyPages[HASH_PAGES];   /* RAM/VRAM pages to rehash      */
+static byte DirtyPCB;          /* 1: AdamNet may have written   */
+const char *HashNames[HASH_COUNT] = /* StateHash() components   */
+{ "CPU","VDP","PSG","RAM","VRAM","AY8910" };
+
 char *SndName    = "LOG.MID";  /* Soundtrack log file           */
 char *StaName    = 0;          /* Emulation state save file     */
 char *SavName    = 0;          /* EEPROM data save file         */
@@ -102,6 +136,41 @@ struct
   byte Text[10];
 } CheatCodes[MAXCHEATS];
 
+/* Timestamped PSG writes, in CPU cycles, in CPU order */
+#define PSG_AY   0x1000        /* Log data: AY8910 Reg<<8|Value  */
+#define PSG_MARK 0x8000        /* Log data: frame end, |Samples  */
+#define PSG_SYNC 0xFE00        /* Log data: resync, |SyncSeq/2   */
+#define PSG_TICK 0xFF00        /* Log data: LoopZ80() tick|Drums */
+static SndLog PSGLog;          /* SN76489 Value, or PSG_* above  */
+static SN76489 SndPSG;         /* SN76489 as heard by renderer   */
+static AY8910 SndAY;           /* AY8910 as heard by renderer    */
+static SN76489 SyncPSG;        /* SN76489 state for PSG_SYNC     */
+static AY8910 SyncAY;          /* AY8910 state for PSG_SYNC      */
+static unsigned int SyncSeq;   /* Sync* version, odd if updating */
+static byte SndLost;           /* 1: Log overflowed, resync next */
+static unsigned int SndTime;   /* CPU time of the current block  */
+static unsigned int SndSpan;   /* CPU cycles in the current block*/
+static unsigned int SndCount;  /* Samples in the current block   */
+static unsigned int SndPos;    /* Samples rendered in this block */
+static unsigned int SndEnd;    /* PSGLog position of block end   */
+static unsigned int SndDebt;   /* Samples played by HoldPSG()    */
+
+/* Run-ahead: frames past the current one, shown before they happen */
+static byte AheadState[MAX_STASIZE]; /* Current state, kept aside */
+static byte Ahead = 0;         /* Frames left to run ahead       */
+static byte AheadDraw;         /* 1: Show the last frame ahead   */
+static int AheadUCount = -1;   /* VDP.UCount of an undrawn frame */
+
+/* Periodic hardware update, called from LoopZ80() */
+static word LoopColeco(Z80 *R);
+/* Log a PSG write at the current CPU cycle */
+static void LogPSG(unsigned int Data);
+/* Show a frame from the future, then come back */
+static void RunAhead(Z80 *R,word J);
+/* Report where movie playback diverged from the recording */
+static void CheckMovie(void);
+/* Reset renderer chips to the current PSG states */
+static void ResyncPSG(void);
 /* Apply RAM-based cheats */
 static int ApplyCheats(void);
 /* Guess some hardware modes by ROM contents */
@@ -216,6 +285,10 @@ int StartColeco(const char *Cartridge)
   /* Set up CPU modes */
   CPU.TrapBadOps = Verbose&0x04;
   CPU.IAutoReset = 1;
+#ifdef DEBUG
+  CPU.Trap       = 0xFFFF;
+  CPU.Trace      = 0;
+#endif
 
   /* Allocate memory for RAM and ROM */
   if(Verbose) printf("Allocating 256kB for CPU address space...");  
@@ -345,7 +418,9 @@ int StartColeco(const char *Cartridge)
 #endif  
 
   if(Verbose) printf("RUNNING ROM CODE...\n");
+  PRF_ENTER(PRF_Z80);
   J=RunZ80(&CPU);
+  PRF_LEAVE();
 
   if(Verbose) printf("EXITED at PC = %04Xh.\n",J);
   return(1);
@@ -469,6 +544,16 @@ int LoadROM(const char *Cartridge)
   /* Keep initial cartridge CRC (may change after SRAM writes) */
   if(P==ROM_CARTRIDGE) LastCRC=CartCRC();
 
+#ifdef PROFZ80
+  /* Profile the new cartridge from scratch */
+  if(P==ROM_CARTRIDGE) ProfZ80Reset();
+#endif
+
+#ifdef TRACEZ80
+  /* Trace the new cartridge from scratch */
+  if(P==ROM_CARTRIDGE) TraceZ80Reset();
+#endif
+
   /* Reset hardware, guessing some hardware modes */
   ResetColeco((Mode&~(CV_EEPROM|CV_SRAM))|GuessROM(P,J));
 
@@ -620,6 +705,9 @@ void TrashColeco(void)
   if(EEPROMData) { free(EEPROMData);EEPROMData=0; }
   if(StaName)    { free(StaName);StaName=0; }
   if(SavName)    { free(SavName);SavName=0; }
+#ifdef PROFZ80
+  ProfZ80Trash();
+#endif
 
   /* Close MIDI sound log */
   TrashMIDI();
@@ -747,7 +835,7 @@ void SetMemory(byte NewPort60,byte NewPort20,byte NewPort53)
   }
 
   /* Reset AdamNet */
-  if((Mode&CV_ADAM)&&(NewPort20==0x0F)) ResetPCB();
+  if((Mode&CV_ADAM)&&(NewPort20==0x0F)) { ResetPCB();DirtyPCB=1; }
 }
 
 /** CartCRC() ************************************************/
@@ -789,6 +877,7 @@ int ResetColeco(int NewMode)
   memset(RAM_EXP_LO,0x00,0x8000);
   memset(RAM_EXP_HI,0x00,0x8000);
   memset(RAM_OS7,0x00,0x2000);
+  memset(DirtyPages,1,sizeof(DirtyPages));
 
   /* Set up memory pages */
   SetMemory(Mode&CV_ADAM? 0x00:0x0F,0x00,0x00);
@@ -807,6 +896,8 @@ int ResetColeco(int NewMode)
   /* Reset AY8910 PSG */
   Reset8910(&AYPSG,CPU_CLOCK/2, SN76489_CHANNELS);
   Sync8910(&AYPSG,AY8910_SYNC);
+  /* Start timestamped PSG writes from the new state */
+  if(TimedPSG) ResyncPSG();
   /* Reset 24Cxx EEPROM */
   I = (Mode&CV_EEPROM)==CV_24C256? C24XX_24C256:C24XX_24C08;
   Reset24XX(&EEPROM,EEPROMData,I|(Verbose&0x08? C24XX_DEBUG:0));
@@ -829,17 +920,28 @@ int ResetColeco(int NewMode)
 /*************************************************************/
 void WrZ80(register word A,register byte V)
 {
+#ifdef DEBUG
+  if(BreakZ80(BRK_MEM,BRK_RAM(A),BRK_WRITE)) CPU.Trace=1;
+#endif
+
   if(Mode&CV_ADAM)
   {
     /* Write to RAM */
     RAMPage[A>>13][A&0x1FFF]=V;
+    DirtyRAM(&RAMPage[A>>13][A&0x1FFF]);
     /* Adam may try writing AdamNet */
-    if(PCBTable[A]) WritePCB(A,V);
+    if(PCBTable[A])
+    {
+      PRF_ENTER(PRF_WRZ80);
+      WritePCB(A,V);DirtyPCB=1;
+      PRF_LEAVE();
+    }
   }
   else if((Mode&CV_SGM)&&(Port53&0x01))
   {
     /* Write to RAM */
     RAMPage[A>>13][A&0x1FFF]=V;
+    DirtyRAM(&RAMPage[A>>13][A&0x1FFF]);
   }
   else if((A>=0x6000)&&(A<0x8000))
   {
@@ -848,9 +950,14 @@ void WrZ80(register word A,register byte V)
     RAM_BASE[0x0800+A]=RAM_BASE[0x0C00+A]=
     RAM_BASE[0x1000+A]=RAM_BASE[0x1400+A]=
     RAM_BASE[0x1800+A]=RAM_BASE[0x1C00+A]=V;
+    A>>=8;
+    DirtyPages[A]   =DirtyPages[A+4] =DirtyPages[A+8] =DirtyPages[A+12]=
+    DirtyPages[A+16]=DirtyPages[A+20]=DirtyPages[A+24]=DirtyPages[A+28]=1;
   }
   else if((A>=0xFF80)&&(MegaSize>2)&&(ROMPage[7]!=RAMPage[7]))
   {
+    PRF_ENTER(PRF_WRZ80);
+
     /* Cartridges, containing EEPROM, use [1111 1111 11xx 0000] addresses */
     if(Mode&CV_EEPROM)
     {
@@ -894,17 +1001,23 @@ void WrZ80(register word A,register byte V)
         ROMPage[7] = ROMPage[6]+0x2000;
         break;
     }
+
+    PRF_LEAVE();
   }
   else if((A>=0xE000)&&(A<0xE800)&&(Mode&CV_SRAM))
   {
     /* SRAM at E800h..EFFFh, writable via E000h..E7FFh */
     ROMPage[A>>13][(A+0x0800)&0x1FFF] = V;
+    DirtyRAM(&ROMPage[A>>13][(A+0x0800)&0x1FFF]);
   }
+#ifdef WII
   else if((wii_coleco_db_entry.flags&OPCODE_MEMORY)&&(A>=0x2000)&&(A<0x5FFF))
   {
     // To support Opcode RAM expansion
     RAMPage[A>>13][A&0x1FFF]=V;
+    DirtyRAM(&RAMPage[A>>13][A&0x1FFF]);
   }
+#endif
   else if(Verbose)
   {
 //    printf("Illegal write RAM[%04Xh] = %02Xh\n",A,V);
@@ -918,13 +1031,19 @@ void WrZ80(register word A,register byte V)
 /*************************************************************/
 byte RdZ80(register word A)
 {
+#ifdef DEBUG
+  if(BreakZ80(BRK_MEM,BRK_RAM(A),BRK_READ)) CPU.Trace=1;
+#endif
+
   /* If trying to switch MegaCart... */
   if((A>=0xFFC0)&&MegaCart&&(ROMPage[7]!=RAMPage[7]))
   {
     /* Set new MegaCart ROM page */
+    PRF_ENTER(PRF_RDZ80);
     MegaPage   = (A-0xFFC0)&(MegaSize-1);
     ROMPage[6] = ROM_CARTRIDGE + (MegaPage<<14);
     ROMPage[7] = ROMPage[6]+0x2000;
+    PRF_LEAVE();
   }
   else if((A==0xFF80)&&(MegaSize>2)&&(ROMPage[7]!=RAMPage[7])&&(Mode&CV_EEPROM))
   {
@@ -933,11 +1052,28 @@ byte RdZ80(register word A)
   }
 
   /* Adam may try reading AdamNet */
-  if((Mode&CV_ADAM)&&PCBTable[A]) ReadPCB(A);
+  if((Mode&CV_ADAM)&&PCBTable[A])
+  {
+    PRF_ENTER(PRF_RDZ80);
+    ReadPCB(A);DirtyPCB=1;
+    PRF_LEAVE();
+  }
 
   return(ROMPage[A>>13][A&0x1FFF]);
 }
 
+#ifdef PROFZ80
+/** BankZ80() ************************************************/
+/** Guest profiler calls this function to tell apart ROM    **/
+/** pages switched in at C000h..FFFFh. Returns 1+MegaPage   **/
+/** there, 0 elsewhere or when nothing is switched.         **/
+/*************************************************************/
+unsigned int BankZ80(word A)
+{
+  return((A>=0xC000)&&(MegaSize>2)&&(ROMPage[7]!=RAMPage[7])? MegaPage+1:0);
+}
+#endif
+
 /** PatchZ80() ***********************************************/
 /** Z80 emulation calls this function when it encounters a  **/
 /** special patch command (ED FE) provided for user needs.  **/
@@ -955,6 +1091,13 @@ byte InZ80(register word Port)
 
 //printf("InZ80(0x%X)\n",Port);
 
+#ifdef DEBUG
+  /* Check port and VRAM breakpoints, VDP returns prefetched data */
+  if(BreakZ80(BRK_IO,Port,BRK_READ)) CPU.Trace=1;
+  if(((Port&0xE1)==0xA0)&&BreakZ80(BRK_VRAM,(VDP.VAddr-1)&0x3FFF,BRK_READ))
+    CPU.Trace=1;
+#endif
+
   switch(Port&0xE0)
   {
     case 0x40: /* Printer Status and SGM Module */
@@ -994,14 +1137,24 @@ void OutZ80(register word Port,register byte Value)
 
 //printf("OutZ80(0x%X,0x%X)\n",Port,Value);
 
+#ifdef DEBUG
+  /* Check port and VRAM breakpoints */
+  if(BreakZ80(BRK_IO,Port,BRK_WRITE)) CPU.Trace=1;
+  if(((Port&0xE1)==0xA0)&&BreakZ80(BRK_VRAM,VDP.VAddr,BRK_WRITE))
+    CPU.Trace=1;
+#endif
+
   switch(Port&0xE0)
   {
     case 0x80: JoyMode=0;break;
     case 0xC0: JoyMode=1;break;
-    case 0xE0: Write76489(&PSG,Value);break; 
+    case 0xE0:
+      Write76489(&PSG,Value);
+      if(TimedPSG) LogPSG(Value);
+      break; 
 
     case 0xA0:
-      if(!(Port&0x01)) WrData9918(&VDP,Value);
+      if(!(Port&0x01)) { DirtyVRAM(VDP.VAddr);WrData9918(&VDP,Value); }
       else if(WrCtrl9918(&VDP,Value)) CPU.IRequest=INT_NMI;
       break;
 
@@ -1011,7 +1164,11 @@ void OutZ80(register word Port,register byte Value)
       {
         if(Port==0x53)      SetMemory(Port60,Port20,Value);
         else if(Port==0x50) WrCtrl8910(&AYPSG,Value);
-        else if(Port==0x51) WrData8910(&AYPSG,Value);
+        else if(Port==0x51)
+        {
+          WrData8910(&AYPSG,Value);
+          if(TimedPSG) LogPSG(PSG_AY|((AYPSG.Latch&0x0F)<<8)|Value);
+        }
       }
       break;
 
@@ -1030,8 +1187,24 @@ void OutZ80(register word Port,register byte Value)
 /** if the system hardware requires any interrupts.         **/
 /*************************************************************/
 word LoopZ80(Z80 *R)
+{
+  word J;
+
+  /* CPUCycles moves to the next period only after all the */
+  /* work, so that CPUTime() stays valid while it is done  */
+  J = LoopColeco(R);
+  CPUCycles += R->IPeriod;
+  return(J);
+}
+
+/** LoopColeco() *********************************************/
+/** Refresh VDP, sound, and input once per scanline. Returns**/
+/** interrupt vector, INT_NONE, or INT_QUIT for LoopZ80().  **/
+/*************************************************************/
+static word LoopColeco(Z80 *R)
 {
   static byte ACount=0;
+  unsigned int Joy,Mou;
 
   /* If emulating spinners... */
   if(Mode&CV_SPINNERS)
@@ -1080,9 +1253,14 @@ word LoopZ80(Z80 *R)
     /* Update AY8910 state */
     Loop8910(&AYPSG,J);
 
-    /* Flush changes to sound channels */
-    Sync76489(&PSG,SN76489_FLUSH|(D? SN76489_DRUMS:0));
-    Sync8910(&AYPSG,AY8910_FLUSH|(D? AY8910_DRUMS:0));
+    /* With timestamped writes, renderer chips get a tick */
+    if(TimedPSG) LogPSG(PSG_TICK|D);
+    else if(!Ahead)
+    {
+      /* Flush changes to sound channels */
+      Sync76489(&PSG,SN76489_FLUSH|(D? SN76489_DRUMS:0));
+      Sync8910(&AYPSG,AY8910_FLUSH|(D? AY8910_DRUMS:0));
+    }
   }
 
   /* Drop out unless end of screen is reached */
@@ -1090,8 +1268,34 @@ word LoopZ80(Z80 *R)
 
   /* End of screen reached... */
 
-  /* Check joysticks, clear unused bits */
-  JoyState=Joystick()&~0x30003000;
+  /* Frames run ahead keep current input, the last one is shown */
+  if(Ahead)
+  {
+    if(CheatsON&&CheatCount) ApplyCheats();
+    if(!--Ahead) return(INT_QUIT);
+    VDP.UCount = (Ahead==1)&&AheadDraw? 100:0;
+    return(R->IRequest);
+  }
+
+  /* Frame after a run ahead was not drawn, restore frame skip */
+  if(AheadUCount>=0)
+  {
+    VDP.UCount  = AheadUCount-(AheadUCount>=100? 100:0)+VDP.DrawFrames;
+    AheadUCount = -1;
+  }
+
+  /* Frame ends here, before the host takes input */
+  PRF_FRAME();
+
+  /* Check joysticks and mouse, record or replay them */
+  PRF_ENTER(PRF_INPUT);
+  Joy = Joystick();
+  Mou = Mode&CV_SPINNERS? Mouse():0;
+  PRF_LEAVE();
+  if(MOVMode()&&(MOVInput(&Joy,&Mou)==MOV_PLAY)) CheckMovie();
+
+  /* Clear unused joystick bits */
+  JoyState=Joy&~0x30003000;
 
   /* Lock out opposite direction keys (Grog's Revenge) */
   if(JoyState&JST_RIGHT)       JoyState&=~JST_LEFT;
@@ -1106,7 +1310,7 @@ word LoopZ80(Z80 *R)
 
     /* Get mouse position relative to the window center, */
     /* normalized to -512..+512 range */
-    I = Mouse();
+    I = Mou;
     /* First spinner */
     K = (Mode&CV_SPINNER1Y? (I<<2):Mode&CV_SPINNER1X? (I<<16):0)>>16;
     K = K<-512? -512:K>512? 512:K;
@@ -1143,10 +1347,316 @@ word LoopZ80(Z80 *R)
   /* If exit requested, return INT_QUIT */
   if(ExitNow) return(INT_QUIT);
 
+  /* Show a frame from the future, if requested. Adam and EEPROM */
+  /* devices keep their state outside of SaveState()            */
+  if(AheadFrames&&!(Mode&(CV_ADAM|CV_EEPROM))) RunAhead(R,R->IRequest);
+
   /* Generate interrupt if needed */
   return(R->IRequest);
 }
 
+/** RunAhead() ***********************************************/
+/** Emulate AheadFrames frames past the current one with    **/
+/** current input, drawing only the last one and logging no **/
+/** sound, then go back to the current state. The next real **/
+/** frame is not drawn, as it has been shown already. Called**/
+/** at the end of screen, J is the interrupt LoopZ80() will **/
+/** return.                                                 **/
+/*************************************************************/
+static void RunAhead(Z80 *R,word J)
+{
+  unsigned int Cycles,Spin,Joy,Size;
+#ifdef PROFZ80
+  int Prof;
+#endif
+#ifdef TRACEZ80
+  unsigned int Clock;
+  int Trc;
+#endif
+#ifdef DEBUG
+  int Muted;
+#endif
+
+  /* Keep current state aside, with what SaveState() skips */
+  Size = SaveState(AheadState,sizeof(AheadState));
+  if(!Size) return;
+  Cycles = CPUCycles;
+  Spin   = SpinCount;
+  Joy    = JoyState;
+
+#ifdef PROFZ80
+  /* Do not profile frames that never happen */
+  Prof = ProfZ80Pause(1);
+#endif
+#ifdef TRACEZ80
+  /* Nor trace them, keeping cycle stamps on the real timeline */
+  Trc   = TrcOn;
+  Clock = TrcClock;
+  TrcOn = 0;
+#endif
+#ifdef DEBUG
+  /* Nor stop in them, LoadState() brings Trap and Trace back */
+  Muted    = MuteBreakZ80(1);
+  R->Trap  = 0xFFFF;
+  R->Trace = 0;
+#endif
+
+  /* Show the last frame if the next one would have been drawn */
+  AheadDraw  = VDP.UCount>=100;
+  VDP.UCount = (AheadFrames==1)&&AheadDraw? 100:0;
+  Ahead      = AheadFrames;
+
+  /* Finish this LoopZ80() call the way RunZ80() would, then */
+  /* run until LoopColeco() has counted all frames ahead     */
+  CPUCycles += R->IPeriod;
+  R->ICount += R->IPeriod;
+  if(J!=INT_NONE) IntZ80(R,J);
+  RunZ80(R);
+  Ahead = 0;
+
+  /* Come back, sound never left the current state */
+  CPUCycles = Cycles;
+  RestoreState(AheadState,Size,0);
+  SpinCount = Spin;
+  JoyState  = Joy;
+
+#ifdef PROFZ80
+  ProfZ80Pause(Prof);
+#endif
+#ifdef TRACEZ80
+  TrcOn    = Trc;
+  TrcClock = Clock;
+#endif
+#ifdef DEBUG
+  MuteBreakZ80(Muted);
+#endif
+
+  /* Do not draw the next real frame */
+  AheadUCount = VDP.UCount;
+  VDP.UCount  = 0;
+}
+
+/** CheckMovie() *********************************************/
+/** Report the first frame where movie playback diverged    **/
+/** from the recording, and the state component that was   **/
+/** different, as soon as it happens.                       **/
+/*************************************************************/
+static void CheckMovie(void)
+{
+  unsigned int F;
+  int J;
+
+  J = MOVDiverged(&F);
+  if(J&&(J<=HASH_COUNT)&&(F+1==MOVFrame())&&Verbose)
+    printf("MOVIE: Diverged at frame %u in %s state\n",F,HashNames[J-1]);
+}
+
+/** LogPSG() *************************************************/
+/** Log a PSG write at the current CPU cycle. After the log **/
+/** has overflowed, resync instead: PSG states passed with  **/
+/** the resync already include this write.                  **/
+/*************************************************************/
+static void LogPSG(unsigned int Data)
+{
+  /* Frames run ahead are silent */
+  if(Ahead) return;
+  if(SndLost||!LogSound(&PSGLog,CPUTime(),Data)) ResyncPSG();
+}
+
+/** ResyncPSG() **********************************************/
+/** Bring renderer chips to the current PSG states at the   **/
+/** current CPU cycle. Used on reset, state loads, and when **/
+/** the log overflows. The states are handed over through   **/
+/** Sync* and picked up when the renderer gets to PSG_SYNC. **/
+/** If the log is full, SndLost makes the next write retry. **/
+/*************************************************************/
+static void ResyncPSG(void)
+{
+  /* Publish chip states, odd SyncSeq while they change */
+  SndRelease(SyncSeq,SyncSeq+1);
+  SndFence();
+  SyncPSG = PSG;
+  SyncAY  = AYPSG;
+  SndRelease(SyncSeq,SyncSeq+1);
+
+  /* Tell renderer to pick them up at this point */
+  SndLost = !LogSound(&PSGLog,CPUTime(),PSG_SYNC|((SyncSeq>>1)&0xFF));
+}
+
+/** ApplyPSG() ***********************************************/
+/** Take the next entry out of the log and apply it to the  **/
+/** renderer chips, issuing Sound() calls right away.       **/
+/*************************************************************/
+static void ApplyPSG(void)
+{
+  SN76489 P;
+  AY8910 A;
+  unsigned int D,T,S;
+
+  D = SndLogData(&PSGLog);
+  T = SndLogTime(&PSGLog);
+  SndRelease(PSGLog.RPtr,PSGLog.RPtr+1);
+
+  if(D<PSG_AY)
+  {
+    Write76489(&SndPSG,D);
+    Sync76489(&SndPSG,SN76489_FLUSH);
+  }
+  else if(D<PSG_MARK)
+  {
+    Write8910(&SndAY,(D>>8)&0x0F,D&0xFF);
+    Sync8910(&SndAY,AY8910_FLUSH);
+  }
+  else if((D&0xFF00)==PSG_TICK)
+  {
+    /* Same envelope step as LoopZ80() makes every 8 lines */
+    Loop8910(&SndAY,(unsigned int)(1000000L*(CPU_HPERIOD<<3)/CPU_CLOCK));
+    Sync8910(&SndAY,AY8910_FLUSH|(D&1? AY8910_DRUMS:0));
+    if(D&1) Sync76489(&SndPSG,SN76489_FLUSH|SN76489_DRUMS);
+  }
+  else if((D&0xFF00)==PSG_SYNC)
+  {
+    /* Time base restarts here */
+    SndTime = T;
+
+    /* Take the states, unless a newer resync replaced them */
+    /* (it comes later in the log and will set them then)   */
+    S = SndAcquire(SyncSeq);
+    if(!(S&1)&&(((S>>1)&0xFF)==(D&0xFF)))
+    {
+      P = SyncPSG;
+      A = SyncAY;
+      SndFence();
+      if(SndAcquire(SyncSeq)==S)
+      {
+        SndPSG = P;
+        SndAY  = A;
+        SndPSG.Changed = 0x80|((1<<SN76489_CHANNELS)-1);
+        SndAY.Changed  = (1<<AY8910_CHANNELS)-1;
+        Sync76489(&SndPSG,SN76489_FLUSH);
+        Sync8910(&SndAY,AY8910_FLUSH);
+      }
+    }
+  }
+}
+
+/** RenderPSG() **********************************************/
+/** Render the next given number of samples of the current  **/
+/** block, applying logged writes at their own samples.     **/
+/** Called back from RenderAndPlayAudio().                  **/
+/*************************************************************/
+static void RenderPSG(int *Wave,unsigned int Samples)
+{
+  unsigned int I,J,E;
+
+  for(I=0;I<Samples;I+=J)
+  {
+    /* Find the block sample at which next write happens */
+    E = PSGLog.RPtr!=SndEnd;
+    if(!E) J=SndCount;
+    else
+    {
+      J = SndLogTime(&PSGLog)-SndTime;
+      J = (int)J<=0? 0:(unsigned int)((unsigned long long)J*SndCount/SndSpan);
+    }
+
+    /* Render up to that sample, or apply the write */
+    J = J>SndPos? J-SndPos:E? 0:Samples-I;
+    J = J<Samples-I? J:Samples-I;
+    if(J) { RenderAudio(Wave+I,J);SndPos+=J; }
+    else ApplyPSG();
+  }
+}
+
+/** SynthPSG() ***********************************************/
+/** Render and play the next frame of logged PSG writes, if **/
+/** PlayPSG() has closed it and its samples fit into Free.  **/
+/** Every write takes effect at the sample matching its CPU **/
+/** cycle. Returns 1 if a frame was played, 0 otherwise.    **/
+/** With ThreadedPSG=1, only call it from the audio thread. **/
+/*************************************************************/
+int SynthPSG(unsigned int Free)
+{
+  unsigned int Now,W,J,K,D,Sync,Samples;
+
+  /* Find the end of the next frame and its last resync */
+  W = SndAcquire(PSGLog.WPtr);
+  for(J=PSGLog.RPtr,Sync=0;J!=W;++J)
+  {
+    D = PSGLog.Data[J&(SND_LOGSIZE-1)];
+    if((D&0xFF00)==PSG_SYNC) Sync=J-PSGLog.RPtr+1;
+    else if((D&0xC000)==PSG_MARK) break;
+  }
+  if(J==W) return(0);
+
+  /* Shorten frame to make up for HoldPSG(), if it fits */
+  Samples = D&0x3FFF;
+  K = Samples>>2;
+  K = SndDebt<K? SndDebt:K;
+  if(Samples-K>Free) return(0);
+  SndDebt -= K;
+  Samples -= K;
+
+  /* Everything up to the last resync happens right away */
+  for(;Sync;--Sync) ApplyPSG();
+
+  /* Map this block of samples onto CPU time of the frame */
+  Now      = PSGLog.Time[J&(SND_LOGSIZE-1)];
+  SndSpan  = Now!=SndTime? Now-SndTime:1;
+  SndCount = Samples;
+  SndPos   = 0;
+  SndEnd   = J;
+
+  /* Render and play, applying writes as samples go by */
+  SetAudioRenderer(RenderPSG);
+  RenderAndPlayAudio(Samples);
+  SetAudioRenderer(0);
+
+  /* Apply whatever writes did not make it into audio */
+  while(PSGLog.RPtr!=SndEnd) ApplyPSG();
+
+  /* Drop the frame mark, next block starts where it ends */
+  SndRelease(PSGLog.RPtr,PSGLog.RPtr+1);
+  SndTime = Now;
+  return(1);
+}
+
+/** HoldPSG() ************************************************/
+/** Keep playing current PSG sound for a given number of    **/
+/** samples when the next frame is late. Following frames   **/
+/** get shortened to catch up. Returns samples played.      **/
+/*************************************************************/
+unsigned int HoldPSG(unsigned int Samples)
+{
+  Samples  = RenderAndPlayAudio(Samples);
+  SndDebt += Samples;
+  SndDebt  = SndDebt<0x3FFF? SndDebt:0x3FFF;
+  return(Samples);
+}
+
+/** PlayPSG() ************************************************/
+/** Close the frame of PSG writes logged since the previous **/
+/** call, to be played as a given number of audio samples.  **/
+/** With ThreadedPSG=1 the audio thread plays it by calling **/
+/** SynthPSG(), otherwise it gets played right away. With   **/
+/** TimedPSG=0, sound has already been flushed and gets     **/
+/** played right away. Returns the number of samples.       **/
+/*************************************************************/
+unsigned int PlayPSG(unsigned int Samples)
+{
+  /* Without timestamps, sound has already been flushed */
+  if(!TimedPSG) return(RenderAndPlayAudio(Samples));
+
+  /* Mark the end of this frame in the log */
+  Samples = Samples<0x3FFF? Samples:0x3FFF;
+  if(SndLost) ResyncPSG();
+  if(!LogSound(&PSGLog,CPUTime(),PSG_MARK|Samples)) return(0);
+
+  /* Play it here, unless audio thread does that */
+  if(!ThreadedPSG) while(SynthPSG(Samples));
+  return(Samples);
+}
+
 /** SaveCHT() ************************************************/
 /** Save cheats to a given text file. Returns the number of **/
 /** cheats on success, 0 on failure.                        **/
@@ -1397,6 +1907,15 @@ int LoadSAV(const char *FileName)
 /** guessed bits.                                           **/
 /*************************************************************/
 unsigned int GuessROM(const byte *ROM,unsigned int Size)
+{
+  return(GuessCRC(ComputeCRC32(0,ROM,Size)));
+}
+
+/** GuessCRC() ***********************************************/
+/** Guess some emulation modes by a given ROM CRC. Returns  **/
+/** sum of guessed bits.                                    **/
+/*************************************************************/
+unsigned int GuessCRC(unsigned int CRC)
 {
   static struct { const char *Name;unsigned int CRC,Mode; } Games[] =
   {
@@ -1406,15 +1925,12 @@ unsigned int GuessROM(const byte *ROM,unsigned int Size)
     { "Lord Of The Dungeon",0x1053F610,CV_SRAM   }, /* 24kB ROM + 2kB SRAM */
     { 0,0,0 }
   };
-  unsigned int CRC,J;
+  unsigned int J;
   unsigned int Guess;
 
   /* Nothing guessed yet */
   Guess = 0;
 
-  /* Compute game CRC */
-  CRC = ComputeCRC32(0,ROM,Size);
-
   /* Find game by CRC */
   for(J=0;Games[J].Mode;++J)
     if(CRC==Games[J].CRC) { Guess=Games[J].Mode;break; }
@@ -34,6 +34,12 @@ extern "C" {
 #define CPU_CLOCK     TMS9918_CLOCK        /* Z80 clock, Hz  */
 #define CPU_HPERIOD   TMS9918_LINE       /* Scanline, clocks */
 
+/** CPUTime() ************************************************/
+/** Current CPU time in cycles, counted from the start of   **/
+/** emulation. Wraps around, so compare with subtraction.   **/
+/*************************************************************/
+#define CPUTime()     (CPUCycles+CPU.IPeriod-CPU.ICount)
+
 /** Cheats() Arguments ***************************************/
 #define CHTS_OFF      0               /* Turn all cheats off */
 #define CHTS_ON       1               /* Turn all cheats on  */
@@ -66,9 +72,7 @@ extern "C" {
 #define CV_24C256     0x00004000  /*   32kB EEPROM     */
 #define CV_SRAM       0x00008000  /* 2kB battery-backed SRAM */
 
-#ifdef WII
 extern byte *RAM;
-#endif
 
 /** Memory Areas *********************************************/
 #define ROM_WRITER    (RAM)         /* 32kB SmartWriter ROM  */
@@ -85,6 +89,27 @@ extern byte *RAM;
 #define RAM_EXP_HI    (RAM+0x30000) /* 32kB exp Adam RAM     */
 #define ROM_CARTRIDGE (RAM+0x38000) /* 32kB Cartridge ROM    */
 
+/** StateHash() Components ***********************************/
+#define HASH_CPU      0             /* Z80 CPU registers     */
+#define HASH_VDP      1             /* TMS9918 registers     */
+#define HASH_PSG      2             /* SN76489 PSG           */
+#define HASH_RAM      3             /* 40kB at RAM_BASE      */
+#define HASH_VRAM     4             /* 16kB of VRAM          */
+#define HASH_AYPSG    5             /* AY8910 PSG            */
+#define HASH_COUNT    6             /* Number of components  */
+
+/** Dirty Pages **********************************************/
+/** RAM_BASE and VRAM are hashed in 256-byte pages. Writes  **/
+/** mark pages in DirtyPages[], so that StateHash() only    **/
+/** rehashes pages that have changed since the last call.   **/
+/*************************************************************/
+#define HASH_RAMPAGES (0xA000>>8)
+#define HASH_PAGES    (HASH_RAMPAGES+(0x4000>>8))
+#define DirtyRAM(P) \
+  { unsigned int O=(P)-RAM_BASE; if(O<0xA000) DirtyPages[O>>8]=1; }
+#define DirtyVRAM(A) \
+  DirtyPages[HASH_RAMPAGES+(((A)&0x3FFF)>>8)]=1
+
 /** Joystick() Result Bits ***********************************/
 #define JST_NONE      0x0000
 #define JST_KEYPAD    0x000F
@@ -137,8 +162,18 @@ extern char *SavName;                 /* EEPROM save file    */
 extern char *PrnName;                 /* Printer redir. file */
 
 extern byte ExitNow;                  /* 1: Exit emulator    */
+extern byte TimedPSG;                 /* 1: Exact PSG timing */
+extern byte ThreadedPSG;              /* 1: SynthPSG() called */
+                                      /* by an audio thread, */
+                                      /* needs TimedPSG=1    */
+extern unsigned int CPUCycles;        /* CPU cycles at start */
+                                      /* of LoopZ80() period */
+extern byte AheadFrames;              /* Frames to run ahead */
+                                      /* of input, 0 = off   */
 extern byte AdamROMs;                 /* 1: Adam ROMs loaded */
 extern byte PCBTable[];
+extern byte DirtyPages[];             /* Pages to rehash     */
+extern const char *HashNames[];       /* StateHash() names   */
 
 /** StartColeco() ********************************************/
 /** Allocate memory, load ROM image, initialize hardware,   **/
@@ -198,12 +233,33 @@ int LoadPAL(const char *Name);
 /*************************************************************/
 unsigned int CartCRC(void);
 
+/** GuessCRC() ***********************************************/
+/** Guess some emulation modes by ROM CRC, as done when     **/
+/** loading a ROM. Returns sum of guessed bits.             **/
+/*************************************************************/
+unsigned int GuessCRC(unsigned int CRC);
+
 /** SaveSTA() ************************************************/
 /** Save emulation state to a given file. Returns 1 on      **/
 /** success, 0 on failure.                                  **/
 /*************************************************************/
 int SaveSTA(const char *StateFile);
 
+/** CaptureSTA() *********************************************/
+/** Capture emulation state, with a .STA header, into a     **/
+/** given buffer. Returns captured size on success, 0 on    **/
+/** failure. Use WriteSTA() to write captured state out.    **/
+/*************************************************************/
+unsigned int CaptureSTA(byte *Buf,unsigned int MaxSize);
+
+/** WriteSTA() ***********************************************/
+/** Compress state captured by CaptureSTA() and write it    **/
+/** into a .STA file. Does not touch emulation state, so it **/
+/** may run on another thread, one call at a time. Returns  **/
+/** 1 on success, 0 on failure.                             **/
+/*************************************************************/
+int WriteSTA(const char *StateFile,const byte *Buf,unsigned int Size);
+
 /** LoadSTA() ************************************************/
 /** Load emulation state from a given file. Returns 1 on    **/
 /** success, 0 on failure.                                  **/
@@ -228,6 +284,19 @@ unsigned int SaveState(unsigned char *Buf,unsigned int MaxSize);
 /*************************************************************/
 unsigned int LoadState(unsigned char *Buf,unsigned int MaxSize);
 
+/** StateSize() **********************************************/
+/** Returns exact number of bytes SaveState() is going to   **/
+/** write for the current emulation state.                  **/
+/*************************************************************/
+unsigned int StateSize(void);
+
+/** StateHash() **********************************************/
+/** Compute HASH_COUNT per-component hashes of the current  **/
+/** emulation state into Hash[], rehashing only dirty RAM   **/
+/** and VRAM pages. Returns the number of hashes computed.  **/
+/*************************************************************/
+unsigned int StateHash(unsigned int *Hash);
+
 /** AddCheat() ***********************************************/
 /** Add a new cheat. Returns 0 on failure or the number of  **/
 /** cheats on success.                                      **/
@@ -250,6 +319,32 @@ void ResetCheats(void);
 /*************************************************************/
 int Cheats(int Switch);
 
+/** PlayPSG() ************************************************/
+/** Close the frame of PSG writes logged since the previous **/
+/** call, to be played as a given number of audio samples.  **/
+/** With ThreadedPSG=1 the audio thread plays it by calling **/
+/** SynthPSG(), otherwise it gets played right away. With   **/
+/** TimedPSG=0, sound has already been flushed and gets     **/
+/** played right away. Returns the number of samples.       **/
+/*************************************************************/
+unsigned int PlayPSG(unsigned int Samples);
+
+/** SynthPSG() ***********************************************/
+/** Render and play the next frame of logged PSG writes, if **/
+/** PlayPSG() has closed it and its samples fit into Free.  **/
+/** Every write takes effect at the sample matching its CPU **/
+/** cycle. Returns 1 if a frame was played, 0 otherwise.    **/
+/** With ThreadedPSG=1, only call it from the audio thread. **/
+/*************************************************************/
+int SynthPSG(unsigned int Free);
+
+/** HoldPSG() ************************************************/
+/** Keep playing current PSG sound for a given number of    **/
+/** samples when the next frame is late. Following frames   **/
+/** get shortened to catch up. Returns samples played.      **/
+/*************************************************************/
+unsigned int HoldPSG(unsigned int Samples);
+
 /** InitMachine() ********************************************/
 /** Allocate resources needed by the machine-dependent code.**/
 /************************************ TO BE WRITTEN BY USER **/
@@ -0,0 +1,316 @@
+/** ColEm: portable Coleco emulator **************************/
+/**                                                         **/
+/**                          Batch.c                        **/
+/**                                                         **/
+/** This file contains the batch runner, which runs every   **/
+/** cartridge in a directory headless, several at a time,   **/
+/** and saves or compares their hashes and speed against a  **/
+/** baseline. The core lives in globals, so each cartridge  **/
+/** runs in its own forked process. Speed is measured in    **/
+/** process CPU time, so that it does not depend on how     **/
+/** many jobs share the CPUs.                               **/
+/**                                                         **/
+/*************************************************************/
+
+#include "Host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define BATCH_LINE   4096          /* Max result line length    */
+
+typedef struct
+{
+  char *Name;                      /* Cartridge file name       */
+  char Line[BATCH_LINE];           /* Its result line           */
+  pid_t PID;                       /* Process running it        */
+  int FD;                          /* Pipe to read results from */
+} BatchRun;
+
+/** IsCartridge() ********************************************/
+/** Check if a file name looks like a cartridge.            **/
+/*************************************************************/
+static int IsCartridge(const char *Name)
+{
+  static const char *Exts[] = { ".rom",".col",".bin",0 };
+  const char *P;
+  int L,J;
+
+  if(!strcasecmp(Name,"COLECO.ROM")) return(0);
+  L = strlen(Name);
+  if((L>3)&&!strcasecmp(Name+L-3,".gz")) L-=3;
+  for(J=0;Exts[J];++J)
+  {
+    P = Name+L-strlen(Exts[J]);
+    if((P>Name)&&!strncasecmp(P,Exts[J],strlen(Exts[J]))) return(1);
+  }
+  return(0);
+}
+
+/** CompareNames() *******************************************/
+/** qsort() helper putting cartridges in name order.        **/
+/*************************************************************/
+static int CompareNames(const void *A,const void *B)
+{
+  return(strcmp(((const BatchRun *)A)->Name,((const BatchRun *)B)->Name));
+}
+
+/** RunChild() ***********************************************/
+/** Run a cartridge in a forked process and write its       **/
+/** result line into FD. Never returns.                     **/
+/*************************************************************/
+static void RunChild(const char *Dir,const char *Name,int FD)
+{
+  char *Path,*Inp,S[BATCH_LINE];
+  HostResult Res;
+  unsigned int J;
+  int N,L;
+
+  Path = malloc(strlen(Dir)+strlen(Name)+2);
+  Inp  = malloc(strlen(Dir)+strlen(Name)+6);
+  if(!Path||!Inp) _exit(1);
+  sprintf(Path,"%s/%s",Dir,Name);
+  sprintf(Inp,"%s.inp",Path);
+
+  /* Per-cartridge input replaces the common one */
+  if(!access(Inp,R_OK)&&!LoadScript(Inp))
+    L = snprintf(S,sizeof(S),"%s\tFAILED\n",Name);
+  else if(!HostRun(Path,&Res))
+    L = snprintf(S,sizeof(S),"%s\tFAILED\n",Name);
+  else
+  {
+    L = snprintf(S,sizeof(S),"%s\t%.1f\t%u",Name,
+      Res.Time>0.0? Res.Frames/Res.Time:0.0,Res.Frames);
+    for(J=0;(J<Res.Count)&&(L<sizeof(S)-40);++J)
+      L+= sprintf(S+L,"\t%u:%08X:%08X:%08X",Res.Check[J].Frame,
+        Res.Check[J].Video,Res.Check[J].Audio,Res.Check[J].State);
+    L+= sprintf(S+L,"\n");
+  }
+
+  N = write(FD,S,L)==L;
+  close(FD);
+  TrashColeco();
+  TrashMachine();
+  _exit(N? 0:1);
+}
+
+/** ReadLine() ***********************************************/
+/** Read a finished run's result line from its pipe.        **/
+/*************************************************************/
+static void ReadLine(BatchRun *R)
+{
+  int N,J;
+
+  for(N=0;(N<BATCH_LINE-1)&&((J=read(R->FD,R->Line+N,BATCH_LINE-1-N))>0);N+=J);
+  R->Line[N]='\0';
+  close(R->FD);
+  R->FD = -1;
+
+  /* No line means the run crashed */
+  if(!N||(R->Line[N-1]!='\n'))
+    snprintf(R->Line,BATCH_LINE,"%s\tFAILED\n",R->Name);
+}
+
+/** FindLine() ***********************************************/
+/** Find a cartridge's line in saved results, or return 0.  **/
+/*************************************************************/
+static char *FindLine(char *Base,const char *Name)
+{
+  int L = strlen(Name);
+  char *P;
+
+  for(P=Base;P&&*P;P=strchr(P,'\n'),P=P? P+1:0)
+    if(!strncmp(P,Name,L)&&(P[L]=='\t')) return(P);
+  return(0);
+}
+
+/** CompareLine() ********************************************/
+/** Compare a result line with the saved one, printing what **/
+/** changed. Returns 1 if there are problems, 0 if not.     **/
+/*************************************************************/
+static int CompareLine(const char *Line,const char *Old,double Slower)
+{
+  unsigned int F1,V1,A1,S1,F2,V2,A2,S2;
+  char Buf[BATCH_LINE];
+  double FPS1,FPS2;
+  const char *P,*Q;
+  int Bad;
+
+  /* Saved line is followed by others, cut it out */
+  for(Bad=0;(Bad<BATCH_LINE-1)&&Old[Bad]&&(Old[Bad]!='\n');++Bad) Buf[Bad]=Old[Bad];
+  Buf[Bad]='\0';
+  Old = Buf;
+
+  P = strchr(Line,'\t')+1;
+  Q = strchr(Old,'\t')+1;
+  if(!strncmp(P,"FAILED",6)) { printf("FAILED\n");return(1); }
+  if(!strncmp(Q,"FAILED",6)) { printf("FIXED\n");return(0); }
+
+  FPS1 = strtod(P,0);
+  FPS2 = strtod(Q,0);
+  P = strchr(P,'\t');P=P? strchr(P+1,'\t'):0;
+  Q = strchr(Q,'\t');Q=Q? strchr(Q+1,'\t'):0;
+
+  /* Report the first checkpoint that differs */
+  for(Bad=0;P&&Q;P=strchr(P+1,'\t'),Q=strchr(Q+1,'\t'))
+  {
+    if(sscanf(P+1,"%u:%X:%X:%X",&F1,&V1,&A1,&S1)!=4) break;
+    if(sscanf(Q+1,"%u:%X:%X:%X",&F2,&V2,&A2,&S2)!=4) break;
+    if((F1!=F2)||(V1!=V2)||(A1!=A2)||(S1!=S2))
+    {
+      printf("CHANGED at frame %u:%s%s%s",F1,V1!=V2? " video":"",
+        A1!=A2? " audio":"",S1!=S2? " state":"");
+      Bad=1;
+      break;
+    }
+  }
+  if(!Bad&&(!P!=!Q)) { printf("CHANGED checkpoints");Bad=1; }
+
+  if((FPS2>0.0)&&(FPS1<FPS2*(1.0-Slower/100.0)))
+  {
+    printf("%sSLOWER %.1f FPS, was %.1f",Bad? ", ":"",FPS1,FPS2);
+    Bad=1;
+  }
+
+  printf(Bad? "\n":"OK\n");
+  return(Bad);
+}
+
+/** LoadFile() ***********************************************/
+/** Load whole text file into a new buffer, or return 0.    **/
+/*************************************************************/
+static char *LoadFile(const char *FileName)
+{
+  char *Buf;
+  long Size;
+  FILE *F;
+
+  if(!(F=fopen(FileName,"rb"))) return(0);
+  fseek(F,0,SEEK_END);
+  Size = ftell(F);
+  rewind(F);
+  if((Size<0)||!(Buf=malloc(Size+1))) { fclose(F);return(0); }
+  Size = fread(Buf,1,Size,F);
+  Buf[Size]='\0';
+  fclose(F);
+  return(Buf);
+}
+
+/** RunBatch() ***********************************************/
+/** Run all cartridges in directory Dir, Jobs at a time.    **/
+/** Save results to SaveName, compare them to CompName, if  **/
+/** given, counting runs under Slower percent as slowdowns. **/
+/** Returns the number of problems found.                   **/
+/*************************************************************/
+int RunBatch(const char *Dir,unsigned int Jobs,const char *SaveName,const char *CompName,double Slower)
+{
+  BatchRun *Runs,*R;
+  unsigned int Count,Max,Next,Busy,J;
+  struct dirent *E;
+  char *Base,*P,*Q;
+  int Pipe[2],Bad;
+  pid_t PID;
+  FILE *F;
+  DIR *D;
+
+  /* Baseline has to be there before running anything */
+  Base = 0;
+  if(CompName&&!(Base=LoadFile(CompName)))
+  { printf("Failed loading %s\n",CompName);return(1); }
+
+  /* Collect cartridges */
+  if(!(D=opendir(Dir))) { printf("Failed opening %s\n",Dir);free(Base);return(1); }
+  for(Runs=0,Count=Max=0;(E=readdir(D));)
+    if(IsCartridge(E->d_name))
+    {
+      if(Count>=Max)
+      {
+        Max = Max? Max*2:64;
+        if(!(R=realloc(Runs,Max*sizeof(BatchRun)))) break;
+        Runs = R;
+      }
+      Runs[Count].Name = strdup(E->d_name);
+      Runs[Count].PID  = 0;
+      Runs[Count].FD   = -1;
+      Runs[Count].Line[0] = '\0';
+      if(Runs[Count].Name) ++Count;
+    }
+  closedir(D);
+  if(Count) qsort(Runs,Count,sizeof(BatchRun),CompareNames);
+
+  if(!Jobs) { long N=sysconf(_SC_NPROCESSORS_ONLN);Jobs=N>0? N:1; }
+  printf("Running %u cartridges from %s, %u at a time...\n",Count,Dir,Jobs);
+
+  /* Keep Jobs processes busy, harvesting them as they end */
+  for(Next=Busy=0,Bad=0;(Next<Count)||Busy;)
+  {
+    if((Next<Count)&&(Busy<Jobs))
+    {
+      R = &Runs[Next++];
+      fflush(stdout);
+      if(pipe(Pipe)||((PID=fork())<0))
+      { snprintf(R->Line,BATCH_LINE,"%s\tFAILED\n",R->Name);continue; }
+      if(!PID) { close(Pipe[0]);RunChild(Dir,R->Name,Pipe[1]); }
+      close(Pipe[1]);
+      R->PID = PID;
+      R->FD  = Pipe[0];
+      ++Busy;
+      continue;
+    }
+
+    if((PID=waitpid(-1,0,0))<=0) break;
+    for(J=0;(J<Count)&&(Runs[J].PID!=PID);++J);
+    if(J<Count) { ReadLine(&Runs[J]);Runs[J].PID=0;--Busy; }
+  }
+
+  /* Report results in name order */
+  for(J=0;J<Count;++J)
+  {
+    R = &Runs[J];
+    printf("%-32s ",R->Name);
+    P = strchr(R->Line,'\t');
+    if(!P) { printf("FAILED\n");++Bad;continue; }
+    if(!strncmp(P+1,"FAILED",6)&&(!Base||!FindLine(Base,R->Name)))
+    { printf("FAILED\n");++Bad; }
+    else if(!Base)
+    {
+      for(Q=P+1;*Q&&(*Q!='\t')&&(*Q!='\n');++Q);
+      printf("%.*s FPS\n",(int)(Q-P-1),P+1);
+    }
+    else if(!(Q=FindLine(Base,R->Name))) printf("NEW\n");
+    else Bad+=CompareLine(R->Line,Q,Slower);
+  }
+
+  /* Cartridges gone since the baseline was saved */
+  if(Base)
+    for(P=Base;P&&*P;P=(P=strchr(P,'\n'))? P+1:0)
+      if((Q=strchr(P,'\t'))&&(Q-P<BATCH_LINE))
+      {
+        for(J=0;(J<Count)&&(strncmp(Runs[J].Name,P,Q-P)||Runs[J].Name[Q-P]);++J);
+        if(J>=Count) { printf("%-32.*s MISSING\n",(int)(Q-P),P);++Bad; }
+      }
+
+  /* Save results */
+  if(SaveName)
+  {
+    if(!(F=fopen(SaveName,"wb"))) { printf("Failed saving %s\n",SaveName);++Bad; }
+    else
+    {
+      for(J=0;J<Count;++J) fputs(Runs[J].Line,F);
+      if(fclose(F)) { printf("Failed saving %s\n",SaveName);++Bad; }
+    }
+  }
+
+  printf("%u cartridges, %d problems\n",Count,Bad);
+
+  for(J=0;J<Count;++J) free(Runs[J].Name);
+  free(Runs);
+  free(Base);
+  return(Bad);
+}
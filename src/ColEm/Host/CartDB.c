@@ -0,0 +1,195 @@
+/** ColEm: portable Coleco emulator **************************/
+/**                                                         **/
+/**                         CartDB.c                        **/
+/**                                                         **/
+/** This file contains a reader for the WiiColem game       **/
+/** settings database (wiicolem.db and wiicolem.db.log),    **/
+/** so that host runs use the same per-game settings as the **/
+/** Wii port. Records are keyed by MD5 of the cartridge.    **/
+/**                                                         **/
+/*************************************************************/
+
+#include "Host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#define DB_LOG_END     "#end"      /* Closes a log record       */
+#define DB_LOG_DELETED "#deleted"  /* Closes a deleted record   */
+
+static const unsigned int MD5K[64] =
+{
+  0xD76AA478,0xE8C7B756,0x242070DB,0xC1BDCEEE,
+  0xF57C0FAF,0x4787C62A,0xA8304613,0xFD469501,
+  0x698098D8,0x8B44F7AF,0xFFFF5BB1,0x895CD7BE,
+  0x6B901122,0xFD987193,0xA679438E,0x49B40821,
+  0xF61E2562,0xC040B340,0x265E5A51,0xE9B6C7AA,
+  0xD62F105D,0x02441453,0xD8A1E681,0xE7D3FBC8,
+  0x21E1CDE6,0xC33707D6,0xF4D50D87,0x455A14ED,
+  0xA9E3E905,0xFCEFA3F8,0x676F02D9,0x8D2A4C8A,
+  0xFFFA3942,0x8771F681,0x6D9D6122,0xFDE5380C,
+  0xA4BEEA44,0x4BDECFA9,0xF6BB4B60,0xBEBFBC70,
+  0x289B7EC6,0xEAA127FA,0xD4EF3085,0x04881D05,
+  0xD9D4D039,0xE6DB99E5,0x1FA27CF8,0xC4AC5665,
+  0xF4292244,0x432AFF97,0xAB9423A7,0xFC93A039,
+  0x655B59C3,0x8F0CCC92,0xFFEFF47D,0x85845DD1,
+  0x6FA87E4F,0xFE2CE6E0,0xA3014314,0x4E0811A1,
+  0xF7537E82,0xBD3AF235,0x2AD7D2BB,0xEB86D391
+};
+
+static const byte MD5R[16] = { 7,12,17,22,5,9,14,20,4,11,16,23,6,10,15,21 };
+
+/** MD5Block() ***********************************************/
+/** Add a 64-byte block at P to MD5 state H.                **/
+/*************************************************************/
+static void MD5Block(unsigned int *H,const byte *P)
+{
+  unsigned int W[16],A,B,C,D,F,T;
+  int J,G;
+
+  for(J=0;J<16;++J,P+=4)
+    W[J]=P[0]|(P[1]<<8)|(P[2]<<16)|((unsigned int)P[3]<<24);
+
+  A=H[0];B=H[1];C=H[2];D=H[3];
+  for(J=0;J<64;++J)
+  {
+    if(J<16)      { F=(B&C)|(~B&D);G=J; }
+    else if(J<32) { F=(D&B)|(~D&C);G=(5*J+1)&15; }
+    else if(J<48) { F=B^C^D;G=(3*J+5)&15; }
+    else          { F=C^(B|~D);G=(7*J)&15; }
+    F+= A+MD5K[J]+W[G];
+    T = MD5R[((J>>4)<<2)|(J&3)];
+    A = D;D=C;C=B;
+    B+= (F<<T)|(F>>(32-T));
+  }
+  H[0]+=A;H[1]+=B;H[2]+=C;H[3]+=D;
+}
+
+/** MD5() ****************************************************/
+/** Compute MD5 of given data into a 33-byte hex string.    **/
+/*************************************************************/
+static void MD5(const byte *Data,unsigned int Size,char *Hex)
+{
+  unsigned int H[4] = { 0x67452301,0xEFCDAB89,0x98BADCFE,0x10325476 };
+  unsigned long long Bits = (unsigned long long)Size<<3;
+  byte Buf[128];
+  unsigned int J,N;
+
+  for(J=0;J+64<=Size;J+=64) MD5Block(H,Data+J);
+
+  /* Pad the tail with 80h, zeros, and 64bit length in bits */
+  N = Size-J;
+  memcpy(Buf,Data+J,N);
+  Buf[N++] = 0x80;
+  J = N<=56? 64:128;
+  memset(Buf+N,0,J-N);
+  for(N=0;N<8;++N) Buf[J-8+N]=(Bits>>(8*N))&0xFF;
+  MD5Block(H,Buf);
+  if(J>64) MD5Block(H,Buf+64);
+
+  for(J=0;J<16;++J) sprintf(Hex+2*J,"%02x",(H[J>>2]>>(8*(J&3)))&0xFF);
+}
+
+/** Trim() ***************************************************/
+/** Remove leading and trailing spaces from a string.       **/
+/*************************************************************/
+static char *Trim(char *S)
+{
+  char *P;
+
+  while(isspace((unsigned char)*S)) ++S;
+  for(P=S+strlen(S);(P>S)&&isspace((unsigned char)P[-1]);--P);
+  *P='\0';
+  return(S);
+}
+
+/** IsRecord() ***********************************************/
+/** Check if line S starts a record, returning its hash in  **/
+/** Hash if so.                                             **/
+/*************************************************************/
+static int IsRecord(const char *S,char *Hash,unsigned int Size)
+{
+  const char *P;
+
+  if((*S!='[')||!(P=strrchr(S,']'))||(P-S-1>=Size)) return(0);
+  memcpy(Hash,S+1,P-S-1);
+  Hash[P-S-1]='\0';
+  return(1);
+}
+
+/** ParseValue() *********************************************/
+/** Parse "key=value" line S into E, if it is a key that    **/
+/** matters to emulation.                                   **/
+/*************************************************************/
+static void ParseValue(char *S,CartDBEntry *E)
+{
+  char *V = strchr(S,'=');
+
+  if(!V) return;
+  *V++='\0';
+  S = Trim(S);
+  V = Trim(V);
+
+  if(!strcmp(S,"flags"))             E->Flags=atoi(V);
+  else if(!strcmp(S,"eeprom"))       E->EEPROM=atoi(V);
+  else if(!strcmp(S,"cycleAdjust"))  E->CycleAdjust=atoi(V);
+  else if(!strcmp(S,"controlsMode")) E->ControlsMode=atoi(V);
+}
+
+/** LookupCartDB() *******************************************/
+/** Find settings for given cartridge data in the WiiColem  **/
+/** database file and its log. Returns 1 if found, 0 if     **/
+/** not.                                                    **/
+/*************************************************************/
+int LookupCartDB(const char *FileName,const byte *Data,unsigned int Size,CartDBEntry *E)
+{
+  char S[256],Hash[64],Key[33],*LogName;
+  CartDBEntry Rec;
+  int Found,InRec;
+  FILE *F;
+
+  memset(E,0,sizeof(*E));
+  MD5(Data,Size,Key);
+  Found = 0;
+
+  /* Look in the database file */
+  if((F=fopen(FileName,"rb")))
+  {
+    for(InRec=0;fgets(S,sizeof(S),F);)
+      if(IsRecord(S,Hash,sizeof(Hash)))
+      {
+        if(InRec) break;
+        InRec = Found = !strcasecmp(Hash,Key);
+      }
+      else if(InRec) ParseValue(S,E);
+    fclose(F);
+  }
+
+  /* Later changes are in the log, last complete record wins */
+  if(!(LogName=malloc(strlen(FileName)+5))) return(Found);
+  strcpy(LogName,FileName);
+  strcat(LogName,".log");
+  F = fopen(LogName,"rb");
+  free(LogName);
+
+  if(F)
+  {
+    for(InRec=0;fgets(S,sizeof(S),F);)
+      if(IsRecord(S,Hash,sizeof(Hash)))
+      {
+        InRec = !strcasecmp(Hash,Key);
+        memset(&Rec,0,sizeof(Rec));
+      }
+      else if(InRec&&!strncmp(S,DB_LOG_END,strlen(DB_LOG_END)))
+      { *E=Rec;Found=1;InRec=0; }
+      else if(InRec&&!strncmp(S,DB_LOG_DELETED,strlen(DB_LOG_DELETED)))
+      { memset(E,0,sizeof(*E));Found=0;InRec=0; }
+      else if(InRec) ParseValue(S,&Rec);
+    fclose(F);
+  }
+
+  return(Found);
+}
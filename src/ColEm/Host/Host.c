@@ -0,0 +1,508 @@
+/** ColEm: portable Coleco emulator **************************/
+/**                                                         **/
+/**                          Host.c                         **/
+/**                                                         **/
+/** This file contains null drivers and a main() procedure  **/
+/** running the emulation headless on a workstation, as     **/
+/** fast as possible, for profiling and testing the core.   **/
+/** Cartridges are loaded and set up the way WiiColem does  **/
+/** it, with scripted input and periodic hashes of video,   **/
+/** audio, and machine state for regression tests.          **/
+/**                                                         **/
+/*************************************************************/
+
+#include "Host.h"
+#include "Sound.h"
+#include "CRC32.h"
+#include "Movie.h"
+#include "Profile.h"
+
+#ifdef PROFZ80
+#include "ProfZ80.h"
+#endif
+
+#ifdef DEBUG
+#include "BreakZ80.h"
+#endif
+
+#ifdef TRACEZ80
+#include "TraceZ80.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define HOST_WIDTH   272           /* Screen buffer width       */
+#define HOST_HEIGHT  200           /* Screen buffer height      */
+#define HOST_RATE    44100         /* Sound sampling rate       */
+#define HOST_FRAMES  3600          /* Default frames to run     */
+#define HOST_AFTER   1000          /* Traced after the trigger  */
+#define HOST_SCRIPT  1024          /* Max scripted input events */
+
+/** WiiColem database values (see src/wii/wii_coleco_db.h) ***/
+#define DB_CART_SRAM        0x00000002
+#define DB_DISABLE_SPINNER  0x00000008
+#define DB_EEPROM_24C08     1
+#define DB_EEPROM_24C256    2
+#define DB_SUPERACTION      1
+#define DB_DRIVING          2
+#define DB_DRIVING_TILT     3
+#define DB_ROLLER           4
+
+static const char *Usage =
+  "Usage: colem-host [-options] <cartridge.rom>\n"
+  "       colem-host [-options] -batch <dir>\n"
+  "  -frames <N>     Run N frames [3600]\n"
+  "  -hash           Print CRC32 of the final frame buffer\n"
+  "  -every <N>      Hash video, audio, and state every N frames\n"
+  "  -input <file>   Scripted input, \"<frame> <keys>\" per line, keys\n"
+  "                  UP DOWN LEFT RIGHT FIREL FIRER K0-K9 STAR POUND\n"
+  "                  NONE or 0x<hex>, joined with '+'\n"
+  "  -db <file>      Apply game settings from wiicolem.db <file>\n"
+  "  -batch <dir>    Run all cartridges in <dir>, using <rom>.inp\n"
+  "                  files as their scripted input, if present\n"
+  "  -jobs <N>       Run N cartridges at once [all CPUs]\n"
+  "  -save <file>    Save batch results to <file>\n"
+  "  -compare <file> Compare batch results to <file>\n"
+  "  -slower <pct>   Report runs slower than saved by <pct>% [10]\n"
+  "  -pal/-ntsc      Emulate PAL/NTSC video [NTSC]\n"
+  "  -nosound        Do not render sound\n"
+  "  -home <dir>     Directory with COLECO.ROM [.]\n"
+  "  -record <file>  Record a movie with state hashes\n"
+  "  -play <file>    Play a movie back, checking hashes\n"
+  "  -seek <N>       Play back from the keyframe before frame N\n"
+#ifdef PROFZ80
+  "  -prof <file>    Save guest profile to <file> (callgrind)\n"
+  "                  and <file>.txt (text report)\n"
+#endif
+#ifdef DEBUG
+  "  -break <addr>   Enter debugger when executing <addr>\n"
+  "  -watch <addr>   Enter debugger when writing RAM <addr>\n"
+#endif
+#ifdef TRACEZ80
+  "  -trace <file>   Save instruction trace to <file>\n"
+  "  -trigger <addr> Stop tracing soon after executing <addr>\n"
+#endif
+  "  -verbose <lvl>  Debug messages level [0]\n";
+
+static const struct { const char *Name;unsigned int Joy; } Keys[] =
+{
+  { "UP",JST_UP },{ "DOWN",JST_DOWN },{ "LEFT",JST_LEFT },
+  { "RIGHT",JST_RIGHT },{ "FIREL",JST_FIREL },{ "FIRER",JST_FIRER },
+  { "K0",JST_0 },{ "K1",JST_1 },{ "K2",JST_2 },{ "K3",JST_3 },
+  { "K4",JST_4 },{ "K5",JST_5 },{ "K6",JST_6 },{ "K7",JST_7 },
+  { "K8",JST_8 },{ "K9",JST_9 },{ "STAR",JST_STAR },
+  { "POUND",JST_POUND },{ "NONE",0 },{ 0,0 }
+};
+
+static pixel Screen[HOST_WIDTH*HOST_HEIGHT]; /* Frame buffer  */
+static unsigned int Frames   = 0;  /* Frames emulated so far    */
+unsigned int MaxFrames = HOST_FRAMES; /* Frames to run          */
+unsigned int CheckStep = 0;        /* Frames between checks     */
+const char *DBName     = 0;        /* wiicolem.db file, or 0    */
+static const char *Cart      = 0;  /* Cartridge being run       */
+static HostResult *Result    = 0;  /* Its results go here       */
+static int Loaded            = 0;  /* 1: loaded, -1: failed     */
+static unsigned int AudioCRC = 0;  /* CRC32 of sound so far     */
+static struct { unsigned int Frame,Joy; } Script[HOST_SCRIPT];
+static unsigned int ScrCount = 0;  /* Scripted input events     */
+static unsigned int ScrPos   = 0;  /* Next event to apply       */
+static unsigned int JoyNow   = 0;  /* Current scripted input    */
+static unsigned int Samples  = 0;  /* Sound samples per frame   */
+static int UseSound          = HOST_RATE; /* 0: no sound        */
+static const char *MovName  = 0;   /* Movie file, if any        */
+#ifdef PROFZ80
+static const char *ProfName = 0;   /* Guest profile file, if any*/
+#endif
+#ifdef TRACEZ80
+static const char *TrcName  = 0;   /* Trace file, if any        */
+#endif
+static int MovMode          = MOV_OFF; /* MOV_RECORD/MOV_PLAY   */
+static unsigned int SeekTo  = 0;   /* Movie frame to start at   */
+static struct timespec Start;      /* CPU time at the 1st frame */
+
+/** Null Audio Driver ****************************************/
+/** Takes any amount of samples and only hashes them.       **/
+/*************************************************************/
+unsigned int InitAudio(unsigned int Rate,unsigned int Latency) { return(Rate); }
+void TrashAudio(void) {}
+int PauseAudio(int Switch) { return(Switch); }
+unsigned int GetFreeAudio(void) { return(Samples); }
+unsigned int WriteAudio(sample *Data,unsigned int Length)
+{
+  AudioCRC = ComputeCRC32(AudioCRC,(byte *)Data,Length*sizeof(sample));
+  return(Length);
+}
+
+/** InitMachine() ********************************************/
+/** Allocate resources needed by machine-dependent code.    **/
+/*************************************************************/
+int InitMachine(void)
+{
+  ScrWidth  = HOST_WIDTH;
+  ScrHeight = HOST_HEIGHT;
+  ScrBuffer = Screen;
+
+  InitSound(UseSound,150);
+  SetChannels(255/SN76489_CHANNELS,(1<<(SN76489_CHANNELS+AY8910_CHANNELS))-1);
+  return(1);
+}
+
+/** TrashMachine() *******************************************/
+/** Deallocate all resources taken by InitMachine().        **/
+/*************************************************************/
+void TrashMachine(void)
+{
+  TrashSound();
+#ifdef TRACEZ80
+  TraceZ80Trash();
+#endif
+}
+
+/** SetColor() ***********************************************/
+/** Allocate a given color. With 8bit pixels, the color is  **/
+/** its own palette index.                                  **/
+/*************************************************************/
+int SetColor(byte N,byte R,byte G,byte B) { return(N); }
+
+/** RefreshScreen() ******************************************/
+/** Nothing is shown, the frame buffer is left for -hash.   **/
+/*************************************************************/
+void RefreshScreen(void *Buffer,int Width,int Height) {}
+
+/** Mouse() **************************************************/
+/** There is no mouse, spinners stay centered.              **/
+/*************************************************************/
+unsigned int Mouse(void) { return(0); }
+
+/** LoadCart() ***********************************************/
+/** Load cartridge and apply its WiiColem database entry,   **/
+/** the same way wii_start_emulation() does.                **/
+/*************************************************************/
+static int LoadCart(const char *Cartridge)
+{
+  CartDBEntry E;
+  int Size;
+
+  if(!(Size=LoadROM(Cartridge))) return(0);
+  if(!DBName||!LookupCartDB(DBName,ROM_CARTRIDGE,Size,&E)) return(1);
+
+  /* Memory adjustments based on cartridge settings */
+  ResetColeco(
+    (Mode&~(CV_EEPROM|CV_SRAM))
+  | (E.Flags&DB_CART_SRAM? CV_SRAM:0)
+  | (E.EEPROM==DB_EEPROM_24C256? CV_24C256
+    :E.EEPROM==DB_EEPROM_24C08?  CV_24C08:(Mode&CV_EEPROM))
+  );
+
+  /* Cycle period */
+  CPU.IPeriod = (Mode&CV_PAL? TMS9929_LINE:TMS9918_LINE)+E.CycleAdjust;
+
+  /* Spinner controls */
+  Mode &= ~CV_SPINNERS;
+  if((E.ControlsMode==DB_DRIVING)||(E.ControlsMode==DB_DRIVING_TILT)
+   ||(E.ControlsMode==DB_ROLLER)
+   ||((E.ControlsMode==DB_SUPERACTION)&&!(E.Flags&DB_DISABLE_SPINNER)))
+  {
+    Mode|=CV_SPINNER1X;
+    if((E.ControlsMode!=DB_DRIVING)&&(E.ControlsMode!=DB_DRIVING_TILT))
+      Mode|=CV_SPINNER2Y;
+  }
+
+  return(1);
+}
+
+/** Checkpoint() *********************************************/
+/** Hash video, audio, and machine state after this frame.  **/
+/** The last frame always gets the last slot.               **/
+/*************************************************************/
+static void Checkpoint(void)
+{
+  unsigned int H[HASH_COUNT];
+  HostCheck *C;
+  int N;
+
+  if(!Result) return;
+  if(Result->Count<HOST_CHECKS) C=&Result->Check[Result->Count++];
+  else if(Frames>=MaxFrames)    C=&Result->Check[HOST_CHECKS-1];
+  else return;
+
+  N = StateHash(H);
+  C->Frame = Frames;
+  C->Video = ComputeCRC32(0,(byte *)Screen,sizeof(Screen));
+  C->Audio = AudioCRC;
+  C->State = ComputeCRC32(0,(byte *)H,N*sizeof(H[0]));
+}
+
+/** Joystick() ***********************************************/
+/** Called once per frame. Loads the cartridge on the first **/
+/** call, then closes the frame of sound, runs the movie or **/
+/** scripted input, takes checkpoints, and ends emulation   **/
+/** after MaxFrames frames.                                 **/
+/*************************************************************/
+unsigned int Joystick(void)
+{
+  unsigned int N;
+
+  /* Load cartridge after the first frame of BIOS, as on Wii */
+  if(!Loaded)
+  {
+    if(!LoadCart(Cart)) { Loaded=-1;ExitNow=1;return(0); }
+    Loaded=1;
+
+    /* Start movie from the first frame, after the reset */
+    if(MovMode==MOV_RECORD)
+    {
+      if(!MOVRecord(MovName)) printf("Failed recording %s\n",MovName);
+    }
+    else if(MovMode==MOV_PLAY)
+    {
+      if(!MOVPlay(MovName)) printf("Failed playing %s\n",MovName);
+      else if(SeekTo)
+      {
+        /* Play on from the last keyframe before SeekTo */
+        if((N=MOVSeek(SeekTo))==MOV_ENDED)
+        { printf("Failed seeking to frame %u\n",SeekTo);Loaded=-1;ExitNow=1;return(0); }
+        printf("Playing from keyframe at frame %u, %u frames before frame %u\n",MOVFrame(),N,SeekTo);
+      }
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&Start);
+    return(0);
+  }
+
+  if(UseSound)
+  {
+    PRF_ENTER(PRF_AUDIO);
+    PlayPSG(Samples);
+    PRF_LEAVE();
+  }
+
+  /* Apply scripted input due by this frame */
+  for(;(ScrPos<ScrCount)&&(Script[ScrPos].Frame<=Frames);++ScrPos)
+    JoyNow=Script[ScrPos].Joy;
+
+  if(++Frames>=MaxFrames) ExitNow=1;
+  if((Frames>=MaxFrames)||(CheckStep&&!(Frames%CheckStep))) Checkpoint();
+  return(JoyNow);
+}
+
+/** LoadScript() *********************************************/
+/** Load scripted input from a given file, or drop it when  **/
+/** FileName=0. Returns 1 on success, 0 on failure.         **/
+/*************************************************************/
+int LoadScript(const char *FileName)
+{
+  char S[256],*P;
+  unsigned int Frame,Joy,Line;
+  int J;
+  FILE *F;
+
+  ScrCount = 0;
+  if(!FileName) return(1);
+  if(!(F=fopen(FileName,"rb"))) return(0);
+
+  for(Line=1;fgets(S,sizeof(S),F);++Line)
+  {
+    if((P=strchr(S,'#'))) *P='\0';
+    if(!(P=strtok(S," \t\r\n"))) continue;
+    Frame = strtoul(P,0,0);
+
+    /* Keys are joined with '+', separate tokens add up too */
+    for(Joy=0;(P=strtok(0,"+ \t\r\n"));)
+      if(!strncmp(P,"0x",2)) Joy|=strtoul(P,0,16);
+      else
+      {
+        for(J=0;Keys[J].Name&&strcasecmp(P,Keys[J].Name);++J);
+        if(!Keys[J].Name)
+        {
+          printf("%s:%u: Unknown key '%s'\n",FileName,Line,P);
+          fclose(F);ScrCount=0;return(0);
+        }
+        Joy|=Keys[J].Joy;
+      }
+
+    /* Keep events in frame order */
+    if(ScrCount>=HOST_SCRIPT)
+    {
+      printf("%s:%u: More than %d input events\n",FileName,Line,HOST_SCRIPT);
+      fclose(F);ScrCount=0;return(0);
+    }
+    for(J=ScrCount;(J>0)&&(Script[J-1].Frame>Frame);--J) Script[J]=Script[J-1];
+    Script[J].Frame = Frame;
+    Script[J].Joy   = Joy;
+    ++ScrCount;
+  }
+
+  fclose(F);
+  return(1);
+}
+
+/** HostRun() ************************************************/
+/** Run given cartridge for MaxFrames frames, as WiiColem   **/
+/** does: load it with LoadROM() and apply its settings     **/
+/** from DBName. Returns 1 on success, 0 on failure.        **/
+/*************************************************************/
+int HostRun(const char *Cartridge,HostResult *Res)
+{
+  struct timespec End;
+
+  memset(Res,0,sizeof(*Res));
+  Cart     = Cartridge;
+  Result   = Res;
+  Frames   = 0;
+  Loaded   = 0;
+  AudioCRC = 0;
+  ScrPos   = 0;
+  JoyNow   = 0;
+
+  /* One frame of sound goes out with each Joystick() call */
+  Samples = UseSound/(Mode&CV_PAL? TMS9929_FRAMES:TMS9918_FRAMES);
+
+  /* Draw every frame, so that the whole renderer is run */
+  UPeriod = 100;
+
+  if(!InitMachine()) return(0);
+  if(!StartColeco(0)||(Loaded<=0)) return(0);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&End);
+
+  Res->Frames = Frames;
+  Res->Time   = (End.tv_sec-Start.tv_sec)+(End.tv_nsec-Start.tv_nsec)/1000000000.0;
+  return(1);
+}
+
+/** main() ***************************************************/
+/** Parse command line arguments, run the emulation, and    **/
+/** print out the results.                                  **/
+/*************************************************************/
+int main(int argc,char *argv[])
+{
+  const char *CartName = 0;
+  const char *BatchDir = 0;
+  const char *SaveName = 0;
+  const char *CompName = 0;
+  const char *InpName  = 0;
+  unsigned int Jobs = 0;
+  double Slower = 10.0;
+  int ShowHash = 0;
+  HostResult Res;
+  double Time;
+  unsigned int F;
+  int N,J;
+
+  Verbose = 0;
+
+  for(N=1;N<argc;++N)
+    if(*argv[N]!='-') CartName=argv[N];
+    else if(!strcmp(argv[N],"-frames")&&(N+1<argc)) MaxFrames=atoi(argv[++N]);
+    else if(!strcmp(argv[N],"-hash"))               ShowHash=1;
+    else if(!strcmp(argv[N],"-every")&&(N+1<argc))  CheckStep=atoi(argv[++N]);
+    else if(!strcmp(argv[N],"-input")&&(N+1<argc))  InpName=argv[++N];
+    else if(!strcmp(argv[N],"-db")&&(N+1<argc))     DBName=argv[++N];
+    else if(!strcmp(argv[N],"-batch")&&(N+1<argc))  BatchDir=argv[++N];
+    else if(!strcmp(argv[N],"-jobs")&&(N+1<argc))   Jobs=atoi(argv[++N]);
+    else if(!strcmp(argv[N],"-save")&&(N+1<argc))   SaveName=argv[++N];
+    else if(!strcmp(argv[N],"-compare")&&(N+1<argc)) CompName=argv[++N];
+    else if(!strcmp(argv[N],"-slower")&&(N+1<argc)) Slower=atof(argv[++N]);
+    else if(!strcmp(argv[N],"-pal"))                Mode|=CV_PAL;
+    else if(!strcmp(argv[N],"-ntsc"))               Mode&=~CV_PAL;
+    else if(!strcmp(argv[N],"-nosound"))            UseSound=0;
+    else if(!strcmp(argv[N],"-home")&&(N+1<argc))   HomeDir=argv[++N];
+    else if(!strcmp(argv[N],"-record")&&(N+1<argc)) { MovName=argv[++N];MovMode=MOV_RECORD; }
+    else if(!strcmp(argv[N],"-play")&&(N+1<argc))   { MovName=argv[++N];MovMode=MOV_PLAY; }
+    else if(!strcmp(argv[N],"-seek")&&(N+1<argc))   SeekTo=atoi(argv[++N]);
+    else if(!strcmp(argv[N],"-verbose")&&(N+1<argc)) Verbose=atoi(argv[++N]);
+#ifdef PROFZ80
+    else if(!strcmp(argv[N],"-prof")&&(N+1<argc))   ProfName=argv[++N];
+#endif
+#ifdef DEBUG
+    else if(!strcmp(argv[N],"-break")&&(N+1<argc))
+      SetBreakZ80(BRK_MEM,strtoul(argv[++N],0,16),BRK_EXEC);
+    else if(!strcmp(argv[N],"-watch")&&(N+1<argc))
+      SetBreakZ80(BRK_MEM,strtoul(argv[++N],0,16),BRK_WRITE);
+#endif
+#ifdef TRACEZ80
+    else if(!strcmp(argv[N],"-trace")&&(N+1<argc))  TrcName=argv[++N];
+    else if(!strcmp(argv[N],"-trigger")&&(N+1<argc))
+      TraceZ80Trigger(strtoul(argv[++N],0,16),HOST_AFTER);
+#endif
+    else { fputs(Usage,stderr);return(1); }
+
+  if(!(CartName||BatchDir)||!MaxFrames) { fputs(Usage,stderr);return(1); }
+
+  if(InpName&&!LoadScript(InpName))
+  { printf("Failed loading %s\n",InpName);return(1); }
+
+  /* Batch runs fork for each cartridge, nothing else applies */
+  if(BatchDir) return(RunBatch(BatchDir,Jobs,SaveName,CompName,Slower)? 1:0);
+
+  if(MovMode)
+  {
+    if(!MOVInit(SaveState,LoadState,MAX_STASIZE,MOV_KEYSTEP))
+    { printf("Failed initializing movies\n");return(1); }
+    MOVHash(StateHash);
+  }
+
+#ifdef TRACEZ80
+  if(TrcName&&!TraceZ80Init(TRACEZ80_SIZE))
+  { printf("Failed initializing trace\n");return(1); }
+#endif
+
+  J = HostRun(CartName,&Res);
+  if(!J) printf("Failed running %s\n",CartName);
+
+  if(J&&Frames)
+  {
+    Time = Res.Time;
+    printf("%u frames in %.3fs CPU, %.1f FPS\n",Frames,Time,Time>0.0? Frames/Time:0.0);
+    if(ShowHash)
+      printf("Frame buffer CRC32: %08X\n",ComputeCRC32(0,(byte *)Screen,sizeof(Screen)));
+    if(CheckStep)
+      for(F=0;F<Res.Count;++F)
+        printf("Frame %6u: video %08X audio %08X state %08X\n",Res.Check[F].Frame,
+          Res.Check[F].Video,Res.Check[F].Audio,Res.Check[F].State);
+    if(MovMode==MOV_PLAY)
+    {
+      N = MOVDiverged(&F);
+      if(N) printf("Movie diverged at frame %u in %s state\n",F,N<=HASH_COUNT? HashNames[N-1]:"?");
+      else  printf("Movie matched the recording\n");
+      J = !N;
+    }
+#ifdef PROFILE
+    {
+      PRFStats S;
+      PRFGetStats(&S);
+      printf("Last %u frames, per frame:\n",PRF_PERIOD);
+      for(N=0;N<PRF_SECTIONS;++N)
+        printf("  %-8s %8.3fms %5.1f%% %8u calls\n",PRFNames[N],S.Time[N]/1000.0,
+          S.Frame? S.Time[N]*100.0/S.Frame:0.0,S.Count[N]);
+      printf("  %-8s %8.3fms (max %.3fms)\n","Frame",S.Frame/1000.0,S.MaxFrame/1000.0);
+    }
+#endif
+  }
+
+#ifdef PROFZ80
+  if(ProfName)
+  {
+    char *T = malloc(strlen(ProfName)+5);
+    if(!ProfZ80Save(ProfName)) printf("Failed saving %s\n",ProfName);
+    if(T)
+    {
+      strcpy(T,ProfName);strcat(T,".txt");
+      if(!ProfZ80Report(T)) printf("Failed saving %s\n",T);
+      free(T);
+    }
+  }
+#endif
+
+#ifdef TRACEZ80
+  if(TrcName&&!TraceZ80Save(TrcName)) printf("Failed saving %s\n",TrcName);
+#endif
+
+  MOVTrash();
+  TrashColeco();
+  TrashMachine();
+  return(J? 0:1);
+}
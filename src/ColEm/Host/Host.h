@@ -0,0 +1,84 @@
+/** ColEm: portable Coleco emulator **************************/
+/**                                                         **/
+/**                          Host.h                         **/
+/**                                                         **/
+/** This file contains declarations shared by the headless  **/
+/** host build modules: single runs (Host.c), batch runs    **/
+/** over a ROM directory (Batch.c), and the WiiColem game   **/
+/** settings reader (CartDB.c).                             **/
+/**                                                         **/
+/*************************************************************/
+#ifndef HOST_H
+#define HOST_H
+
+#include "Coleco.h"
+
+#define HOST_CHECKS  64            /* Max checkpoints per run   */
+
+/** HostCheck ************************************************/
+/** Hashes taken at a checkpoint, after given frame.        **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Frame;              /* Frames run so far         */
+  unsigned int Video;              /* CRC32 of frame buffer     */
+  unsigned int Audio;              /* CRC32 of all sound so far */
+  unsigned int State;              /* CRC32 of StateHash()      */
+} HostCheck;
+
+/** HostResult ***********************************************/
+/** Results of running one cartridge.                       **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Frames;             /* Frames run                */
+  double Time;                     /* CPU seconds they took     */
+  unsigned int Count;              /* Checkpoints taken         */
+  HostCheck Check[HOST_CHECKS];
+} HostResult;
+
+/** CartDBEntry **********************************************/
+/** WiiColem game settings that affect emulation. See       **/
+/** src/wii/wii_coleco_db.h for their values.               **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Flags;              /* CART_SRAM, etc.           */
+  int EEPROM;                      /* EEPROM_24C08, etc.        */
+  int CycleAdjust;                 /* Added to CPU.IPeriod      */
+  int ControlsMode;                /* CONTROLS_MODE_DRIVING, ...*/
+} CartDBEntry;
+
+extern unsigned int MaxFrames;     /* Frames to run             */
+extern unsigned int CheckStep;     /* Frames between checks     */
+extern const char *DBName;         /* wiicolem.db file, or 0    */
+
+/** HostRun() ************************************************/
+/** Run given cartridge for MaxFrames frames, as WiiColem   **/
+/** does: load it with LoadROM() and apply its settings     **/
+/** from DBName. Returns 1 on success, 0 on failure.        **/
+/*************************************************************/
+int HostRun(const char *Cartridge,HostResult *Res);
+
+/** LoadScript() *********************************************/
+/** Load scripted input from a given file, or drop it when  **/
+/** FileName=0. Returns 1 on success, 0 on failure.         **/
+/*************************************************************/
+int LoadScript(const char *FileName);
+
+/** RunBatch() ***********************************************/
+/** Run all cartridges in directory Dir, Jobs at a time.    **/
+/** Save results to SaveName, compare them to CompName, if  **/
+/** given, counting runs under Slower percent as slowdowns. **/
+/** Returns the number of problems found.                   **/
+/*************************************************************/
+int RunBatch(const char *Dir,unsigned int Jobs,const char *SaveName,const char *CompName,double Slower);
+
+/** LookupCartDB() *******************************************/
+/** Find settings for given cartridge data in the WiiColem  **/
+/** database file and its log. Returns 1 if found, 0 if     **/
+/** not.                                                    **/
+/*************************************************************/
+int LookupCartDB(const char *FileName,const byte *Data,unsigned int Size,CartDBEntry *E);
+
+#endif /* HOST_H */
@@ -0,0 +1,155 @@
+/** ColEm: portable Coleco emulator **************************/
+/**                                                         **/
+/**                        SndBench.c                       **/
+/**                                                         **/
+/** This file contains the audio renderer benchmark. It     **/
+/** plays randomized tones and noise through RenderAudio()  **/
+/** and RenderAndPlayAudio() from Sound.c, and prints the   **/
+/** throughput and a hash of the output of every case, so   **/
+/** that renderer changes can be checked for bit-exactness. **/
+/**                                                         **/
+/*************************************************************/
+
+#include "Sound.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_RATE    48000        /* Sampling rate             */
+#define BENCH_FRAME   800          /* Samples between changes   */
+#define BENCH_SAMPLES 4800000      /* Default samples per case  */
+
+static const char *Usage =
+  "Usage: sndbench [-options]\n"
+  "  -samples <N>    Render N samples in each case [4800000]\n";
+
+static const struct
+{
+  const char *Name;                /* Case shown in the report  */
+  int Voices;                      /* Tone channels             */
+  int Noises;                      /* Noise channels            */
+  int MaxFreq;                     /* Highest tone (Hz)         */
+  int Play;                        /* 1: RenderAndPlayAudio()   */
+} Cases[] =
+{
+  { "3 tones <= 500Hz + noise, render",    3,1,500,0 },
+  { "3 tones <= 2kHz + noise, render",     3,1,2000,0 },
+  { "3 tones <= 8kHz + noise, render",     3,1,8000,0 },
+  { "6 tones <= 2kHz + 4 noise, play",     6,4,2000,1 },
+  { 0,0,0,0,0 }
+};
+
+static unsigned int Seed;          /* Random number generator   */
+static unsigned int Hash;          /* FNV-1a hash of the output */
+
+/** HASH() ***************************************************/
+/** Add a value to Hash. Values are hashed whole, to keep   **/
+/** hashing cheap next to the renderer.                     **/
+/*************************************************************/
+#define HASH(V) Hash=(Hash^(unsigned int)(V))*16777619u
+
+/** Null Audio Driver ****************************************/
+/** Takes any amount of samples and only hashes them.       **/
+/*************************************************************/
+unsigned int InitAudio(unsigned int Rate,unsigned int Latency) { return(Rate); }
+void TrashAudio(void) {}
+int PauseAudio(int Switch) { return(Switch); }
+unsigned int GetFreeAudio(void) { return(BENCH_FRAME); }
+unsigned int WriteAudio(sample *Data,unsigned int Length)
+{
+  unsigned int J;
+
+  for(J=0;J<Length;++J) HASH(Data[J]);
+  return(Length);
+}
+
+/** Random() *************************************************/
+/** Returns the next pseudo-random number in 0..N-1. Same   **/
+/** sequence on every run, so cases are reproducible.       **/
+/*************************************************************/
+static unsigned int Random(unsigned int N)
+{
+  Seed = Seed*1103515245+12345;
+  return((Seed>>8)%N);
+}
+
+/** RunCase() ************************************************/
+/** Run given case for given number of samples. Returns the **/
+/** CPU time taken, in seconds.                             **/
+/*************************************************************/
+static double RunCase(int N,unsigned int Samples)
+{
+  struct timespec Start,End;
+  int Buf[256];
+  unsigned int I,J,K,L,C,V;
+
+  /* Tones first, noise channels after them */
+  V = Cases[N].Voices+Cases[N].Noises;
+  for(C=0;C<V;++C)
+  {
+    SetSound(C,C<Cases[N].Voices? SND_MELODIC:SND_NOISE);
+    Sound(C,0,0);
+  }
+  for(;C<SND_CHANNELS;++C) Sound(C,0,0);
+  SetChannels(255/V,(1<<V)-1);
+  SetNoise(0x0001,14,13);
+
+  Seed = 1;
+  Hash = 2166136261u;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&Start);
+
+  for(I=0;I<Samples;I+=K)
+  {
+    /* New tones and volumes on every frame */
+    for(C=0;C<V;++C)
+      Sound(C,
+        C<Cases[N].Voices? 100+Random(Cases[N].MaxFreq-99):1000+Random(20000),
+        Random(256)
+      );
+
+    K = Samples-I<BENCH_FRAME? Samples-I:BENCH_FRAME;
+    if(Cases[N].Play) RenderAndPlayAudio(K);
+    else
+      for(J=0;J<K;J+=C)
+      {
+        C = K-J<256? K-J:256;
+        memset(Buf,0,C*sizeof(int));
+        RenderAudio(Buf,C);
+        for(L=0;L<C;++L) HASH(Buf[L]);
+      }
+  }
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&End);
+  return((End.tv_sec-Start.tv_sec)+(End.tv_nsec-Start.tv_nsec)/1000000000.0);
+}
+
+/** main() ***************************************************/
+/** Run all cases and print their throughput and hashes.    **/
+/*************************************************************/
+int main(int argc,char *argv[])
+{
+  unsigned int Samples = BENCH_SAMPLES;
+  double T;
+  int N;
+
+  for(N=1;N<argc;++N)
+    if(!strcmp(argv[N],"-samples")&&(N+1<argc)) Samples=strtoul(argv[++N],0,0);
+    else { fputs(Usage,stderr);return(1); }
+
+  if(!InitSound(BENCH_RATE,150)) { printf("Failed initializing sound\n");return(1); }
+
+  printf("%u samples per case at %dHz\n",Samples,BENCH_RATE);
+  for(N=0;Cases[N].Name;++N)
+  {
+    T = RunCase(N,Samples);
+    printf(
+      "  %-36s %7.1f Msamples/s  hash %08X\n",
+      Cases[N].Name,T>0? Samples/T/1000000.0:0.0,Hash
+    );
+  }
+
+  TrashSound();
+  return(0);
+}
@@ -0,0 +1,123 @@
+/** ColEm: portable Coleco emulator **************************/
+/**                                                         **/
+/**                         Z80Trace.c                      **/
+/**                                                         **/
+/** This file contains the offline decoder for binary trace **/
+/** files saved by TraceZ80Save(). It prints one line per   **/
+/** instruction, disassembled by DAsm() from the opcode     **/
+/** bytes kept in the trace.                                **/
+/**                                                         **/
+/*************************************************************/
+
+#include "TraceZ80.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GetINT(P) \
+  ((P)[0]|((P)[1]<<8)|((P)[2]<<16)|((unsigned int)(P)[3]<<24))
+
+#define GetWORD(P) \
+  ((word)((P)[0]|((P)[1]<<8)))
+
+static const char *Usage =
+  "Usage: z80trace [-options] <file.trc>\n"
+  "  -skip <N>       Skip first N entries [0]\n"
+  "  -count <N>      Print at most N entries [all]\n";
+
+static TraceZ80Entry Cur;          /* Entry being disassembled  */
+
+/** RdZ80() **************************************************/
+/** DAsm() calls this to read opcode bytes, which only come **/
+/** from the entry being disassembled.                      **/
+/*************************************************************/
+byte RdZ80(word A) { return(Cur.Op[(word)(A-Cur.PC)&3]); }
+
+/** Print() **************************************************/
+/** Print out Cur, that took given number of cycles, or -1  **/
+/** if unknown, at cycle Clock.                             **/
+/*************************************************************/
+static void Print(unsigned int Clock,int Cycles)
+{
+  char S[128],B[16],C[16];
+  int J,L;
+
+  L = DAsm(S,Cur.PC);
+  for(J=0,*B='\0';(J<L)&&(J<4);++J) sprintf(B+3*J,"%02X ",Cur.Op[J]);
+  if(Cycles<0) strcpy(C,"?"); else sprintf(C,"%d",Cycles);
+
+  printf
+  (
+    "%10u %6s %04X %-12s%-20s %04X %04X %04X %04X %04X %04X %04X\n",
+    Clock,C,Cur.PC,B,S,Cur.AF,Cur.BC,Cur.DE,Cur.HL,Cur.IX,Cur.IY,Cur.SP
+  );
+}
+
+/** main() ***************************************************/
+/** Parse command line arguments and print out the trace.   **/
+/** Each entry is printed once the next one is read, to     **/
+/** know the cycles it took.                                **/
+/*************************************************************/
+int main(int argc,char *argv[])
+{
+  const char *Name = 0;
+  unsigned int Skip  = 0;
+  unsigned int Count = 0xFFFFFFFF;
+  unsigned int Entries,First,J;
+  byte Buf[TRACEZ80_ENTRY];
+  TraceZ80Entry Next;
+  FILE *F;
+  int N;
+
+  for(N=1;N<argc;++N)
+    if(*argv[N]!='-') Name=argv[N];
+    else if(!strcmp(argv[N],"-skip")&&(N+1<argc))  Skip=strtoul(argv[++N],0,0);
+    else if(!strcmp(argv[N],"-count")&&(N+1<argc)) Count=strtoul(argv[++N],0,0);
+    else { fputs(Usage,stderr);return(1); }
+
+  if(!Name) { fputs(Usage,stderr);return(1); }
+  if(!(F=fopen(Name,"rb"))) { printf("Failed opening %s\n",Name);return(1); }
+
+  /* Check header */
+  if((fread(Buf,1,12,F)!=12)||memcmp(Buf,"TRZ\032\001",5))
+  { printf("%s is not a trace file\n",Name);fclose(F);return(1); }
+  Entries = GetINT(Buf+8);
+
+  printf("; %s: %u entries\n",Name,Entries);
+  printf(";    Cycle Cycles PC  Bytes       Instruction          AF   BC   DE   HL   IX   IY   SP\n");
+
+  for(J=0,First=0;J<Entries;++J)
+  {
+    if(fread(Buf,1,TRACEZ80_ENTRY,F)!=TRACEZ80_ENTRY)
+    { printf("; Trace cut off at entry %u\n",J);break; }
+
+    Next.Clock = GetINT(Buf);
+    Next.PC    = GetWORD(Buf+2*2);
+    Next.SP    = GetWORD(Buf+2*3);
+    Next.AF    = GetWORD(Buf+2*4);
+    Next.BC    = GetWORD(Buf+2*5);
+    Next.DE    = GetWORD(Buf+2*6);
+    Next.HL    = GetWORD(Buf+2*7);
+    Next.IX    = GetWORD(Buf+2*8);
+    Next.IY    = GetWORD(Buf+2*9);
+    memcpy(Next.Op,Buf+20,4);
+
+    /* Cycles are counted from the first entry */
+    if(!J) First=Next.Clock;
+    else if(J>Skip)
+    {
+      if(!Count) break;
+      Print(Cur.Clock-First,Next.Clock-Cur.Clock);
+      --Count;
+    }
+
+    Cur = Next;
+  }
+
+  /* Last entry took unknown number of cycles */
+  if((J>Skip)&&Count) Print(Cur.Clock-First,-1);
+
+  fclose(F);
+  return(0);
+}
@@ -49,45 +49,137 @@
   if(Size+(DataSize)>MaxSize) return(0); \
   else Size+=(DataSize)
 
+#define SaveINT(Value) \
+  { unsigned int V=(Value);memcpy(P,&V,sizeof(V));P+=sizeof(V); }
+
+#define LoadINT() \
+  (memcpy(&V,P,sizeof(V)),P+=sizeof(V),V)
+
+#define HW_STATE 256*sizeof(unsigned int) /* Hardware state size */
+
+/** StaBuf[] *************************************************/
+/** Scratch buffer used by SaveSTA() and LoadSTA(), so that **/
+/** they do not need to allocate memory on every call.      **/
+/*************************************************************/
+static byte StaBuf[MAX_STASIZE];
+static byte StaTmp[MAX_STASIZE];
+
+/** .STA files ***********************************************/
+/** A 16-byte header ("STF\032\003", CV_ADAM bit, 32bit ROM **/
+/** CRC, byte order) is followed by chunks, one per state   **/
+/** component: 4-byte tag, 32bit stored size, 32bit size,   **/
+/** then data. Stored size is smaller when data has been    **/
+/** compressed with ZLIB. Sizes are little-endian, while    **/
+/** components are stored in host byte order.               **/
+/** Version 2 files ("STF\032\002") hold raw SaveState()    **/
+/** data after the header.                                  **/
+/*************************************************************/
+#define STA_BIGENDIAN 0x01         /* Header[10]: byte order    */
+#ifdef LSB_FIRST
+#define STA_ORDER     0
+#else
+#define STA_ORDER     STA_BIGENDIAN
+#endif
+
+#define STA_REQUIRED  0x3F         /* Chunks that must be there */
+#define STA_AY8910    0x40         /* AY8910 chunk is optional  */
+
+#ifdef ZLIB
+#define STA_WMODE     "wbT"        /* Write w/out gzip wrapper  */
+#else
+#define STA_WMODE     "wb"
+#endif
+
+/* Chunk tags, in SaveState() order */
+static const char *StaChunks[] =
+{ "CPU ","VDP ","PSG ","HWST","RAM ","VRAM","AY  ",0 };
+
+#define PutSTA32(P,V) \
+  { (P)[0]=(V)&0xFF;(P)[1]=((V)>>8)&0xFF;(P)[2]=((V)>>16)&0xFF;(P)[3]=((V)>>24)&0xFF; }
+
+#define GetSTA32(P) \
+  ((P)[0]|((P)[1]<<8)|((P)[2]<<16)|((unsigned int)(P)[3]<<24))
+
+/** StateSize() **********************************************/
+/** Returns exact number of bytes SaveState() is going to   **/
+/** write for the current emulation state.                  **/
+/*************************************************************/
+unsigned int StateSize(void)
+{
+  return(
+    sizeof(CPU)+Save9918(&VDP,0,0)+sizeof(PSG)+HW_STATE
+  + 0xA000+0x4000+sizeof(AYPSG)
+  );
+}
+
+/** StateHash() **********************************************/
+/** Compute HASH_COUNT per-component hashes of the current  **/
+/** emulation state into Hash[], rehashing only dirty RAM   **/
+/** and VRAM pages. Returns the number of hashes computed.  **/
+/*************************************************************/
+unsigned int StateHash(unsigned int *Hash)
+{
+  static unsigned int PageHash[HASH_PAGES];
+  unsigned int J;
+
+  /* AdamNet writes straight into RAM, rehash all of it */
+  if(DirtyPCB) { memset(DirtyPages,1,HASH_RAMPAGES);DirtyPCB=0; }
+
+  /* Rehash pages written since the last call */
+  for(J=0;J<HASH_PAGES;++J)
+    if(DirtyPages[J])
+    {
+      DirtyPages[J] = 0;
+      PageHash[J]   = ComputeCRC32(0,J<HASH_RAMPAGES? RAM_BASE+(J<<8):VDP.VRAM+((J-HASH_RAMPAGES)<<8),256);
+    }
+
+  /* Registers and interrupt timing, without struct padding */
+  /* or frontend fields (Trap, Trace, User)                  */
+  Hash[HASH_CPU]   = ComputeCRC32(0,(byte *)&CPU,offsetof(Z80,R)+sizeof(CPU.R));
+  Hash[HASH_CPU]   = ComputeCRC32(Hash[HASH_CPU],(byte *)&CPU.IPeriod,offsetof(Z80,IBackup)+sizeof(CPU.IBackup)-offsetof(Z80,IPeriod));
+  Hash[HASH_CPU]   = ComputeCRC32(Hash[HASH_CPU],(byte *)&CPU.IRequest,sizeof(CPU.IRequest));
+  Hash[HASH_VDP]   = ComputeCRC32(0,VDP.R,offsetof(TMS9918,VAddr)+sizeof(VDP.VAddr)-offsetof(TMS9918,R));
+  Hash[HASH_PSG]   = ComputeCRC32(0,(byte *)&PSG,offsetof(SN76489,Sync));
+  Hash[HASH_PSG]   = ComputeCRC32(Hash[HASH_PSG],&PSG.NoiseMode,2);
+  Hash[HASH_RAM]   = ComputeCRC32(0,(byte *)PageHash,HASH_RAMPAGES*sizeof(PageHash[0]));
+  Hash[HASH_VRAM]  = ComputeCRC32(0,(byte *)(PageHash+HASH_RAMPAGES),(HASH_PAGES-HASH_RAMPAGES)*sizeof(PageHash[0]));
+  Hash[HASH_AYPSG] = ComputeCRC32(0,AYPSG.R,sizeof(AYPSG.R));
+  Hash[HASH_AYPSG] = ComputeCRC32(Hash[HASH_AYPSG],&AYPSG.Latch,1);
+  Hash[HASH_AYPSG] = ComputeCRC32(Hash[HASH_AYPSG],(byte *)&AYPSG.EPeriod,3*sizeof(int));
+
+  return(HASH_COUNT);
+}
+
+/** StaChunkSize() *******************************************/
+/** Returns size of the Nth component in SaveState() data.  **/
+/*************************************************************/
+static unsigned int StaChunkSize(int N)
+{
+  switch(N)
+  {
+    case 0:  return(sizeof(CPU));
+    case 1:  return(Save9918(&VDP,0,0));
+    case 2:  return(sizeof(PSG));
+    case 3:  return(HW_STATE);
+    case 4:  return(0xA000);
+    case 5:  return(0x4000);
+    case 6:  return(sizeof(AYPSG));
+    default: return(0);
+  }
+}
+
 /** SaveState() **********************************************/
 /** Save emulation state to a memory buffer. Returns size   **/
 /** on success, 0 on failure.                               **/
 /*************************************************************/
 unsigned int SaveState(unsigned char *Buf,unsigned int MaxSize)
 {
-  unsigned int State[256],Size;
-  int J;
+  unsigned int Size,J;
+  byte *P;
 
   /* No data written yet */
   Size = 0;
 
-  /* Generate hardware state */
-  J=0;
-  memset(State,0,sizeof(State));
-  State[J++] = Mode;
-  State[J++] = UPeriod;
-  State[J++] = ROMPage[0]-RAM;
-  State[J++] = ROMPage[1]-RAM;
-  State[J++] = ROMPage[2]-RAM;
-  State[J++] = ROMPage[3]-RAM;
-  State[J++] = ROMPage[4]-RAM;
-  State[J++] = ROMPage[5]-RAM;
-  State[J++] = ROMPage[6]-RAM;
-  State[J++] = ROMPage[7]-RAM;
-  State[J++] = RAMPage[0]-RAM;
-  State[J++] = RAMPage[1]-RAM;
-  State[J++] = RAMPage[2]-RAM;
-  State[J++] = RAMPage[3]-RAM;
-  State[J++] = RAMPage[4]-RAM;
-  State[J++] = RAMPage[5]-RAM;
-  State[J++] = RAMPage[6]-RAM;
-  State[J++] = RAMPage[7]-RAM;
-  State[J++] = JoyMode;
-  State[J++] = Port20;
-  State[J++] = Port60;
-  State[J++] = MegaPage;
-  State[J++] = Port53;
-
   /* Save CPU state */
   SaveSTRUCT(CPU);
 
@@ -95,9 +187,25 @@ unsigned int SaveState(unsigned char *Buf,unsigned int MaxSize)
   J = Save9918(&VDP,Buf+Size,MaxSize-Size);
   if(!J) return(0); else Size+=J;
 
-  /* Save remaining states */
+  /* Save PSG state */
   SaveSTRUCT(PSG);
-  SaveARRAY(State);
+
+  /* Generate hardware state right in the buffer */
+  if(Size+HW_STATE>MaxSize) return(0);
+  P = Buf+Size;
+  SaveINT(Mode);
+  SaveINT(UPeriod);
+  for(J=0;J<8;++J) SaveINT(ROMPage[J]-RAM);
+  for(J=0;J<8;++J) SaveINT(RAMPage[J]-RAM);
+  SaveINT(JoyMode);
+  SaveINT(Port20);
+  SaveINT(Port60);
+  SaveINT(MegaPage);
+  SaveINT(Port53);
+  memset(P,0,Buf+Size+HW_STATE-P);
+  Size += HW_STATE;
+
+  /* Save remaining states */
   SaveDATA(RAM_BASE,0xA000);
   SaveDATA(VDP.VRAM,0x4000);
   SaveSTRUCT(AYPSG);
@@ -106,14 +214,17 @@ unsigned int SaveState(unsigned char *Buf,unsigned int MaxSize)
   return(Size);
 }
 
-/** LoadState() **********************************************/
-/** Load emulation state from a memory buffer. Returns size **/
-/** on success, 0 on failure.                               **/
+/** RestoreState() *******************************************/
+/** Load emulation state from a memory buffer. With Sound=0 **/
+/** sound channels are left alone, as RunAhead() does when  **/
+/** it comes back to the state it has just saved. Returns   **/
+/** size on success, 0 on failure.                          **/
 /*************************************************************/
-unsigned int LoadState(unsigned char *Buf,unsigned int MaxSize)
+static unsigned int RestoreState(unsigned char *Buf,unsigned int MaxSize,int Sound)
 {
-  int State[256],J;
   unsigned int Size;
+  const byte *P;
+  int V,J;
 
   /* No data read yet */
   Size = 0;
@@ -127,7 +238,8 @@ unsigned int LoadState(unsigned char *Buf,unsigned int MaxSize)
 
   /* Load remaining states */
   LoadSTRUCT(PSG);
-  LoadARRAY(State);
+  P = Buf+Size;
+  SkipDATA(HW_STATE);
   LoadDATA(RAM_BASE,0xA000);
   LoadDATA(VDP.VRAM,0x4000);
 
@@ -135,99 +247,227 @@ unsigned int LoadState(unsigned char *Buf,unsigned int MaxSize)
   if(HaveSTRUCT(AYPSG)) { LoadSTRUCT(AYPSG); }
   else Reset8910(&AYPSG,CPU_CLOCK/2,SN76489_CHANNELS);
 
-  /* Parse hardware state */
-  J=0;
-  Mode       = State[J++];
-  UPeriod    = State[J++];
-  ROMPage[0] = State[J++]+RAM;
-  ROMPage[1] = State[J++]+RAM;
-  ROMPage[2] = State[J++]+RAM;
-  ROMPage[3] = State[J++]+RAM;
-  ROMPage[4] = State[J++]+RAM;
-  ROMPage[5] = State[J++]+RAM;
-  ROMPage[6] = State[J++]+RAM;
-  ROMPage[7] = State[J++]+RAM;
-  RAMPage[0] = State[J++]+RAM;
-  RAMPage[1] = State[J++]+RAM;
-  RAMPage[2] = State[J++]+RAM;
-  RAMPage[3] = State[J++]+RAM;
-  RAMPage[4] = State[J++]+RAM;
-  RAMPage[5] = State[J++]+RAM;
-  RAMPage[6] = State[J++]+RAM;
-  RAMPage[7] = State[J++]+RAM;
-  JoyMode    = State[J++];
-  Port20     = State[J++];
-  Port60     = State[J++];
-  MegaPage   = State[J++]&(MegaSize-1);
-  Port53     = State[J++];
+  /* Parse hardware state in place */
+  Mode     = LoadINT();
+  UPeriod  = LoadINT();
+  for(J=0;J<8;++J) ROMPage[J] = LoadINT()+RAM;
+  for(J=0;J<8;++J) RAMPage[J] = LoadINT()+RAM;
+  JoyMode  = LoadINT();
+  Port20   = LoadINT();
+  Port60   = LoadINT();
+  MegaPage = LoadINT()&(MegaSize-1);
+  Port53   = LoadINT();
 
   /* Normal cartridges have fixed ROM pages */
   if(MegaSize<=2) MegaPage=1;
 
-  /* All PSG channels have been changed */
-  PSG.Changed   = 0x80|((1<<SN76489_CHANNELS)-1);
-  AYPSG.Changed = (1<<AY8910_CHANNELS)-1;
+  if(Sound)
+  {
+    /* All PSG channels have been changed */
+    PSG.Changed   = 0x80|((1<<SN76489_CHANNELS)-1);
+    AYPSG.Changed = (1<<AY8910_CHANNELS)-1;
+
+    /* Drop PSG writes logged before the load */
+    if(TimedPSG) ResyncPSG();
+  }
 
   /* Set current update period */
   VDP.DrawFrames = UPeriod;
 
+  /* All RAM and VRAM pages have been changed */
+  memset(DirtyPages,1,sizeof(DirtyPages));
+
   /* Return amount of data read */
   return(Size);
 }
 
-/** SaveSTA() ************************************************/
-/** Save emulation state into a .STA file. Returns 1 on     **/
-/** success, 0 on failure.                                  **/
+/** LoadState() **********************************************/
+/** Load emulation state from a memory buffer. Returns size **/
+/** on success, 0 on failure.                               **/
 /*************************************************************/
-int SaveSTA(const char *Name)
+unsigned int LoadState(unsigned char *Buf,unsigned int MaxSize)
+{
+  return(RestoreState(Buf,MaxSize,1));
+}
+
+/** CaptureSTA() *********************************************/
+/** Capture emulation state, with a .STA header, into a     **/
+/** given buffer. Returns captured size on success, 0 on    **/
+/** failure. Use WriteSTA() to write captured state out.    **/
+/*************************************************************/
+unsigned int CaptureSTA(byte *Buf,unsigned int MaxSize)
 {
-  static byte Header[16] = "STF\032\002\0\0\0\0\0\0\0\0\0\0\0";
   unsigned int Size,J;
-  byte *Buf;
+
+  /* Must have room for the header */
+  if(MaxSize<16) return(0);
+
+  /* Try saving state after the header */
+  Size = SaveState(Buf+16,MaxSize-16);
+  if(!Size) return(0);
+
+  /* Fill header */
+  J = LastCRC;
+  memset(Buf,0,16);
+  memcpy(Buf,"STF\032\003",5);
+  Buf[5]  = Mode&CV_ADAM;
+  Buf[6]  = J&0xFF;
+  Buf[7]  = (J>>8)&0xFF;
+  Buf[8]  = (J>>16)&0xFF;
+  Buf[9]  = (J>>24)&0xFF;
+  Buf[10] = STA_ORDER;
+
+  /* Done */
+  return(Size+16);
+}
+
+/** WriteSTA() ***********************************************/
+/** Compress state captured by CaptureSTA() and write it    **/
+/** into a .STA file. Does not touch emulation state, so it **/
+/** may run on another thread, one call at a time. Returns  **/
+/** 1 on success, 0 on failure.                             **/
+/*************************************************************/
+int WriteSTA(const char *Name,const byte *Buf,unsigned int Size)
+{
+  static byte ZBuf[MAX_STASIZE];
+  unsigned int Pos,Len,Stored,J;
+  const byte *Data;
+  byte Chunk[12];
   FILE *F;
 
-  /* Fail if no state file */
-  if(!Name) return(0);
+  /* Fail if no state file or no state */
+  if(!Name||(Size<16)) return(0);
 
-  /* Allocate temporary buffer */
-  Buf = malloc(MAX_STASIZE);
-  if(!Buf) return(0);
+  /* Open new state file, chunks are compressed on their own */
+  F = fopen(Name,STA_WMODE);
+  if(!F) return(0);
 
-  /* Try saving state */
-  Size = SaveState(Buf,MAX_STASIZE);
-  if(!Size) { free(Buf);return(0); }
+  /* Write out the header */
+  if(F && (fwrite(Buf,1,16,F)!=16)) { fclose(F);F=0; }
 
-  /* Open new state file */
-  F = fopen(Name,"wb");
-  if(!F) { free(Buf);return(0); }
+  /* Write out one chunk per component */
+  for(J=0,Pos=16;F&&StaChunks[J];++J,Pos+=Len)
+  {
+    Len    = StaChunkSize(J);
+    Data   = Buf+Pos;
+    Stored = Len;
 
-  /* Fill header */
-  J = LastCRC;
-  Header[5] = Mode&CV_ADAM;
-  Header[6] = J&0xFF;
-  Header[7] = (J>>8)&0xFF;
-  Header[8] = (J>>16)&0xFF;
-  Header[9] = (J>>24)&0xFF;
+    /* Captured state must have all components */
+    if(Pos+Len>Size) { fclose(F);F=0;break; }
+
+#ifdef ZLIB
+    /* Keep compressed data only if it is actually smaller */
+    {
+      uLongf Z = sizeof(ZBuf);
+      if((compress(ZBuf,&Z,Data,Len)==Z_OK) && (Z<Len))
+      { Data=ZBuf;Stored=Z; }
+    }
+#endif
 
-  /* Write out the header and the data */
-  if(F && (fwrite(Header,1,16,F)!=16))  { fclose(F);F=0; }
-  if(F && (fwrite(Buf,1,Size,F)!=Size)) { fclose(F);F=0; }
+    /* Chunk tag, stored size, original size */
+    memcpy(Chunk,StaChunks[J],4);
+    PutSTA32(Chunk+4,Stored);
+    PutSTA32(Chunk+8,Len);
+
+    if(fwrite(Chunk,1,12,F)!=12)             { fclose(F);F=0; }
+    else if(fwrite(Data,1,Stored,F)!=Stored) { fclose(F);F=0; }
+  }
 
   /* If failed writing state, delete open file */
   if(F) fclose(F); else unlink(Name);
 
   /* Done */
-  free(Buf);
   return(!!F);
 }
 
+/** SaveSTA() ************************************************/
+/** Save emulation state into a .STA file. Returns 1 on     **/
+/** success, 0 on failure.                                  **/
+/*************************************************************/
+int SaveSTA(const char *Name)
+{
+  unsigned int Size;
+
+  /* Fail if no state file */
+  if(!Name) return(0);
+
+  /* Capture state, then write it out */
+  Size = CaptureSTA(StaBuf,sizeof(StaBuf));
+  return(Size? WriteSTA(Name,StaBuf,Size):0);
+}
+
+/** LoadSTAChunks() ******************************************/
+/** Read chunks of a .STA file into StaBuf[] and load state **/
+/** from it. Components missing from the file, or fields    **/
+/** past the end of a shorter chunk, keep current values.   **/
+/** Unknown chunks are skipped. Returns LoadState() result. **/
+/*************************************************************/
+static unsigned int LoadSTAChunks(FILE *F)
+{
+  unsigned int Size,Pos,Len,Stored,Max,Have,J;
+  byte Chunk[12];
+
+  /* Start with the current state */
+  Size = SaveState(StaBuf,sizeof(StaBuf));
+  if(!Size) return(0);
+
+  for(Have=0;fread(Chunk,1,12,F)==12;)
+  {
+    Stored = GetSTA32(Chunk+4);
+    Len    = GetSTA32(Chunk+8);
+
+    /* Find component by its tag */
+    for(J=Pos=0;StaChunks[J]&&memcmp(Chunk,StaChunks[J],4);++J)
+      Pos+=StaChunkSize(J);
+
+    /* Skip unknown chunks */
+    if(!StaChunks[J])
+    {
+      if(fseek(F,Stored,SEEK_CUR)<0) return(0);
+      continue;
+    }
+
+    /* Read chunk data */
+    if(Stored>sizeof(StaTmp)) return(0);
+    if(fread(StaTmp,1,Stored,F)!=Stored) return(0);
+
+    /* Store data over the current state */
+    Max = StaChunkSize(J);
+    if(Stored==Len) memcpy(StaBuf+Pos,StaTmp,Len<Max? Len:Max);
+    else
+    {
+#ifdef ZLIB
+      uLongf Z = Max;
+      /* Longer chunks fill StaBuf[] up to Max and stop there */
+      switch(uncompress(StaBuf+Pos,&Z,StaTmp,Stored))
+      {
+        case Z_OK:      break;
+        case Z_BUF_ERROR: if(Len>Max) break;
+        default:        return(0);
+      }
+#else
+      return(0);
+#endif
+    }
+
+    /* Component has been loaded */
+    Have |= 1<<J;
+  }
+
+  /* All components but AY8910 are required */
+  if((Have&STA_REQUIRED)!=STA_REQUIRED) return(0);
+
+  /* Older saves may not have AY8910 state */
+  return(LoadState(StaBuf,Have&STA_AY8910? Size:Size-sizeof(AYPSG)));
+}
+
 /** LoadSTA() ************************************************/
 /** Load emulation state from a .STA file. Returns 1 on     **/
 /** success, 0 on failure.                                  **/
 /*************************************************************/
 int LoadSTA(const char *Name)
 {
-  byte Header[16],*Buf;
+  byte Header[16];
   int Size,OldMode,J;
   FILE *F;
 
@@ -238,8 +478,9 @@ int LoadSTA(const char *Name)
   if(!(F=fopen(Name,"rb"))) return(0);
 
   /* Read and check the header */
-  if(fread(Header,1,16,F)!=16)       { fclose(F);return(0); }
-  if(memcmp(Header,"STF\032\002",5)) { fclose(F);return(0); }
+  if(fread(Header,1,16,F)!=16)      { fclose(F);return(0); }
+  if(memcmp(Header,"STF\032",4))    { fclose(F);return(0); }
+  if((Header[4]!=2)&&(Header[4]!=3)) { fclose(F);return(0); }
   J = LastCRC;
   if(
     (Header[5]!=(Mode&CV_ADAM)) ||
@@ -249,20 +490,22 @@ int LoadSTA(const char *Name)
     (Header[9]!=((J>>24)&0xFF))
   ) { fclose(F);return(0); }
 
-  /* Allocate temporary buffer */
-  Buf = malloc(MAX_STASIZE);
-  if(!Buf) { fclose(F);return(0); }
+  /* Components are stored in host byte order */
+  if((Header[4]==3)&&(Header[10]!=STA_ORDER)) { fclose(F);return(0); }
 
-  /* Read state into temporary buffer, then load it */
   OldMode = Mode;
-  Size    = fread(Buf,1,MAX_STASIZE,F);
-  Size    = Size>0? LoadState(Buf,Size):0;
+  if(Header[4]==3) Size = LoadSTAChunks(F);
+  else
+  {
+    /* Read raw state into scratch buffer, then load it */
+    Size = fread(StaBuf,1,sizeof(StaBuf),F);
+    Size = Size>0? LoadState(StaBuf,Size):0;
+  }
 
   /* If failed loading state, reset hardware */
   if(!Size) ResetColeco(OldMode);
 
   /* Done */
-  free(Buf);
   fclose(F);
   return(!!Size);
 }
@@ -42,15 +42,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <wiiuse/wpad.h>
+#include <SDL.h>
+#include <SDL_thread.h>
 
 #include "Coleco.h"
+#include "Profile.h"
+#include "Rewind.h"
 #include "Sound.h"
 
+#ifdef PROFZ80
+#include "ProfZ80.h"
+#endif
+
+#ifdef TRACEZ80
+#include "TraceZ80.h"
+
+// Instructions kept in the trace (12MB, about a second of play)
+#define TRACE_ENTRIES 0x80000
+#endif
+
 #include "fileop.h"
 #include "vi_encoder.h"
 #include "wii_sdl.h"
+#include "wii_app_common.h"
 #include "wii_app.h"
 #include "wii_hw_buttons.h"
 #include "wii_gx.h"
@@ -73,17 +90,44 @@ static u64 CurrentTick;
 static u64 TimerCount;
 static u64 StartTick;
 
+// Audio pacing information
+#define PACING_MAX_ADJUST 0.005f  /* Max. samples/frame stretch (0.5%) */
+static BOOL AudioPacing = FALSE;  /* Frames paced by the audio clock */
+static int PaceSize;              /* Audio buffer size in samples */
+static int PaceTarget;            /* Audio buffer fill to hold */
+static float PaceSamples;         /* Nominal samples per frame */
+static float PaceFraction;        /* Sample remainder carried over */
+
+// Audio thread information
+#define AUDIO_HOLD_SAMPLES 256         /* Samples per HoldPSG() call */
+static SDL_Thread* AudioThread = NULL; /* Plays frames of PSG writes */
+static volatile BOOL AudioRunning = FALSE;
+
 /** Whether to reset the timing information */
 static BOOL ResetTiming = TRUE;
 
 /** The current FPS */
 static float FpsCounter = 0.0;
 
+// Fast-forward information
+#define FAST_FORWARD_FRAMES 4       /* Draw every Nth frame */
+static BOOL FastForward = FALSE;    /* Whether fast-forwarding */
+static byte NormalUPeriod = 100;    /* UPeriod when not fast-forwarding */
+
+// Emulated frame rate information
+static float EmuFpsCounter = 0.0;   /* Frames emulated per second */
+static u32 EmuFrames = 0;           /* Frames emulated since EmuTick */
+static u64 EmuTick = 0;             /* Start of the current count */
+
 /** Is this the first time the loop is occurring */
 static BOOL InitialLoop = TRUE;
 
 /** Forward reference to render the emulator screen */
 static void render_screen();
+/** Forward reference to the tick counter */
+static u64 getTicks();
+/** Forward reference to stop the audio thread */
+void StopAudioThread();
 
 /** View external reference (SDL) */
 extern Mtx gx_view;
@@ -108,7 +152,12 @@ static void wii_prerender_callback();
 /** Deallocate all resources taken by InitMachine().        **/
 /*************************************************************/
 void TrashMachine(void) {
+    StopAudioThread();
+    RWDTrash();
     TrashSound();
+#ifdef TRACEZ80
+    TraceZ80Trash();
+#endif
 }
 
 /** ResetTiming() ********************************************/
@@ -123,6 +172,153 @@ void ResetCycleTiming(void) {
 
     TicksPerUpdate = TicksPerSecond / UpdateFreq;
     ResetTiming = TRUE;
+
+    // Pace by the audio clock if selected and audio is running
+    AudioStats snd;
+    GetAudioStats(&snd);
+    PaceSize = snd.Size;
+    PaceTarget = PaceSize >> 1;
+    PaceSamples = (float)UseSound / UpdateFreq;
+    PaceFraction = 0.0f;
+    AudioPacing =
+        (wii_frame_pacing == FRAME_PACING_AUDIO) && (PaceSize > PaceSamples);
+}
+
+/**
+ * Returns the number of audio samples to render for the current frame. When
+ * pacing by audio, the nominal count is stretched by up to PACING_MAX_ADJUST
+ * to steer the buffer fill back to its target. Tones keep their pitch, only
+ * the emulated timeline is resampled.
+ *
+ * @return  The number of audio samples to render
+ */
+static unsigned int GetFrameSamples() {
+    unsigned int avail = GetFreeAudio();
+    if (FastForward) {
+        // Compress the frame's audio, drop it once the buffer is full
+        unsigned int count =
+            (unsigned int)(PaceSamples / FAST_FORWARD_FRAMES);
+        return count <= avail ? count : 0;
+    }
+    if ((!AudioPacing && !ThreadedPSG) || !PaceTarget) {
+        return avail;
+    }
+
+    float err = (float)(PaceSize - (int)avail - PaceTarget) / PaceTarget;
+    if (err > 1.0f) err = 1.0f;
+    if (err < -1.0f) err = -1.0f;
+
+    PaceFraction += PaceSamples * (1.0f - PACING_MAX_ADJUST * err);
+    unsigned int count = (unsigned int)PaceFraction;
+    PaceFraction -= count;
+
+    // The audio thread plays frames as room frees up, so do not clip them
+    return (ThreadedPSG || count < avail) ? count : avail;
+}
+
+/**
+ * Sleeps until the audio device has played the buffer down to its target
+ * fill. Bounded to two frames so a stalled or paused device cannot hang the
+ * emulation.
+ */
+static void WaitAudio() {
+    u64 limit = getTicks() + (TicksPerUpdate << 1);
+    while ((PaceSize - (int)GetFreeAudio()) > PaceTarget &&
+           getTicks() < limit) {
+        usleep(1000);
+    }
+}
+
+/**
+ * Starts or stops fast-forwarding. While fast-forwarding, only every
+ * FAST_FORWARD_FRAMES frame is drawn and frames are not paced.
+ *
+ * @param   enable Whether to fast-forward
+ */
+static void SetFastForward(BOOL enable) {
+    if (enable == FastForward) {
+        return;
+    }
+
+    FastForward = enable;
+    if (enable) {
+        NormalUPeriod = UPeriod;
+        UPeriod = 100 / FAST_FORWARD_FRAMES;
+    } else {
+        UPeriod = NormalUPeriod;
+        // Pick up pacing from the current time and audio fill
+        ResetCycleTiming();
+    }
+    VDP.DrawFrames = UPeriod;
+}
+
+/**
+ * Counts an emulated frame, updating the emulated frame rate once a second
+ */
+static void CountEmuFrame() {
+    u64 now = getTicks();
+    EmuFrames++;
+    if (now - EmuTick >= TicksPerSecond) {
+        EmuFpsCounter = ((float)EmuFrames * TicksPerSecond) / (now - EmuTick);
+        EmuFrames = 0;
+        EmuTick = now;
+    }
+}
+
+/**
+ * Audio thread. Plays frames of PSG writes as the emulation closes them and
+ * room frees up in the audio buffer. When the next frame is late and the
+ * buffer runs low, keeps the current tones going rather than letting it run
+ * dry. Idles while audio is paused (keypad, menu).
+ *
+ * @param   data Unused
+ * @return  Thread exit code
+ */
+static int AudioWorker(void* data) {
+    while (AudioRunning) {
+        if (PauseAudio(-1)) {
+            SDL_Delay(1);
+        } else if (SynthPSG(GetFreeAudio())) {
+            continue;
+        } else if ((PaceSize - (int)GetFreeAudio()) < (PaceSize >> 2)) {
+            HoldPSG(AUDIO_HOLD_SAMPLES);
+        } else {
+            SDL_Delay(1);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Starts the audio thread, falling back to synthesizing audio on the
+ * emulation thread if it can not be created. Only timestamped PSG writes
+ * can be played off the emulation thread, without them sound channels are
+ * changed as the emulation runs.
+ */
+void StartAudioThread() {
+    if (!TimedPSG || AudioThread) {
+        return;
+    }
+    ThreadedPSG = 1;
+    AudioRunning = TRUE;
+    AudioThread = SDL_CreateThread(AudioWorker, NULL);
+    if (!AudioThread) {
+        AudioRunning = FALSE;
+        ThreadedPSG = 0;
+    }
+}
+
+/**
+ * Stops the audio thread. Sound channels may only be set up from the
+ * emulation thread while it is stopped (resets, loading states).
+ */
+void StopAudioThread() {
+    if (AudioThread) {
+        AudioRunning = FALSE;
+        SDL_WaitThread(AudioThread, NULL);
+        AudioThread = NULL;
+    }
+    ThreadedPSG = 0;
 }
 
 /** InitMachine() ********************************************/
@@ -134,14 +330,30 @@ int InitMachine(void) {
     ScrHeight = COLECO_HEIGHT;
     ScrBuffer = blit_surface->pixels;
 
-    // Reset timing information
-    ResetCycleTiming();
-
-    InitSound(UseSound, 150);
+    InitSound(UseSound, wii_audio_latency);
     SndSwitch = (1 << (SN76489_CHANNELS + AY8910_CHANNELS)) - 1;
     SndVolume = 255 / SN76489_CHANNELS;
     SetChannels(SndVolume, SndSwitch);
 
+    // Reset timing information (after audio, which it may pace by)
+    ResetCycleTiming();
+
+    // Synthesize audio off the emulation thread
+    if (wii_audio_thread) {
+        StartAudioThread();
+    }
+
+    // Keep rewind history, if enabled
+    if (wii_rewind_size) {
+        RWDInit(SaveState, LoadState, StateSize(), wii_rewind_size << 20,
+                RWD_KEYSTEP);
+    }
+
+#ifdef TRACEZ80
+    // Keep tracing the last instructions run, for wiicolem.trc
+    TraceZ80Init(TRACE_ENTRIES);
+#endif
+
     return (1);
 }
 
@@ -259,8 +471,41 @@ static void AddRenderCallbackPostMenu() {
         VIDEO_WaitVSync();
         WII_VideoStart();                                                        
     }
+
+    // Time spent in the menu is not part of any frame
+    PRF_SKIP();
 }
 
+#ifdef PROFZ80
+/**
+ * Saves the guest profile of the current game as a callgrind file, along
+ * with a text report
+ */
+static void SaveGuestProfile() {
+    char path[WII_MAX_PATH];
+    snprintf(path, sizeof(path), "%s%s", wii_get_fs_prefix(),
+             WII_FILES_DIR "wiicolem.prof");
+    ProfZ80Save(path);
+    snprintf(path, sizeof(path), "%s%s", wii_get_fs_prefix(),
+             WII_FILES_DIR "wiicolem.prof.txt");
+    ProfZ80Report(path);
+}
+#endif
+
+#ifdef TRACEZ80
+/**
+ * Saves the instructions last run by the current game, to be decoded with
+ * z80trace, and starts the trace over
+ */
+static void SaveGuestTrace() {
+    char path[WII_MAX_PATH];
+    snprintf(path, sizeof(path), "%s%s", wii_get_fs_prefix(),
+             WII_FILES_DIR "wiicolem.trc");
+    TraceZ80Save(path);
+    TraceZ80Reset();
+}
+#endif
+
 /**
  * Removes emulator render callback. This should be called prior to the menu
  * being displayed.
@@ -291,8 +536,10 @@ static u32 lastkeypad = 0;
 static BOOL keypad_changed = FALSE;
 
 unsigned int Joystick(void) {
-    /* Render audio here */
-    RenderAndPlayAudio(GetFreeAudio());
+    /* Close this frame of audio, played here or by the audio thread */
+    PRF_ENTER(PRF_AUDIO);
+    PlayPSG(GetFrameSamples());
+    PRF_LEAVE();
 
     if (InitialLoop) {
         InitialLoop = FALSE;
@@ -341,6 +588,16 @@ unsigned int Joystick(void) {
         //
         if ((down & WII_BUTTON_HOME) || (gcDown & GC_BUTTON_HOME) ||
             wii_hw_button) {
+            // Leave fast-forward, the menu may save the state
+            SetFastForward(FALSE);
+#ifdef PROFZ80
+            // Pull the card after leaving the game to look at the profile
+            SaveGuestProfile();
+#endif
+#ifdef TRACEZ80
+            // Pull the card after leaving the game to decode the trace
+            SaveGuestTrace();
+#endif
             // Removes the emulator render callback prior to showing the menu
             RemoveRenderCallbackPreMenu();
             // Show the menu
@@ -413,10 +670,27 @@ unsigned int Joystick(void) {
                 // Reset the timing info.
                 PauseAudio(0);
                 ResetCycleTiming();
+                PRF_SKIP();
             }
         }
     } while (loop);
 
+    // Holding minus fast-forwards or steps back. Every frame is recorded,
+    // unless stepping back.
+    BOOL hold = (WPAD_ButtonsHeld(0) & WII_BUTTON_CV_HOLD) != 0;
+    if (wii_hold_action == HOLD_ACTION_FAST_FORWARD) {
+        SetFastForward(hold);
+        RWDRecord();
+    } else if (hold) {
+        RWDBack();
+    } else {
+        RWDRecord();
+    }
+
+    if (wii_debug) {
+        CountEmuFrame();
+    }
+
     if (keypad) {
         return keypad;
     } else {
@@ -459,6 +733,72 @@ static void wii_prerender_callback() {
     }
 }
 
+#ifdef PROFILE
+/**
+ * Renders the profiler statistics: the time per frame spent in each section,
+ * and a histogram of recent frame times with the frames over budget in red
+ *
+ * @param   x The left of the statistics
+ * @param   y The top of the statistics
+ * @param   update Whether to pick up the latest statistics
+ */
+static void render_profile(int x, int y, BOOL update) {
+    static PRFStats stats;
+    static char text[PRF_SECTIONS + 1][64];
+
+    int pixelSize = 14;
+    int h = pixelSize;
+    int padding = 2;
+    int lineh = h + (padding << 1);
+
+    if (update) {
+        PRFGetStats(&stats);
+        unsigned int frame = stats.Frame ? stats.Frame : 1;
+        for (int i = 0; i < PRF_SECTIONS; i++) {
+            sprintf(text[i], "%s: %0.2f ms (%u%%) x%u", PRFNames[i],
+                    stats.Time[i] / 1000.0f, stats.Time[i] * 100 / frame,
+                    stats.Count[i]);
+        }
+        sprintf(text[PRF_SECTIONS], "Frame: %0.2f ms (max %0.2f ms)",
+                stats.Frame / 1000.0f, stats.MaxFrame / 1000.0f);
+    }
+
+    GXColor color = (GXColor){0x0, 0x0, 0x0, 0x80};
+    for (int i = 0; i <= PRF_SECTIONS; i++) {
+        int w = wii_gx_gettextwidth(pixelSize, text[i]);
+        wii_gx_drawrectangle(x + -padding, y + padding, w + (padding << 1),
+                             lineh, color, TRUE);
+        wii_gx_drawtext(x, y - h, pixelSize, text[i], ftgxWhite,
+                        FTGX_ALIGN_BOTTOM);
+        y -= lineh;
+    }
+
+    // Frame time histogram, one bar per PRF_HISTSTEP microseconds
+    const int barw = 6;
+    const int maxh = 48;
+    unsigned int max = 1;
+    for (int i = 0; i < PRF_HISTSIZE; i++) {
+        if (stats.Hist[i] > max) max = stats.Hist[i];
+    }
+    unsigned int budget = TicksPerUpdate * (1000000 / TicksPerSecond);
+    GXColor over = (GXColor){0xFF, 0x40, 0x40, 0xFF};
+
+    y -= padding;
+    wii_gx_drawrectangle(x + -padding, y + padding,
+                         PRF_HISTSIZE * barw + (padding << 1),
+                         maxh + (padding << 1), color, TRUE);
+    for (int i = 0; i < PRF_HISTSIZE; i++) {
+        int barh = stats.Hist[i] * maxh / max;
+        if (barh) {
+            wii_gx_drawrectangle(
+                x + i * barw, y - maxh + barh, barw - 1, barh,
+                (unsigned int)i * PRF_HISTSTEP >= budget ? over : ftgxWhite,
+                TRUE);
+        }
+    }
+}
+#endif
+
 /**
  * GX render callback
  */
@@ -497,13 +837,19 @@ static void wii_render_callback() {
         int padding = 2;
 
         if (dbg_count % 60 == 0) {
+            AudioStats snd;
+            GetAudioStats(&snd);
 #ifdef ENABLE_VSYNC            
-            sprintf(text, "FPS: %0.2f, VSync: %s, CycleAdj: %d %s", FpsCounter,
+            sprintf(text, "FPS: %0.2f (Emu: %0.1f), VSync: %s, CycleAdj: %d, "
+                    "Snd: %u/%u U:%u %s", FpsCounter, EmuFpsCounter,
                     (wii_vsync == VSYNC_ENABLED ? "On" : "Off"),
-                    wii_coleco_db_entry.cycleAdjust, debug_str);
+                    wii_coleco_db_entry.cycleAdjust, snd.MinFill, snd.Size,
+                    snd.Underruns, debug_str);
 #else
-            sprintf(text, "FPS: %0.2f, CycleAdj: %d %s", FpsCounter,                    
-                    wii_coleco_db_entry.cycleAdjust, debug_str);
+            sprintf(text, "FPS: %0.2f (Emu: %0.1f), CycleAdj: %d, "
+                    "Snd: %u/%u U:%u %s", FpsCounter, EmuFpsCounter,
+                    wii_coleco_db_entry.cycleAdjust, snd.MinFill,
+                    snd.Size, snd.Underruns, debug_str);
 #endif                    
         }
 
@@ -517,6 +863,10 @@ static void wii_render_callback() {
 
         wii_gx_drawtext(x, y, pixelSize, text, ftgxWhite, FTGX_ALIGN_BOTTOM);
 
+#ifdef PROFILE
+        render_profile(x, y - (padding << 1), dbg_count % 60 == 0);
+#endif
+
         if (wii_coleco_db_entry.controlsMode == CONTROLS_MODE_DRIVING_TILT) {
             sprintf(text2, "Tilt: %0.2f", Tilt);
 
@@ -538,16 +888,22 @@ static void wii_render_callback() {
  * Renders the screen
  */
 static void render_screen() {
+    PRF_ENTER(PRF_BLIT);
+
     // Normal rendering
     wii_sdl_put_image_normal(1);
 
     // Send to display
     wii_sdl_flip();
 
+    PRF_LEAVE();
+
 #ifdef ENABLE_VSYNC
     // Wait for VSync signal
-    if (wii_vsync == VSYNC_ENABLED)
+    PRF_ENTER(PRF_WAIT);
+    if (wii_vsync == VSYNC_ENABLED && !FastForward)
         VIDEO_WaitVSync();
+    PRF_LEAVE();
 #endif        
 }
 
@@ -570,6 +926,7 @@ void RefreshScreen(void* Buffer, int Width, int Height) {
     render_screen();
 
     // Wait if needed
+    PRF_ENTER(PRF_WAIT);
     if (ResetTiming) {
         NextTick = getTicks() + TicksPerUpdate;
 
@@ -579,6 +936,22 @@ void RefreshScreen(void* Buffer, int Width, int Height) {
         }
 
         ResetTiming = FALSE;
+    } else if (FastForward) {
+        // Run as fast as possible
+        CurrentTick = getTicks();
+
+        if (wii_debug) {
+            FpsCounter =
+                (((float)TimerCount++ / (CurrentTick - StartTick)) * 100000.0);
+        }
+    } else if (AudioPacing) {
+        WaitAudio();
+        CurrentTick = getTicks();
+
+        if (wii_debug) {
+            FpsCounter =
+                (((float)TimerCount++ / (CurrentTick - StartTick)) * 100000.0);
+        }
     } else {
         do {
             CurrentTick = getTicks();
@@ -590,4 +963,5 @@ void RefreshScreen(void* Buffer, int Width, int Height) {
                 (((float)TimerCount++ / (CurrentTick - StartTick)) * 100000.0);
         }
     }
+    PRF_LEAVE();
 }
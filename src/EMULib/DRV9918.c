@@ -13,6 +13,7 @@
 /**     changes to this file.                               **/
 /*************************************************************/
 #include "TMS9918.h"
+#include "Profile.h"
 
 /** Static Functions *****************************************/
 /** Functions used internally by the TMS9918 drivers.       **/
@@ -67,6 +68,8 @@ void RefreshSprites(register TMS9918 *VDP,register byte Y)
   register int L,K;
   register unsigned int M;
 
+  PRF_ENTER(PRF_SPRITES);
+
   /* No 5th sprite yet */
   VDP->Status &= ~(TMS9918_STAT_5THNUM|TMS9918_STAT_5THSPR);
 
@@ -200,6 +203,8 @@ void RefreshSprites(register TMS9918 *VDP,register byte Y)
         }
       }
     }
+
+  PRF_LEAVE();
 }
 
 /** RefreshLine0() *******************************************/
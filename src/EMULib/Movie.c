@@ -0,0 +1,603 @@
+/** EMULib Emulation Library *********************************/
+/**                                                         **/
+/**                         Movie.c                         **/
+/**                                                         **/
+/** This file contains routines for recording gameplay into **/
+/** movie files of any length and playing them back. Input  **/
+/** is streamed to disk as it comes, with a compressed      **/
+/** keyframe every few seconds and a keyframe index at the  **/
+/** end of the file. See Movie.h for declarations.          **/
+/**                                                         **/
+/*************************************************************/
+#include "Movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ZLIB
+#include <zlib.h>
+#endif
+
+#define MOV_INPUT    'I'             /* Input run record         */
+#define MOV_KEY      'K'             /* Keyframe record          */
+#define MOV_INDEX    'X'             /* Keyframe index record    */
+#define MOV_HASH     'H'             /* State hashes record      */
+#define MOV_HEADER   16              /* Header size              */
+#define MOV_TRAILER  12              /* Trailer size             */
+#define MOV_KEYGROW  64              /* Index entries per alloc  */
+
+#define PutINT(P,V) \
+  { (P)[0]=(V)&0xFF;(P)[1]=((V)>>8)&0xFF;(P)[2]=((V)>>16)&0xFF;(P)[3]=((V)>>24)&0xFF; }
+
+#define GetINT(P) \
+  ((P)[0]|((P)[1]<<8)|((P)[2]<<16)|((unsigned int)(P)[3]<<24))
+
+/** Movie Files **********************************************/
+/** A 16-byte header ("MOV\032\001", 32bit KeyStep) is      **/
+/** followed by records, each starting with a type byte:    **/
+/**   'I' Count,Joy,Mouse    - same input for Count frames  **/
+/**   'K' Frame,Size,Stored  - state before Frame's input,  **/
+/**                            compressed if Stored<Size    **/
+/**   'X' Count,Frame,Pos... - index of all 'K' records     **/
+/**   'H' Frame,Count,0,...  - Count state hashes before    **/
+/**                            Frame's input, if MOVHash()  **/
+/** and a 12-byte trailer ("MOVX", 32bit offset of the 'X'  **/
+/** record, 32bit number of frames). All numbers are        **/
+/** little-endian. Files without the trailer, i.e. cut off  **/
+/** while recording, are scanned to rebuild the index.      **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Frame;                /* Frame of the keyframe    */
+  unsigned int Pos;                  /* 'K' record file offset   */
+} MOVKeyT;
+
+static FILE *MF            = 0;      /* Movie file               */
+static int MOVState        = MOV_OFF;/* MOV_OFF/RECORD/PLAY      */
+static unsigned int Frame  = 0;      /* Current frame            */
+static unsigned int Frames = 0;      /* Frames in played movie   */
+static unsigned int Run    = 0;      /* Frames in the input run  */
+static unsigned int RunJoy = 0;      /* Joystick input of a run  */
+static unsigned int RunMouse = 0;    /* Mouse input of a run     */
+
+static MOVKeyT *Keys       = 0;      /* Keyframes, in file order */
+static unsigned int KeyCount = 0;    /* Keyframes in Keys[]      */
+static unsigned int KeyMax = 0;      /* Keys[] size              */
+static unsigned int KeyStep = 0;     /* Frames per keyframe      */
+
+static unsigned char *State = 0;     /* State buffer             */
+static unsigned char *ZBuf = 0;      /* Compressed state buffer  */
+static unsigned int StateSize = 0;   /* State[] size             */
+static unsigned int ZSize  = 0;      /* ZBuf[] size              */
+
+static unsigned int (*SaveState)(unsigned char *,unsigned int) = 0;
+static unsigned int (*LoadState)(unsigned char *,unsigned int) = 0;
+static unsigned int (*HashState)(unsigned int *) = 0;
+
+static unsigned int DivFrame = 0;    /* First diverging frame    */
+static int DivHash         = 0;      /* 1+diverging hash, or 0   */
+
+/** AddKey() *************************************************/
+/** Add a keyframe to the index. Returns 1 on success, 0 on **/
+/** failure.                                                **/
+/*************************************************************/
+static int AddKey(unsigned int KeyFrame,unsigned int Pos)
+{
+  MOVKeyT *P;
+
+  /* Grow index as needed */
+  if(KeyCount>=KeyMax)
+  {
+    P = realloc(Keys,(KeyMax+MOV_KEYGROW)*sizeof(MOVKeyT));
+    if(!P) return(0);
+    Keys    = P;
+    KeyMax += MOV_KEYGROW;
+  }
+
+  Keys[KeyCount].Frame = KeyFrame;
+  Keys[KeyCount].Pos   = Pos;
+  ++KeyCount;
+  return(1);
+}
+
+/** FlushRun() ***********************************************/
+/** Write out the current input run, if any. Returns 1 on   **/
+/** success, 0 on failure.                                  **/
+/*************************************************************/
+static int FlushRun(void)
+{
+  unsigned char Buf[13];
+
+  if(!Run) return(1);
+
+  Buf[0] = MOV_INPUT;
+  PutINT(Buf+1,Run);
+  PutINT(Buf+5,RunJoy);
+  PutINT(Buf+9,RunMouse);
+  Run = 0;
+
+  return(fwrite(Buf,1,13,MF)==13);
+}
+
+/** WriteKey() ***********************************************/
+/** Write out current emulation state as a keyframe, adding **/
+/** it to the index. Returns 1 on success, 0 on failure.    **/
+/*************************************************************/
+static int WriteKey(void)
+{
+  unsigned int Size,Stored;
+  unsigned char Buf[13],*Data;
+  long Pos;
+
+  Pos  = ftell(MF);
+  Size = SaveState(State,StateSize);
+  if((Pos<0)||!Size) return(0);
+
+  Data   = State;
+  Stored = Size;
+
+#ifdef ZLIB
+  /* Keep compressed state only if it is actually smaller */
+  {
+    uLongf Z = ZSize;
+    if((compress(ZBuf,&Z,State,Size)==Z_OK) && (Z<Size))
+    { Data=ZBuf;Stored=Z; }
+  }
+#endif
+
+  Buf[0] = MOV_KEY;
+  PutINT(Buf+1,Frame);
+  PutINT(Buf+5,Size);
+  PutINT(Buf+9,Stored);
+
+  if(fwrite(Buf,1,13,MF)!=13)         return(0);
+  if(fwrite(Data,1,Stored,MF)!=Stored) return(0);
+  return(AddKey(Frame,Pos));
+}
+
+/** WriteHash() **********************************************/
+/** Write out hashes of the current emulation state. Input  **/
+/** runs are flushed first, so the hashes land right before **/
+/** the input of their frame. Returns 1 on success, 0 on    **/
+/** failure.                                                **/
+/*************************************************************/
+static int WriteHash(void)
+{
+  unsigned char Buf[13+4*MOV_MAXHASH];
+  unsigned int Hash[MOV_MAXHASH];
+  unsigned int N,J;
+
+  if(!FlushRun()) return(0);
+
+  N = HashState(Hash);
+  if(N>MOV_MAXHASH) N=MOV_MAXHASH;
+
+  Buf[0] = MOV_HASH;
+  PutINT(Buf+1,Frame);
+  PutINT(Buf+5,N);
+  PutINT(Buf+9,0);
+  for(J=0;J<N;++J) PutINT(Buf+13+4*J,Hash[J]);
+
+  return(fwrite(Buf,1,13+4*N,MF)==13+4*N);
+}
+
+/** CheckHash() **********************************************/
+/** Read hashes following a 'H' record header and compare   **/
+/** them to the current emulation state, remembering the    **/
+/** first mismatch. Returns 1 on success, 0 on failure.     **/
+/*************************************************************/
+static int CheckHash(const unsigned char *Header)
+{
+  unsigned char Buf[4*MOV_MAXHASH];
+  unsigned int Hash[MOV_MAXHASH];
+  unsigned int N,J;
+
+  N = GetINT(Header+4);
+  if(N>MOV_MAXHASH)              return(0);
+  if(fread(Buf,1,4*N,MF)!=4*N)   return(0);
+
+  /* Only check for the first divergence */
+  if(!HashState||DivHash||(GetINT(Header)!=Frame)) return(1);
+
+  J = HashState(Hash);
+  if(J<N) N=J;
+  for(J=0;J<N;++J)
+    if(GetINT(Buf+4*J)!=Hash[J])
+    { DivFrame=Frame;DivHash=J+1;break; }
+
+  return(1);
+}
+
+/** LoadKey() ************************************************/
+/** Read keyframe at a given file offset and load it. Movie **/
+/** file is left right past the keyframe. Returns 1 on      **/
+/** success, 0 on failure.                                  **/
+/*************************************************************/
+static int LoadKey(unsigned int Pos)
+{
+  unsigned int Size,Stored;
+  unsigned char Buf[13];
+
+  if(fseek(MF,Pos,SEEK_SET))             return(0);
+  if(fread(Buf,1,13,MF)!=13)             return(0);
+  if(Buf[0]!=MOV_KEY)                    return(0);
+
+  Size   = GetINT(Buf+5);
+  Stored = GetINT(Buf+9);
+  if((Size>StateSize)||(Stored>Size))    return(0);
+
+  /* Uncompressed states are read in place */
+  if(Stored==Size)
+  {
+    if(fread(State,1,Size,MF)!=Size)     return(0);
+  }
+  else
+  {
+#ifdef ZLIB
+    uLongf Z = Size;
+    if(fread(ZBuf,1,Stored,MF)!=Stored)  return(0);
+    if(uncompress(State,&Z,ZBuf,Stored)!=Z_OK) return(0);
+    if(Z!=Size)                          return(0);
+#else
+    return(0);
+#endif
+  }
+
+  return(LoadState(State,Size)? 1:0);
+}
+
+/** NextRun() ************************************************/
+/** Read the next input run, skipping keyframes and         **/
+/** checking hashes on the way. Returns 1 on success, 0 at  **/
+/** the end of the movie.                                   **/
+/*************************************************************/
+static int NextRun(void)
+{
+  unsigned char Buf[12];
+  int T;
+
+  while((T=fgetc(MF))!=EOF)
+  {
+    if(fread(Buf,1,12,MF)!=12) return(0);
+
+    switch(T)
+    {
+      case MOV_INPUT:
+        Run      = GetINT(Buf);
+        RunJoy   = GetINT(Buf+4);
+        RunMouse = GetINT(Buf+8);
+        if(Run) return(1);
+        break;
+
+      case MOV_KEY:
+        if(fseek(MF,GetINT(Buf+8),SEEK_CUR)) return(0);
+        break;
+
+      case MOV_HASH:
+        if(!CheckHash(Buf)) return(0);
+        break;
+
+      default:
+        return(0);
+    }
+  }
+
+  return(0);
+}
+
+/** ReadIndex() **********************************************/
+/** Read keyframe index and movie length from the trailer,  **/
+/** or rebuild them by scanning records if there is none.   **/
+/** Returns 1 on success, 0 on failure.                     **/
+/*************************************************************/
+static int ReadIndex(void)
+{
+  unsigned char Buf[12];
+  unsigned int N,J;
+  long Pos;
+  int T;
+
+  KeyCount = 0;
+
+  /* Try the trailer first */
+  if(
+    !fseek(MF,-MOV_TRAILER,SEEK_END)
+  && (fread(Buf,1,MOV_TRAILER,MF)==MOV_TRAILER)
+  && !memcmp(Buf,"MOVX",4)
+  )
+  {
+    Frames = GetINT(Buf+8);
+    if(
+      !fseek(MF,GetINT(Buf+4),SEEK_SET)
+    && (fgetc(MF)==MOV_INDEX)
+    && (fread(Buf,1,4,MF)==4)
+    )
+    {
+      N = GetINT(Buf);
+      for(J=0;(J<N)&&(fread(Buf,1,8,MF)==8);++J)
+        if(!AddKey(GetINT(Buf),GetINT(Buf+4))) break;
+      if(J==N) return(KeyCount>0);
+    }
+  }
+
+  /* No valid trailer, scan records */
+  KeyCount = 0;
+  Frames   = 0;
+  if(fseek(MF,MOV_HEADER,SEEK_SET)) return(0);
+  for(;;)
+  {
+    Pos = ftell(MF);
+    T   = fgetc(MF);
+    if((T!=MOV_INPUT)&&(T!=MOV_KEY)&&(T!=MOV_HASH)) break;
+    if(fread(Buf,1,12,MF)!=12)        break;
+    if(T==MOV_INPUT) Frames+=GetINT(Buf);
+    else if(T==MOV_HASH)
+    {
+      if(fseek(MF,4*GetINT(Buf+4),SEEK_CUR)) break;
+    }
+    else
+    {
+      if(!AddKey(GetINT(Buf),Pos))     break;
+      if(fseek(MF,GetINT(Buf+8),SEEK_CUR)) break;
+    }
+  }
+
+  return(KeyCount>0);
+}
+
+/** MOVInit() ************************************************/
+/** Initialize movie subsystem for states of up to MaxSize  **/
+/** bytes, with a keyframe every KeyStep frames. Returns 1  **/
+/** on success, 0 on failure.                               **/
+/*************************************************************/
+int MOVInit(unsigned int (*SaveHandler)(unsigned char *,unsigned int),unsigned int (*LoadHandler)(unsigned char *,unsigned int),unsigned int MaxSize,unsigned int Step)
+{
+  /* Drop any previous buffers */
+  MOVTrash();
+
+  if(!SaveHandler||!LoadHandler||!MaxSize||!Step) return(0);
+
+  /* Compressed data may come out a little larger */
+  ZSize = MaxSize+(MaxSize>>10)+64;
+  State = malloc(MaxSize+ZSize);
+  if(!State) return(0);
+
+  ZBuf      = State+MaxSize;
+  StateSize = MaxSize;
+  KeyStep   = Step;
+  SaveState = SaveHandler;
+  LoadState = LoadHandler;
+  return(1);
+}
+
+/** MOVTrash() ***********************************************/
+/** Stop any movie and free all movie resources.            **/
+/*************************************************************/
+void MOVTrash(void)
+{
+  MOVStop();
+  if(State) free(State);
+  if(Keys)  free(Keys);
+  State     = ZBuf = 0;
+  StateSize = ZSize = 0;
+  Keys      = 0;
+  KeyCount  = KeyMax = 0;
+}
+
+/** MOVHash() ************************************************/
+/** Set a handler computing up to MOV_MAXHASH hashes of the **/
+/** emulation state, or 0 to disable hashing. Recorded      **/
+/** movies get hashes for every frame, played ones get      **/
+/** them checked.                                           **/
+/*************************************************************/
+void MOVHash(unsigned int (*Handler)(unsigned int *))
+{
+  HashState = Handler;
+}
+
+/** MOVRecord() **********************************************/
+/** Start recording a movie into a given file, from current **/
+/** emulation state. Returns 1 on success, 0 on failure.    **/
+/*************************************************************/
+int MOVRecord(const char *FileName)
+{
+  unsigned char Header[MOV_HEADER];
+
+  /* Insure that movies are initialized */
+  if(!State) return(0);
+
+  /* Stop any current movie */
+  MOVStop();
+
+  MF = fopen(FileName,"wb");
+  if(!MF) return(0);
+
+  memset(Header,0,sizeof(Header));
+  memcpy(Header,"MOV\032\001",5);
+  PutINT(Header+5,KeyStep);
+  if(fwrite(Header,1,MOV_HEADER,MF)!=MOV_HEADER)
+  { fclose(MF);MF=0;remove(FileName);return(0); }
+
+  /* First keyframe gets written with the first input */
+  MOVState = MOV_RECORD;
+  Frame    = 0;
+  Run      = 0;
+  KeyCount = 0;
+  return(1);
+}
+
+/** MOVPlay() ************************************************/
+/** Start playing a movie back from a given file, loading   **/
+/** its first keyframe. Returns 1 on success, 0 on failure. **/
+/*************************************************************/
+int MOVPlay(const char *FileName)
+{
+  unsigned char Header[MOV_HEADER];
+
+  /* Insure that movies are initialized */
+  if(!State) return(0);
+
+  /* Stop any current movie */
+  MOVStop();
+
+  MF = fopen(FileName,"rb");
+  if(!MF) return(0);
+
+  /* Check header, get keyframe index */
+  if(
+    (fread(Header,1,MOV_HEADER,MF)!=MOV_HEADER)
+  || memcmp(Header,"MOV\032\001",5)
+  || !ReadIndex()
+  ) { fclose(MF);MF=0;return(0); }
+
+  /* Start from the first keyframe */
+  MOVState = MOV_PLAY;
+  DivHash  = 0;
+  if(MOVSeek(0)==MOV_ENDED) { MOVStop();return(0); }
+  return(1);
+}
+
+/** MOVStop() ************************************************/
+/** Stop recording or playback. When recording, writes out  **/
+/** the keyframe index. Returns 1 on success, 0 on failure. **/
+/*************************************************************/
+int MOVStop(void)
+{
+  unsigned char Buf[MOV_TRAILER];
+  unsigned int J;
+  long Pos = 0;
+  int Result;
+
+  if(!MF) { MOVState=MOV_OFF;return(1); }
+
+  Result = 1;
+  if(MOVState==MOV_RECORD)
+  {
+    /* Write out last input run, then the index */
+    Result = FlushRun() && ((Pos=ftell(MF))>=0);
+    if(Result)
+    {
+      Buf[0] = MOV_INDEX;
+      PutINT(Buf+1,KeyCount);
+      Result = fwrite(Buf,1,5,MF)==5;
+    }
+    for(J=0;Result&&(J<KeyCount);++J)
+    {
+      PutINT(Buf,Keys[J].Frame);
+      PutINT(Buf+4,Keys[J].Pos);
+      Result = fwrite(Buf,1,8,MF)==8;
+    }
+
+    /* Trailer points to the index */
+    if(Result)
+    {
+      memcpy(Buf,"MOVX",4);
+      PutINT(Buf+4,(unsigned int)Pos);
+      PutINT(Buf+8,Frame);
+      Result = fwrite(Buf,1,MOV_TRAILER,MF)==MOV_TRAILER;
+    }
+  }
+
+  if(fclose(MF)) Result=0;
+  MF       = 0;
+  MOVState = MOV_OFF;
+  Run      = 0;
+  return(Result);
+}
+
+/** MOVInput() ***********************************************/
+/** Call this once per frame with current input. Records it **/
+/** when recording, replaces it with recorded input when    **/
+/** playing back. Returns MOVMode() after the call.         **/
+/*************************************************************/
+int MOVInput(unsigned int *Joy,unsigned int *Mouse)
+{
+  switch(MOVState)
+  {
+    case MOV_RECORD:
+      /* Keyframes go before the input of their frame */
+      if(!(Frame%KeyStep)&&(!FlushRun()||!WriteKey()))
+      { MOVStop();break; }
+
+      /* So do state hashes, when enabled */
+      if(HashState&&!WriteHash()) { MOVStop();break; }
+
+      /* Extend current input run, or start a new one */
+      if(Run&&(*Joy==RunJoy)&&(*Mouse==RunMouse)) ++Run;
+      else if(!FlushRun()) { MOVStop();break; }
+      else { Run=1;RunJoy=*Joy;RunMouse=*Mouse; }
+
+      ++Frame;
+      break;
+
+    case MOV_PLAY:
+      /* Stop at the end of the movie */
+      if((Frame>=Frames)||(!Run&&!NextRun())) { MOVStop();break; }
+
+      *Joy   = RunJoy;
+      *Mouse = RunMouse;
+      --Run;
+      ++Frame;
+      break;
+  }
+
+  return(MOVState);
+}
+
+/** MOVSeek() ************************************************/
+/** Jump to the nearest keyframe at or before a given frame **/
+/** of the movie being played and load it. Returns number   **/
+/** of frames to play on to reach the frame, or MOV_ENDED.  **/
+/*************************************************************/
+unsigned int MOVSeek(unsigned int ToFrame)
+{
+  unsigned int L,H,M;
+
+  if((MOVState!=MOV_PLAY)||(ToFrame>Frames)) return(MOV_ENDED);
+  if(!KeyCount||(Keys[0].Frame>ToFrame))      return(MOV_ENDED);
+
+  /* Find the last keyframe at or before ToFrame */
+  for(L=0,H=KeyCount;H-L>1;)
+  {
+    M = (L+H)>>1;
+    if(Keys[M].Frame<=ToFrame) L=M; else H=M;
+  }
+
+  /* Load it and play on from there */
+  if(!LoadKey(Keys[L].Pos)) { MOVStop();return(MOV_ENDED); }
+  Frame   = Keys[L].Frame;
+  Run     = 0;
+  DivHash = 0;
+  return(ToFrame-Frame);
+}
+
+/** MOVMode() ************************************************/
+/** Return MOV_OFF, MOV_RECORD, or MOV_PLAY.                **/
+/*************************************************************/
+int MOVMode(void) { return(MOVState); }
+
+/** MOVFrame() ***********************************************/
+/** Return current frame of the movie.                      **/
+/*************************************************************/
+unsigned int MOVFrame(void) { return(Frame); }
+
+/** MOVDiverged() ********************************************/
+/** Check if movie playback has diverged from the recording **/
+/** since the last MOVPlay() or MOVSeek(). Returns 0 if all **/
+/** hashes matched, or 1+number of the first mismatching    **/
+/** hash, with its frame in *DFrame.                        **/
+/*************************************************************/
+int MOVDiverged(unsigned int *DFrame)
+{
+  if(DivHash&&DFrame) *DFrame=DivFrame;
+  return(DivHash);
+}
+
+/** MOVCount() ***********************************************/
+/** Return number of frames in the movie.                   **/
+/*************************************************************/
+unsigned int MOVCount(void)
+{
+  return(MOVState==MOV_PLAY? Frames:MOVState==MOV_RECORD? Frame:0);
+}
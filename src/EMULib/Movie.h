@@ -0,0 +1,108 @@
+/** EMULib Emulation Library *********************************/
+/**                                                         **/
+/**                         Movie.h                         **/
+/**                                                         **/
+/** This file contains routines for recording gameplay into **/
+/** movie files of any length and playing them back. Input  **/
+/** is streamed to disk as it comes, with a compressed      **/
+/** keyframe every few seconds and a keyframe index at the  **/
+/** end of the file. See Movie.c for implementation.        **/
+/**                                                         **/
+/*************************************************************/
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOV_KEYSTEP  600             /* Default frames/keyframe  */
+#define MOV_MAXHASH  8               /* Max state hashes/frame   */
+
+/** MOVMode() results ****************************************/
+#define MOV_OFF      0               /* No movie                 */
+#define MOV_RECORD   1               /* Recording a movie        */
+#define MOV_PLAY     2               /* Playing a movie back     */
+
+/** MOVSeek() results ****************************************/
+#define MOV_ENDED    0xFFFFFFFF      /* Failed or past the end   */
+
+/** MOVInit() ************************************************/
+/** Initialize movie subsystem for states of up to MaxSize  **/
+/** bytes, with a keyframe every KeyStep frames. Returns 1  **/
+/** on success, 0 on failure.                               **/
+/*************************************************************/
+int MOVInit(unsigned int (*SaveHandler)(unsigned char *,unsigned int),unsigned int (*LoadHandler)(unsigned char *,unsigned int),unsigned int MaxSize,unsigned int KeyStep);
+
+/** MOVTrash() ***********************************************/
+/** Stop any movie and free all movie resources.            **/
+/*************************************************************/
+void MOVTrash(void);
+
+/** MOVHash() ************************************************/
+/** Set a handler computing up to MOV_MAXHASH hashes of the **/
+/** emulation state, or 0 to disable hashing. Recorded      **/
+/** movies get hashes for every frame, played ones get      **/
+/** them checked.                                           **/
+/*************************************************************/
+void MOVHash(unsigned int (*Handler)(unsigned int *));
+
+/** MOVRecord() **********************************************/
+/** Start recording a movie into a given file, from current **/
+/** emulation state. Returns 1 on success, 0 on failure.    **/
+/*************************************************************/
+int MOVRecord(const char *FileName);
+
+/** MOVPlay() ************************************************/
+/** Start playing a movie back from a given file, loading   **/
+/** its first keyframe. Returns 1 on success, 0 on failure. **/
+/*************************************************************/
+int MOVPlay(const char *FileName);
+
+/** MOVStop() ************************************************/
+/** Stop recording or playback. When recording, writes out  **/
+/** the keyframe index. Returns 1 on success, 0 on failure. **/
+/*************************************************************/
+int MOVStop(void);
+
+/** MOVInput() ***********************************************/
+/** Call this once per frame with current input. Records it **/
+/** when recording, replaces it with recorded input when    **/
+/** playing back. Returns MOVMode() after the call.         **/
+/*************************************************************/
+int MOVInput(unsigned int *Joy,unsigned int *Mouse);
+
+/** MOVSeek() ************************************************/
+/** Jump to the nearest keyframe at or before a given frame **/
+/** of the movie being played and load it. Returns number   **/
+/** of frames to play on to reach the frame, or MOV_ENDED.  **/
+/*************************************************************/
+unsigned int MOVSeek(unsigned int Frame);
+
+/** MOVMode() ************************************************/
+/** Return MOV_OFF, MOV_RECORD, or MOV_PLAY.                **/
+/*************************************************************/
+int MOVMode(void);
+
+/** MOVFrame() ***********************************************/
+/** Return current frame of the movie.                      **/
+/*************************************************************/
+unsigned int MOVFrame(void);
+
+/** MOVDiverged() ********************************************/
+/** Check if movie playback has diverged from the recording **/
+/** since the last MOVPlay() or MOVSeek(). Returns 0 if all **/
+/** hashes matched, or 1+number of the first mismatching    **/
+/** hash, with its frame in *DFrame.                        **/
+/*************************************************************/
+int MOVDiverged(unsigned int *DFrame);
+
+/** MOVCount() ***********************************************/
+/** Return number of frames in the movie.                   **/
+/*************************************************************/
+unsigned int MOVCount(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* MOVIE_H */
@@ -0,0 +1,164 @@
+/** EMULib Emulation Library *********************************/
+/**                                                         **/
+/**                        Profile.c                        **/
+/**                                                         **/
+/** This file contains routines accounting host time spent  **/
+/** in emulation subsystems, frame by frame, along with a   **/
+/** rolling histogram of frame times. See Profile.h for     **/
+/** declarations.                                           **/
+/**                                                         **/
+/*************************************************************/
+#ifdef PROFILE
+
+#include "Profile.h"
+
+#include <string.h>
+
+/** Host Clock ***********************************************/
+/** Read often, so it has to be cheap: the time base on the **/
+/** Wii, the monotonic clock elsewhere.                     **/
+/*************************************************************/
+#ifdef WII
+#include <ogc/lwp_watchdog.h>
+#define CLOCK()   gettime()
+#define USEC(T)   ((unsigned int)ticks_to_microsecs(T))
+#else
+#include <time.h>
+static unsigned long long CLOCK(void)
+{
+  struct timespec T;
+  clock_gettime(CLOCK_MONOTONIC,&T);
+  return((unsigned long long)T.tv_sec*1000000000ULL+T.tv_nsec);
+}
+#define USEC(T)   ((unsigned int)((T)/1000))
+#endif
+
+const char *PRFNames[PRF_SECTIONS] =
+{
+  "Other","Z80","RdZ80","WrZ80","Lines","Sprites",
+  "Collide","Audio","Input","Blit","Wait"
+};
+
+static unsigned int Stack[PRF_DEPTH]; /* Sections entered         */
+static unsigned int Depth     = 0;   /* Sections in Stack[]      */
+static unsigned long long Last = 0;  /* Time last charged        */
+static unsigned long long Start = 0; /* Time current frame began */
+
+static unsigned long long FTime[PRF_SECTIONS]; /* This frame     */
+static unsigned int FCount[PRF_SECTIONS];      /* This frame     */
+static unsigned long long PTime[PRF_SECTIONS]; /* This period    */
+static unsigned int PCount[PRF_SECTIONS];      /* This period    */
+static unsigned long long PFrame = 0; /* Frame times this period */
+static unsigned int PMax      = 0;   /* Longest frame this period*/
+static unsigned int Frames    = 0;   /* Frames this period       */
+
+static unsigned char HistBin[PRF_HISTLEN]; /* Last frames' bins  */
+static unsigned int HistPos   = 0;   /* Next HistBin[] entry     */
+static unsigned int HistCount = 0;   /* Entries in HistBin[]     */
+static unsigned int Hist[PRF_HISTSIZE]; /* Counts of HistBin[]   */
+
+static PRFStats Latest;              /* Last published statistics*/
+
+/** Charge() *************************************************/
+/** Charge time since the last call to the current section. **/
+/*************************************************************/
+static void Charge(void)
+{
+  unsigned long long Now = CLOCK();
+
+  if(!Start) Start=Now;
+  else FTime[!Depth? PRF_OTHER:Stack[(Depth>PRF_DEPTH? PRF_DEPTH:Depth)-1]]+=Now-Last;
+  Last = Now;
+}
+
+/** PRFEnter() ***********************************************/
+/** Start charging time to a given section, until the       **/
+/** matching PRFLeave() call.                               **/
+/*************************************************************/
+void PRFEnter(unsigned int Section)
+{
+  Charge();
+  if(Depth<PRF_DEPTH) Stack[Depth]=Section;
+  ++Depth;
+  ++FCount[Section];
+}
+
+/** PRFLeave() ***********************************************/
+/** Go back to charging time to the enclosing section.      **/
+/*************************************************************/
+void PRFLeave(void)
+{
+  Charge();
+  if(Depth) --Depth;
+}
+
+/** PRFFrame() ***********************************************/
+/** Call this once per frame to close the frame's accounts. **/
+/*************************************************************/
+void PRFFrame(void)
+{
+  unsigned int J,Frame,Bin;
+
+  Charge();
+  Frame = USEC(Last-Start);
+  Start = Last;
+
+  /* Add frame to the period */
+  for(J=0;J<PRF_SECTIONS;++J)
+  {
+    PTime[J]  += FTime[J];
+    PCount[J] += FCount[J];
+  }
+  PFrame += Frame;
+  if(Frame>PMax) PMax=Frame;
+  memset(FTime,0,sizeof(FTime));
+  memset(FCount,0,sizeof(FCount));
+
+  /* Replace the oldest frame in the histogram */
+  Bin = Frame/PRF_HISTSTEP;
+  if(Bin>=PRF_HISTSIZE) Bin=PRF_HISTSIZE-1;
+  if(HistCount<PRF_HISTLEN) ++HistCount; else --Hist[HistBin[HistPos]];
+  HistBin[HistPos] = Bin;
+  HistPos = (HistPos+1)%PRF_HISTLEN;
+  ++Hist[Bin];
+
+  /* Publish statistics at the end of each period */
+  if(++Frames>=PRF_PERIOD)
+  {
+    for(J=0;J<PRF_SECTIONS;++J)
+    {
+      Latest.Time[J]  = USEC(PTime[J]/Frames);
+      Latest.Count[J] = PCount[J]/Frames;
+    }
+    Latest.Frame    = (unsigned int)(PFrame/Frames);
+    Latest.MaxFrame = PMax;
+    memcpy(Latest.Hist,Hist,sizeof(Hist));
+
+    memset(PTime,0,sizeof(PTime));
+    memset(PCount,0,sizeof(PCount));
+    PFrame = 0;
+    PMax   = 0;
+    Frames = 0;
+  }
+}
+
+/** PRFSkip() ************************************************/
+/** Drop the current frame's accounts. Call this after the  **/
+/** emulation has been paused, e.g. for a menu.             **/
+/*************************************************************/
+void PRFSkip(void)
+{
+  memset(FTime,0,sizeof(FTime));
+  memset(FCount,0,sizeof(FCount));
+  Start = Last = CLOCK();
+}
+
+/** PRFGetStats() ********************************************/
+/** Copy the latest statistics into a given structure.      **/
+/*************************************************************/
+void PRFGetStats(PRFStats *Stats)
+{
+  *Stats = Latest;
+}
+
+#endif /* PROFILE */
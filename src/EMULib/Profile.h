@@ -0,0 +1,105 @@
+/** EMULib Emulation Library *********************************/
+/**                                                         **/
+/**                        Profile.h                        **/
+/**                                                         **/
+/** This file contains routines accounting host time spent  **/
+/** in emulation subsystems, frame by frame, along with a   **/
+/** rolling histogram of frame times. Everything compiles   **/
+/** out unless PROFILE is #defined. See Profile.c for the   **/
+/** implementation.                                         **/
+/**                                                         **/
+/*************************************************************/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Sections *************************************************/
+/** Time is charged to the innermost section entered, so    **/
+/** that nested sections do not count twice.                **/
+/*************************************************************/
+#define PRF_OTHER    0               /* Outside of any section   */
+#define PRF_Z80      1               /* RunZ80(), LoopZ80()      */
+#define PRF_RDZ80    2               /* RdZ80() slow paths       */
+#define PRF_WRZ80    3               /* WrZ80() slow paths       */
+#define PRF_LINE     4               /* Loop9918() line handlers */
+#define PRF_SPRITES  5               /* RefreshSprites()         */
+#define PRF_CHECK    6               /* CheckSprites()           */
+#define PRF_AUDIO    7               /* Rendering/playing audio  */
+#define PRF_INPUT    8               /* Joystick() polling       */
+#define PRF_BLIT     9               /* RefreshScreen() blit     */
+#define PRF_WAIT     10              /* RefreshScreen() wait     */
+#define PRF_SECTIONS 11              /* Number of sections       */
+
+#define PRF_DEPTH    16              /* Max section nesting      */
+#define PRF_PERIOD   60              /* Frames/statistics update */
+#define PRF_HISTSIZE 32              /* Frame time histogram bins*/
+#define PRF_HISTSTEP 1000            /* Microseconds per bin     */
+#define PRF_HISTLEN  256             /* Frames in the histogram  */
+
+/** PRFStats *************************************************/
+/** Statistics averaged over the last PRF_PERIOD frames,    **/
+/** times in microseconds per frame. Hist[] counts the last **/
+/** PRF_HISTLEN frame times, the last bin takes all longer  **/
+/** frames.                                                 **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Time[PRF_SECTIONS];   /* Time in each section     */
+  unsigned int Count[PRF_SECTIONS];  /* Entries to each section  */
+  unsigned int Frame;                /* Average frame time       */
+  unsigned int MaxFrame;             /* Longest frame time       */
+  unsigned int Hist[PRF_HISTSIZE];   /* Frame time histogram     */
+} PRFStats;
+
+#ifdef PROFILE
+
+extern const char *PRFNames[PRF_SECTIONS];
+
+#define PRF_ENTER(S) PRFEnter(S)
+#define PRF_LEAVE()  PRFLeave()
+#define PRF_FRAME()  PRFFrame()
+#define PRF_SKIP()   PRFSkip()
+
+/** PRFEnter() ***********************************************/
+/** Start charging time to a given section, until the       **/
+/** matching PRFLeave() call.                               **/
+/*************************************************************/
+void PRFEnter(unsigned int Section);
+
+/** PRFLeave() ***********************************************/
+/** Go back to charging time to the enclosing section.      **/
+/*************************************************************/
+void PRFLeave(void);
+
+/** PRFFrame() ***********************************************/
+/** Call this once per frame to close the frame's accounts. **/
+/*************************************************************/
+void PRFFrame(void);
+
+/** PRFSkip() ************************************************/
+/** Drop the current frame's accounts. Call this after the  **/
+/** emulation has been paused, e.g. for a menu.             **/
+/*************************************************************/
+void PRFSkip(void);
+
+/** PRFGetStats() ********************************************/
+/** Copy the latest statistics into a given structure.      **/
+/*************************************************************/
+void PRFGetStats(PRFStats *Stats);
+
+#else
+
+#define PRF_ENTER(S)
+#define PRF_LEAVE()
+#define PRF_FRAME()
+#define PRF_SKIP()
+
+#endif /* PROFILE */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* PROFILE_H */
@@ -0,0 +1,324 @@
+/** EMULib Emulation Library *********************************/
+/**                                                         **/
+/**                        Rewind.c                         **/
+/**                                                         **/
+/** This file contains routines for stepping emulation back **/
+/** in time. States are kept as XOR deltas against previous **/
+/** states, run-length coded, with a full keyframe every    **/
+/** few records. See Rewind.h for declarations.             **/
+/**                                                         **/
+/*************************************************************/
+#include "Rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RWD_KEY      0x80000000      /* Record is a keyframe     */
+#define RWD_GAP      4               /* Max same bytes in a run  */
+#define RWD_SLACK    16              /* Worst-case coding growth */
+#define RWD_RECSIZE  128             /* Pool bytes per record    */
+
+/** Coded Records ********************************************/
+/** Every record codes one state as runs of XOR differences **/
+/** from the previous state. Keyframes are coded against an **/
+/** all-zero state. Records are kept in a circular pool in  **/
+/** recording order, and the oldest record is always a      **/
+/** keyframe, so each state can be rebuilt from one.        **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Pos;                  /* Offset in RWDPool[]      */
+  unsigned int Size;                 /* Coded size | RWD_KEY     */
+  unsigned int State;                /* State size               */
+} RWDRecordT;
+
+static unsigned char *RWDPool = 0;   /* Coded records            */
+static unsigned int PoolSize  = 0;   /* RWDPool[] size           */
+static RWDRecordT *RWDList    = 0;   /* Records, oldest first    */
+static unsigned int MaxCount  = 0;   /* RWDList[] size           */
+static unsigned int First     = 0;   /* Oldest record in RWDList */
+static unsigned int Count     = 0;   /* Records in RWDList       */
+static unsigned int Head      = 0;   /* Oldest record in RWDPool */
+static unsigned int Tail      = 0;   /* Free space in RWDPool    */
+static unsigned int Since     = 0;   /* Records since keyframe   */
+static unsigned int KeyStep   = 0;   /* Records per keyframe     */
+
+static unsigned char *Cur     = 0;   /* Last recorded state      */
+static unsigned char *Tmp     = 0;   /* New state being coded    */
+static unsigned int CurSize   = 0;   /* Cur[] state size         */
+static unsigned int StateSize = 0;   /* Max state size           */
+
+static unsigned int (*SaveState)(unsigned char *,unsigned int) = 0;
+static unsigned int (*LoadState)(unsigned char *,unsigned int) = 0;
+
+/** PutNum()/GetNum() ****************************************/
+/** Code numbers in 7-bit groups, with bit 7 set on all but **/
+/** the last group.                                         **/
+/*************************************************************/
+static unsigned char *PutNum(unsigned char *P,unsigned int N)
+{
+  for(;N>=0x80;N>>=7) *P++=(N&0x7F)|0x80;
+  *P++=N;
+  return(P);
+}
+
+static const unsigned char *GetNum(const unsigned char *P,unsigned int *N)
+{
+  unsigned int J,V;
+  for(J=0,V=0;*P&0x80;J+=7) V|=(*P++&0x7F)<<J;
+  *N=V|(*P++<<J);
+  return(P);
+}
+
+/** Encode() *************************************************/
+/** Code differences between New[] and Old[] (all zeros if  **/
+/** Old=0) into Dst[], as (skip,length,XOR bytes) runs. Up  **/
+/** to RWD_GAP unchanged bytes are merged into a run to save **/
+/** on run headers. Returns coded size, which never exceeds **/
+/** Size+RWD_SLACK.                                         **/
+/*************************************************************/
+static unsigned int Encode(unsigned char *Dst,const unsigned char *New,const unsigned char *Old,unsigned int Size)
+{
+  unsigned char *P = Dst;
+  unsigned int I,J,K,L;
+
+  for(I=0;I<Size;I=K)
+  {
+    /* Skip unchanged bytes */
+    if(Old) for(J=I;(J<Size)&&(New[J]==Old[J]);++J);
+    else    for(J=I;(J<Size)&&!New[J];++J);
+    if(J>=Size) break;
+
+    /* Find the end of the run */
+    for(K=J+1,L=K;K<Size;++K)
+      if(Old? (New[K]!=Old[K]):New[K]) L=K+1;
+      else if(K-L>=RWD_GAP) break;
+    K=L;
+
+    /* Store the run */
+    P=PutNum(P,J-I);
+    P=PutNum(P,K-J);
+    if(Old) for(;J<K;++J) *P++=New[J]^Old[J];
+    else    { memcpy(P,New+J,K-J);P+=K-J; }
+  }
+
+  return(P-Dst);
+}
+
+/** Decode() *************************************************/
+/** Apply coded differences from Src[] to Buf[] in place.   **/
+/** Since XOR is its own inverse, this steps Buf[] either   **/
+/** forward or back by one record.                          **/
+/*************************************************************/
+static void Decode(unsigned char *Buf,const unsigned char *Src,unsigned int Size)
+{
+  const unsigned char *End = Src+Size;
+  unsigned int N;
+
+  while(Src<End)
+  {
+    Src=GetNum(Src,&N);Buf+=N;
+    Src=GetNum(Src,&N);
+    for(;N;--N) *Buf++^=*Src++;
+  }
+}
+
+/** DropOldest() *********************************************/
+/** Drop the oldest keyframe and the deltas following it.   **/
+/*************************************************************/
+static void DropOldest(void)
+{
+  do { First=(First+1)%MaxCount;--Count; }
+  while(Count&&!(RWDList[First].Size&RWD_KEY));
+  if(!Count) Head=Tail=0; else Head=RWDList[First].Pos;
+}
+
+/** Reserve() ************************************************/
+/** Make Need contiguous bytes available at RWDPool+Tail,   **/
+/** dropping the oldest records if needed. Returns 1 on     **/
+/** success, 0 if the pool is too small.                    **/
+/*************************************************************/
+static int Reserve(unsigned int Need)
+{
+  if(Need>PoolSize) return(0);
+
+  for(;Count;DropOldest())
+    if(Tail>Head)
+    {
+      /* Room after the newest record or at pool start */
+      if(PoolSize-Tail>=Need) return(1);
+      if(Head>=Need) { Tail=0;return(1); }
+    }
+    else if(Head-Tail>=Need) return(1);
+
+  /* Pool is empty */
+  Head=Tail=0;
+  return(1);
+}
+
+/** RWDInit() ************************************************/
+/** Initialize rewind store, allocating PoolSize bytes for  **/
+/** coded states of up to MaxSize bytes. A keyframe is kept **/
+/** every KeyStep records. Returns 1 on success, 0 on       **/
+/** failure.                                                **/
+/*************************************************************/
+int RWDInit(unsigned int (*SaveHandler)(unsigned char *,unsigned int),unsigned int (*LoadHandler)(unsigned char *,unsigned int),unsigned int MaxSize,unsigned int Size,unsigned int Step)
+{
+  unsigned char *P;
+  unsigned int J;
+
+  /* Free old resources */
+  RWDTrash();
+
+  /* Pool must hold at least a couple of keyframes */
+  if(!SaveHandler||!LoadHandler||(Size<4*(MaxSize+RWD_SLACK))) return(0);
+
+  /* Allocate pool, record list, and two state buffers at once */
+  J = Size/RWD_RECSIZE;
+  P = malloc(Size+J*sizeof(RWDRecordT)+2*MaxSize);
+  if(!P) return(0);
+
+  RWDList   = (RWDRecordT *)P;
+  RWDPool   = P+J*sizeof(RWDRecordT);
+  Cur       = RWDPool+Size;
+  Tmp       = Cur+MaxSize;
+  MaxCount  = J;
+  PoolSize  = Size;
+  StateSize = MaxSize;
+  KeyStep   = Step? Step:RWD_KEYSTEP;
+  SaveState = SaveHandler;
+  LoadState = LoadHandler;
+
+  RWDReset();
+  return(1);
+}
+
+/** RWDTrash() ***********************************************/
+/** Free all rewind store resources.                        **/
+/*************************************************************/
+void RWDTrash(void)
+{
+  /* Pool, list, and state buffers share one allocation */
+  if(RWDList) free(RWDList);
+
+  RWDList   = 0;
+  RWDPool   = 0;
+  Cur = Tmp = 0;
+  PoolSize  = 0;
+  MaxCount  = 0;
+  StateSize = 0;
+  RWDReset();
+}
+
+/** RWDReset() ***********************************************/
+/** Drop all recorded states, i.e. after loading a game.    **/
+/*************************************************************/
+void RWDReset(void)
+{
+  First = Count = 0;
+  Head  = Tail  = 0;
+  Since = CurSize = 0;
+}
+
+/** RWDRecord() **********************************************/
+/** Record current emulation state, dropping the oldest     **/
+/** states when out of room. Returns 1 on success, 0 on     **/
+/** failure.                                                **/
+/*************************************************************/
+int RWDRecord(void)
+{
+  unsigned char *P;
+  unsigned int Size,J,Key;
+
+  /* Must be initialized */
+  if(!RWDPool) return(0);
+
+  /* Save new state */
+  Size = SaveState(Tmp,StateSize);
+  if(!Size) return(0);
+
+  /* Make room for the new record */
+  if(Count==MaxCount) DropOldest();
+  if(!Reserve(Size+RWD_SLACK)) return(0);
+
+  /* Start a keyframe when due, or if state size changed */
+  Key = !Count || (Since+1>=KeyStep) || (Size!=CurSize);
+
+  /* Code the state and append the record */
+  J = Encode(RWDPool+Tail,Tmp,Key? 0:Cur,Size);
+  RWDList[(First+Count)%MaxCount].Pos   = Tail;
+  RWDList[(First+Count)%MaxCount].Size  = J|(Key? RWD_KEY:0);
+  RWDList[(First+Count)%MaxCount].State = Size;
+  if(!Count) Head=Tail;
+  Tail += J;
+  ++Count;
+
+  /* New state becomes the current one */
+  Since   = Key? 0:Since+1;
+  P       = Cur;
+  Cur     = Tmp;
+  Tmp     = P;
+  CurSize = Size;
+  return(1);
+}
+
+/** RWDBack() ************************************************/
+/** Step back to the previously recorded state and load it. **/
+/** Returns 1 on success, 0 if there is no earlier state.   **/
+/*************************************************************/
+int RWDBack(void)
+{
+  RWDRecordT *R;
+  unsigned int J,K;
+
+  /* Need at least one state before the current one */
+  if(Count<2) return(0);
+
+  /* Newest record codes the current state */
+  R = RWDList+(First+Count-1)%MaxCount;
+
+  if(!(R->Size&RWD_KEY))
+  {
+    /* Undo the delta */
+    Decode(Cur,RWDPool+R->Pos,R->Size);
+    --Since;
+  }
+  else
+  {
+    /* Find the previous keyframe (oldest record is one) */
+    for(K=Count-2;K&&!(RWDList[(First+K)%MaxCount].Size&RWD_KEY);--K);
+
+    /* Rebuild the state from it */
+    R = RWDList+(First+K)%MaxCount;
+    memset(Cur,0,R->State);
+    Decode(Cur,RWDPool+R->Pos,R->Size&~RWD_KEY);
+    CurSize = R->State;
+    for(J=K+1;J<Count-1;++J)
+    {
+      R = RWDList+(First+J)%MaxCount;
+      Decode(Cur,RWDPool+R->Pos,R->Size);
+    }
+    Since = Count-2-K;
+    R = RWDList+(First+Count-1)%MaxCount;
+  }
+
+  /* Drop the newest record */
+  Tail = R->Pos;
+  --Count;
+
+  /* Load the state */
+  return(LoadState(Cur,CurSize)? 1:0);
+}
+
+/** RWDCount() ***********************************************/
+/** Return the number of states recorded.                   **/
+/*************************************************************/
+unsigned int RWDCount(void) { return(Count); }
+
+/** RWDUsed() ************************************************/
+/** Return the number of pool bytes taken by coded states.  **/
+/*************************************************************/
+unsigned int RWDUsed(void)
+{
+  return(!Count? 0:Tail>Head? Tail-Head:PoolSize-Head+Tail);
+}
@@ -0,0 +1,64 @@
+/** EMULib Emulation Library *********************************/
+/**                                                         **/
+/**                        Rewind.h                         **/
+/**                                                         **/
+/** This file contains routines for stepping emulation back **/
+/** in time. States are kept as XOR deltas against previous **/
+/** states, run-length coded, with a full keyframe every    **/
+/** few records. See Rewind.c for implementation.           **/
+/**                                                         **/
+/*************************************************************/
+#ifndef REWIND_H
+#define REWIND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RWD_KEYSTEP  60              /* Default records/keyframe */
+
+/** RWDInit() ************************************************/
+/** Initialize rewind store, allocating PoolSize bytes for  **/
+/** coded states of up to MaxSize bytes. A keyframe is kept **/
+/** every KeyStep records. Returns 1 on success, 0 on       **/
+/** failure.                                                **/
+/*************************************************************/
+int RWDInit(unsigned int (*SaveHandler)(unsigned char *,unsigned int),unsigned int (*LoadHandler)(unsigned char *,unsigned int),unsigned int MaxSize,unsigned int PoolSize,unsigned int KeyStep);
+
+/** RWDTrash() ***********************************************/
+/** Free all rewind store resources.                        **/
+/*************************************************************/
+void RWDTrash(void);
+
+/** RWDReset() ***********************************************/
+/** Drop all recorded states, i.e. after loading a game.    **/
+/*************************************************************/
+void RWDReset(void);
+
+/** RWDRecord() **********************************************/
+/** Record current emulation state, dropping the oldest     **/
+/** states when out of room. Returns 1 on success, 0 on     **/
+/** failure.                                                **/
+/*************************************************************/
+int RWDRecord(void);
+
+/** RWDBack() ************************************************/
+/** Step back to the previously recorded state and load it. **/
+/** Returns 1 on success, 0 if there is no earlier state.   **/
+/*************************************************************/
+int RWDBack(void);
+
+/** RWDCount() ***********************************************/
+/** Return the number of states recorded.                   **/
+/*************************************************************/
+unsigned int RWDCount(void);
+
+/** RWDUsed() ************************************************/
+/** Return the number of pool bytes taken by coded states.  **/
+/*************************************************************/
+unsigned int RWDUsed(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* REWIND_H */
@@ -120,6 +120,14 @@ static int NoiseOut   = 16;       /* NoiseGen bit used for output     */
 static int NoiseXor   = 14;       /* NoiseGen bit used for XORing     */
 int MasterSwitch      = 0xFFFF;   /* Switches to turn channels on/off */
 int MasterVolume      = 192;      /* Master volume                    */
+static void (*Renderer)(int *,unsigned int) = 0; /* 0: RenderAudio()  */
+
+/** RenderAudio() Span Thresholds *************************************/
+/** Below these phase steps, output runs are long enough that filling **/
+/** constant spans beats per-sample evaluation.                       **/
+/**********************************************************************/
+#define SPAN_MELODIC 0x0800       /* Melodic channels (~1.5kHz@48kHz) */
+#define SPAN_NOISE   0x1000       /* Noise channels (~3kHz@48kHz)     */
 
 /** MIDI Logging Variables ********************************************/
 static const char *LogName = 0;   /* MIDI logging file name           */
@@ -305,6 +313,26 @@ const signed char *GetWave(int Channel)
   );
 }
 
+/** LogSound() ***********************************************/
+/** Add a chip write with given Data, stamped with CPU      **/
+/** cycle Time, to the log. Returns 1 on success, 0 if the  **/
+/** log is full.                                            **/
+/*************************************************************/
+int LogSound(SndLog *L,unsigned int Time,unsigned int Data)
+{
+  register unsigned int J;
+
+  /* Fail if the log is full */
+  J = L->WPtr;
+  if(J-SndAcquire(L->RPtr)>=SND_LOGSIZE) return(0);
+
+  /* Store the write, then publish it */
+  L->Time[J&(SND_LOGSIZE-1)] = Time;
+  L->Data[J&(SND_LOGSIZE-1)] = Data;
+  SndRelease(L->WPtr,J+1);
+  return(1);
+}
+
 /** InitMIDI() ***********************************************/
 /** Initialize soundtrack logging into MIDI file FileName.  **/
 /** Repeated calls to InitMIDI() will close current MIDI    **/
@@ -689,7 +717,7 @@ void TrashSound(void)
 /*************************************************************/
 void RenderAudio(int *Wave,unsigned int Samples)
 {
-  register int J,K,I,L1,L2,V,A1;
+  register int J,K,I,L1,L2,V,A1,M;
 #ifdef WAVE_INTERPOLATION
   /* Keep GCC happy about variable initialization */
   register int A2 = 0;
@@ -784,11 +812,24 @@ void RenderAudio(int *Wave,unsigned int Samples)
             K = 0x10000;
           }
           L1=WaveCH[J].Count;
-          for(I=0;I<Samples;I++)
+          /* Output stays constant until the next generator step, */
+          /* so fill whole spans when steps are far enough apart  */
+          for(I=0;I<Samples;)
           {
-            /* Use NoiseOut bit for output */
-            Wave[I]+=((NoiseGen>>NoiseOut)&1? 127:-128)*V;
-            L1+=K;
+            if(K<SPAN_NOISE)
+            {
+              M  = K? (0x10000-L1+K-1)/K:Samples;
+              M  = M<Samples-I? M:Samples-I;
+              L1+= M*K;
+              A1 = ((NoiseGen>>NoiseOut)&1? 127:-128)*V;
+              for(M+=I;I<M;++I) Wave[I]+=A1;
+            }
+            else
+            {
+              /* Use NoiseOut bit for output */
+              Wave[I++]+=((NoiseGen>>NoiseOut)&1? 127:-128)*V;
+              L1+=K;
+            }
             if(L1&0xFFFF0000)
             {
               /* XOR NoiseOut and NoiseXOR bits and feed them back */
@@ -809,8 +850,32 @@ void RenderAudio(int *Wave,unsigned int Samples)
           K=0x10000*WaveCH[J].Freq/SndRate;
           L1=WaveCH[J].Count;
 #if !defined(SLOW_MELODIC_AUDIO)
-          for(I=0;I<Samples;I++,L1+=K)
-            Wave[I]+=((L1-K)^(L1+K))&0x8000? 0:(L1&0x8000? 127:-128)*V;
+          /* Output only changes when L1-K, L1, or L1+K crosses a */
+          /* half-period edge, so fill constant spans in between  */
+          if(K<SPAN_MELODIC)
+            for(I=0;I<Samples;)
+            {
+              /* Distance to the nearest edge ahead */
+              M  = 0x8000-((L1-K)&0x7FFF);
+              L2 = 0x8000-(L1&0x7FFF);
+              M  = L2<M? L2:M;
+              L2 = 0x8000-((L1+K)&0x7FFF);
+              M  = L2<M? L2:M;
+              /* Convert it to samples, clipped to the buffer */
+              M  = K? (M+K-1)/K:Samples;
+              M  = M<Samples-I? M:Samples-I;
+              A1 = ((L1-K)^(L1+K))&0x8000? 0:(L1&0x8000? 127:-128)*V;
+              L1+= M*K;
+              for(M+=I;I<M;++I) Wave[I]+=A1;
+            }
+          else
+          {
+            /* Short spans: branch-free per-sample selection */
+            L2 = -128*V;
+            A1 = 255*V;
+            for(I=0;I<Samples;I++,L1+=K)
+              Wave[I]+=(L2+((L1>>15)&1)*A1)&((((L1-K)^(L1+K))>>15&1)-1);
+          }
 #else /* SLOW_MELODIC_AUDIO */
           for(I=0;I<Samples;I++,L1+=K)
           {
@@ -826,6 +891,33 @@ void RenderAudio(int *Wave,unsigned int Samples)
       }
 }
 
+/** ConvertAudio() *******************************************/
+/** Scale mixed samples by MasterVolume, clamp them, and    **/
+/** convert them to the output sample format in one pass.   **/
+/*************************************************************/
+static void ConvertAudio(sample *Buf,const int *Wave,unsigned int Samples)
+{
+  register unsigned int I;
+  register int D,V;
+
+  /* Kept branch-free so that the compiler can vectorize it */
+  for(I=0,V=MasterVolume;I<Samples;++I)
+  {
+    D      = (Wave[I]*V)>>8;
+    D      = D>32767? 32767:D;
+    D      = D<-32768? -32768:D;
+#if defined(BPU16)
+    Buf[I] = D+32768;
+#elif defined(BPS16)
+    Buf[I] = D;
+#elif defined(BPU8)
+    Buf[I] = (D>>8)+128;
+#else
+    Buf[I] = D>>8;
+#endif
+  }
+}
+
 /** PlayAudio() **********************************************/
 /** Normalize and play given number of samples from the mix **/
 /** buffer. Returns the number of samples actually played.  **/
@@ -834,7 +926,6 @@ unsigned int PlayAudio(int *Wave,unsigned int Samples)
 {
   sample Buf[256];
   unsigned int I,J,K;
-  int D;
 
   /* Exit if wave sound not initialized */
   if(SndRate<8192) return(0);
@@ -850,23 +941,8 @@ unsigned int PlayAudio(int *Wave,unsigned int Samples)
     J = sizeof(Buf)/sizeof(sample);
     J = Samples-K>J? J:Samples-K;
 
-    /* Convert samples */
-    for(I=0;I<J;++I)
-    {
-      D      = ((*Wave++)*MasterVolume)>>8;
-      D      = D>32767? 32767:D<-32768? -32768:D;
-#if defined(BPU16)
-      Buf[I] = D+32768;
-#elif defined(BPS16)
-      Buf[I] = D;
-#elif defined(BPU8)
-      Buf[I] = (D>>8)+128;
-#else
-      Buf[I] = D>>8;
-#endif
-    }
-
-    /* Play samples */
+    /* Convert and play samples */
+    ConvertAudio(Buf,Wave+K,J);
     I = WriteAudio(Buf,J);
   }
 
@@ -881,6 +957,7 @@ unsigned int PlayAudio(int *Wave,unsigned int Samples)
 unsigned int RenderAndPlayAudio(unsigned int Samples)
 {
   int Buf[256];
+  sample Out[256];
   unsigned int J,I;
 
   /* Exit if wave sound not initialized */
@@ -889,17 +966,29 @@ unsigned int RenderAndPlayAudio(unsigned int Samples)
   J       = GetFreeAudio();
   Samples = Samples<J? Samples:J;
  
-  /* Render and play sound */
+  /* Render, convert, and play sound in blocks, without */
+  /* going through PlayAudio() and its GetFreeAudio()   */
   for(I=0;I<Samples;I+=J)
   {
     J = Samples-I;
     J = J<sizeof(Buf)/sizeof(Buf[0])? J:sizeof(Buf)/sizeof(Buf[0]);
     memset(Buf,0,J*sizeof(Buf[0]));
-    RenderAudio(Buf,J);
-    if(PlayAudio(Buf,J)<J) { I+=J;break; }
+    if(Renderer) (*Renderer)(Buf,J); else RenderAudio(Buf,J);
+    ConvertAudio(Out,Buf,J);
+    if(WriteAudio(Out,J)<J) { I+=J;break; }
   }
 
   /* Return number of samples rendered */
   return(I);
 }
 #endif /* !NO_AUDIO_PLAYBACK */
+
+/** SetAudioRenderer() ***************************************/
+/** Make RenderAndPlayAudio() call Handler instead of       **/
+/** RenderAudio() to fill the mixing buffer. Set Handler to **/
+/** 0 to go back to RenderAudio().                          **/
+/*************************************************************/
+void SetAudioRenderer(void (*Handler)(int *Wave,unsigned int Samples))
+{
+  Renderer = Handler;
+}
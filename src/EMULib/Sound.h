@@ -39,6 +39,8 @@ extern "C" {
 #define MIDI_MAXFREQ    12285  /* Max MIDI frequency (Hz)    */
 #define MIDI_DIVISIONS  1000   /* Number of ticks per second */
 
+#define SND_LOGSIZE     8192   /* Logged writes, power of 2  */
+
                                /* MIDILogging() arguments:   */
 #define MIDI_OFF        0      /* Turn MIDI logging off      */
 #define MIDI_ON         1      /* Turn MIDI logging on       */
@@ -55,6 +57,18 @@ unsigned int InitSound(unsigned int Rate,unsigned int Latency);
 /*************************************************************/
 void TrashSound(void);
 
+/** InitAudio() **********************************************/
+/** Platform audio driver InitSound() starts. Returns rate  **/
+/** (Hz) on success, else 0. Platform Lib*.h headers may    **/
+/** declare it too.                                         **/
+/*************************************************************/
+unsigned int InitAudio(unsigned int Rate,unsigned int Latency);
+
+/** TrashAudio() *********************************************/
+/** Free resources allocated by InitAudio().                **/
+/*************************************************************/
+void TrashAudio(void);
+
 /** RenderAudio() ********************************************/
 /** Render given number of melodic sound samples into an    **/
 /** integer buffer for mixing.                              **/
@@ -73,6 +87,53 @@ unsigned int PlayAudio(int *Wave,unsigned int Samples);
 /*************************************************************/
 unsigned int RenderAndPlayAudio(unsigned int Samples);
 
+/** SetAudioRenderer() ***************************************/
+/** Make RenderAndPlayAudio() call Handler instead of       **/
+/** RenderAudio() to fill the mixing buffer. Set Handler to **/
+/** 0 to go back to RenderAudio().                          **/
+/*************************************************************/
+void SetAudioRenderer(void (*Handler)(int *Wave,unsigned int Samples));
+
+/** SndLog ***************************************************/
+/** Ring buffer of sound chip writes stamped with the CPU   **/
+/** cycle at which they happened. The emulated CPU adds     **/
+/** writes with LogSound(), while the audio renderer takes  **/
+/** them out in time order and applies each one at its own  **/
+/** sample. RPtr and WPtr are free-running counters. The    **/
+/** writer only stores WPtr, the reader only stores RPtr,   **/
+/** so the two may run on different threads.                **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Time[SND_LOGSIZE];   /* CPU cycle of each write */
+  unsigned short Data[SND_LOGSIZE]; /* Chip-specific data      */
+  unsigned int RPtr,WPtr;           /* Read/write counters     */
+} SndLog;
+
+/** Ordering for SndLog counters shared between threads: a  **/
+/** release store makes the entries written before it       **/
+/** visible to whoever makes an acquire load of the counter.**/
+#ifdef __GNUC__
+#define SndAcquire(V)   __atomic_load_n(&(V),__ATOMIC_ACQUIRE)
+#define SndRelease(V,X) __atomic_store_n(&(V),(X),__ATOMIC_RELEASE)
+#define SndFence()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define SndAcquire(V)   (*(volatile unsigned int *)&(V))
+#define SndRelease(V,X) (*(volatile unsigned int *)&(V)=(X))
+#define SndFence()
+#endif
+
+#define SndLogEmpty(L) ((L)->RPtr==SndAcquire((L)->WPtr))
+#define SndLogTime(L)  ((L)->Time[(L)->RPtr&(SND_LOGSIZE-1)])
+#define SndLogData(L)  ((L)->Data[(L)->RPtr&(SND_LOGSIZE-1)])
+
+/** LogSound() ***********************************************/
+/** Add a chip write with given Data, stamped with CPU      **/
+/** cycle Time, to the log. Returns 1 on success, 0 if the  **/
+/** log is full.                                            **/
+/*************************************************************/
+int LogSound(SndLog *L,unsigned int Time,unsigned int Data);
+
 /** Sound() **************************************************/
 /** Generate sound of given frequency (Hz) and volume       **/
 /** (0..255) via given channel. Setting Freq=0 or Volume=0  **/
@@ -13,6 +13,8 @@
 /*************************************************************/
 
 #include "TMS9918.h"
+#include "Profile.h"
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -266,7 +268,11 @@ byte Loop9918(TMS9918 *VDP)
   /* If refreshing display area, call scanline handler */
   if((VDP->Line>=TMS9918_START_LINE)&&(VDP->Line<TMS9918_END_LINE))
     if(VDP->UCount>=100)
+    {
+      PRF_ENTER(PRF_LINE);
       Screen9918[VDP->Mode].LineHandler(VDP,VDP->Line-TMS9918_START_LINE);
+      PRF_LEAVE();
+    }
 
   /* If time for VBlank... */
   if(VDP->Line==TMS9918_END_LINE)
@@ -291,7 +297,11 @@ byte Loop9918(TMS9918 *VDP)
 
     /* Set Sprite Collision status flag */
     if(!(VDP->Status&TMS9918_STAT_OVRLAP))
+    {
+      PRF_ENTER(PRF_CHECK);
       if(CheckSprites(VDP)) VDP->Status|=TMS9918_STAT_OVRLAP;
+      PRF_LEAVE();
+    }
   }
 
   /* Done */
@@ -368,25 +378,32 @@ byte RdData9918(TMS9918 *VDP)
 /** Save9918() ***********************************************/
 /** Save TMS9918 state to a given buffer of given maximal   **/
 /** size. Returns number of bytes saved or 0 on failure.    **/
+/** When Buf=0, returns number of bytes it would save.      **/
 /*************************************************************/
 unsigned int Save9918(const TMS9918 *VDP,byte *Buf,unsigned int Size)
 {
-  unsigned int N = (const byte *)&(VDP->XBuf) - (const byte *)VDP;
-  TMS9918 TMP;
+  unsigned int N = offsetof(TMS9918,XBuf);
+  quad Reserved[6];
+
+  /* Just asking for the size */
+  if(!Buf) return(N);
 
   /* Must have enough bytes */
   if(N>Size) return(0);
 
+  /* Copy state straight into the buffer */
+  memcpy(Buf,VDP,N);
+
   /* Fill outdated fields for backward compatibility */
-  TMP = *VDP;
-  TMP.Reserved1    = 0;
-  TMP.Reserved2[0] = TMP.ChrTab-TMP.VRAM;
-  TMP.Reserved2[1] = TMP.ChrGen-TMP.VRAM;
-  TMP.Reserved2[2] = TMP.SprTab-TMP.VRAM;
-  TMP.Reserved2[3] = TMP.SprGen-TMP.VRAM;
-  TMP.Reserved2[4] = TMP.ColTab-TMP.VRAM;
-
-  memcpy(Buf,&TMP,N);
+  Reserved[0] = 0;
+  Reserved[1] = VDP->ChrTab-VDP->VRAM;
+  Reserved[2] = VDP->ChrGen-VDP->VRAM;
+  Reserved[3] = VDP->SprTab-VDP->VRAM;
+  Reserved[4] = VDP->SprGen-VDP->VRAM;
+  Reserved[5] = VDP->ColTab-VDP->VRAM;
+  memcpy(Buf+offsetof(TMS9918,Reserved1),Reserved,sizeof(VDP->Reserved1));
+  memcpy(Buf+offsetof(TMS9918,Reserved2),Reserved+1,sizeof(VDP->Reserved2));
+
   return(N);
 }
 
@@ -396,7 +413,7 @@ unsigned int Save9918(const TMS9918 *VDP,byte *Buf,unsigned int Size)
 /*************************************************************/
 unsigned int Load9918(TMS9918 *VDP,byte *Buf,unsigned int Size)
 {
-  unsigned int N = (const byte *)&(VDP->XBuf) - (const byte *)VDP;
+  unsigned int N = offsetof(TMS9918,XBuf);
   int XPal[16],Width,Height,DrawFrames;
   byte OwnXBuf;
 
@@ -216,6 +216,7 @@ byte Write9918(TMS9918 *VDP,byte R,byte V);
 /** Save9918() ***********************************************/
 /** Save TMS9918 state to a given buffer of given maximal   **/
 /** size. Returns number of bytes saved or 0 on failure.    **/
+/** When Buf=0, returns number of bytes it would save.      **/
 /*************************************************************/
 unsigned int Save9918(const TMS9918 *VDP,byte *Buf,unsigned int Size);
 
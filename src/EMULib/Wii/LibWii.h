@@ -59,6 +59,24 @@ unsigned int InitAudio(unsigned int Rate, unsigned int Delay);
 /*************************************************************/
 void TrashAudio(void);
 
+/** AudioStats ***********************************************/
+/** Audio ring buffer telemetry, see GetAudioStats().       **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Size;      /* Samples buffered at full latency  */
+  unsigned int Fill;      /* Samples buffered right now        */
+  unsigned int MinFill;   /* Lowest fill seen since last call  */
+  unsigned int Underruns; /* Callbacks that ran out of samples */
+  unsigned int Overruns;  /* Writes that had samples dropped   */
+} AudioStats;
+
+/** GetAudioStats() ******************************************/
+/** Fill Stats with the audio ring buffer telemetry. The    **/
+/** MinFill value is restarted on every call.               **/
+/*************************************************************/
+void GetAudioStats(AudioStats *Stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -48,32 +48,92 @@
 
 #include "SDL.h"
 
-static int SndRate = 0;              /* Audio sampling rate          */
-static int SndSize = 0;              /* SndData[] size               */
-static sample* SndData = 0;          /* Audio buffers                */
-static int RPtr = 0;                 /* Read pointer into Bufs       */
-static int WPtr = 0;                 /* Write pointer into Bufs      */
-static volatile int AudioPaused = 0; /* 1: Audio paused      */
+/** Ring Buffer Access ***************************************/
+/** AudioHandler() runs on the SDL audio thread and is the  **/
+/** only reader of SndData[], WriteAudio() is its only      **/
+/** writer. RCount and WCount are free-running sample       **/
+/** counters, each stored by one side only. Acquire/release **/
+/** ordering makes samples visible before the counter that  **/
+/** covers them is.                                         **/
+/*************************************************************/
+#define LoadCount(C)    __atomic_load_n(&(C),__ATOMIC_ACQUIRE)
+#define StoreCount(C,V) __atomic_store_n(&(C),(V),__ATOMIC_RELEASE)
+
+static int SndRate = 0;               /* Audio sampling rate          */
+static unsigned int SndSize = 0;      /* Samples buffered at latency  */
+static unsigned int SndMask = 0;      /* SndData[] size-1, size=2^N   */
+static sample* SndData = 0;           /* Audio ring buffer            */
+static unsigned int RCount = 0;       /* Samples read by AudioHandler */
+static unsigned int WCount = 0;       /* Samples written to SndData[] */
+static Uint32 SndLast = 0;            /* Last stereo frame played     */
+static unsigned int MinFill = 0;      /* Lowest fill seen by handler  */
+static unsigned int Underruns = 0;    /* Handler calls short of data  */
+static unsigned int Overruns = 0;     /* Samples dropped on write     */
+static volatile int AudioPaused = 0;  /* 1: Audio paused              */
+
+/** ClearAudio() *********************************************/
+/** Empty the ring and queue SndSize samples of silence, so **/
+/** that playback starts with a full latency worth of data. **/
+/** Must not race with AudioHandler().                      **/
+/*************************************************************/
+static void ClearAudio(void) {
+    if (SndData)
+        memset(SndData, 0, (SndMask + 1) * sizeof(sample));
+    RCount = 0;
+    WCount = SndSize;
+    __atomic_store_n(&MinFill, SndSize, __ATOMIC_RELAXED);
+    SndLast = 0;
+}
 
 /** AudioHandler() *******************************************/
 /** Callback invoked by SDL to play audio.                  **/
 /*************************************************************/
 void AudioHandler(void* UserData, Uint8* StreamIn, int Length) {
-    int J;
-    sample* Stream = (sample*)StreamIn;
+    Uint32* Stream = (Uint32*)StreamIn;
+    unsigned int R, N, Fill, J, K, I;
+    const sample* Src;
 
     /* Need to have valid playback rate */
     if (!SndRate)
         return;
 
-    /* Recompute length in samples */
-    Length /= sizeof(sample);
+    /* Recompute length in stereo frames */
+    Length /= 2 * sizeof(sample);
+    if (Length <= 0)
+        return;
 
-    /* Copy audio data */
-    for (J = 0; J < Length; J += 2) {
-        Stream[J] = SndData[RPtr];
-        Stream[J + 1] = SndData[RPtr];
-        RPtr = RPtr < SndSize - 1 ? RPtr + 1 : 0;
+    /* See how much the writer has committed */
+    R = RCount;
+    Fill = LoadCount(WCount) - R;
+
+    /* Lower MinFill, unless GetAudioStats() restarts it first */
+    J = __atomic_load_n(&MinFill, __ATOMIC_RELAXED);
+    while ((Fill < J) &&
+           !__atomic_compare_exchange_n(&MinFill, &J, Fill, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    N = Fill < (unsigned int)Length ? Fill : Length;
+
+    /* Copy audio data in at most two contiguous runs, */
+    /* writing each mono sample to both channels at once */
+    for (J = 0; J < N; J += K) {
+        Src = SndData + ((R + J) & SndMask);
+        K = SndMask + 1 - ((R + J) & SndMask);
+        if (K > N - J)
+            K = N - J;
+        for (I = 0; I < K; ++I)
+            *Stream++ = (Uint16)Src[I] * 0x00010001u;
+    }
+
+    /* Hand consumed space back to the writer */
+    StoreCount(RCount, R + N);
+
+    /* On underrun, hold the last level instead of clicking */
+    if (N) SndLast = Stream[-1];
+    if (N < (unsigned int)Length) {
+        ++Underruns;
+        for (J = N; J < (unsigned int)Length; ++J)
+            *Stream++ = SndLast;
     }
 }
 
@@ -83,35 +143,41 @@ void AudioHandler(void* UserData, Uint8* StreamIn, int Length) {
 /*************************************************************/
 unsigned int InitAudio(unsigned int Rate, unsigned int Latency) {
     SDL_AudioSpec AudioFormat;
-    int J;
+    unsigned int J;
 
     /* Shut down audio, just to be sure */
     TrashAudio();
     SndRate = 0;
     SndSize = 0;
+    SndMask = 0;
     SndData = 0;
-    RPtr = 0;
-    WPtr = 0;
+    Underruns = 0;
+    Overruns = 0;
     AudioPaused = 0;
 
     /* Have to have at least 8kHz sampling rate and 1ms buffer */
     if ((Rate < 8000) || !Latency)
         return (0);
 
-    /* Compute number of sound buffers */
+    /* Compute number of buffered samples, ring size is 2^N */
     SndSize = Rate * Latency / 1000;
+    for (J = 1; J < SndSize; J <<= 1)
+        ;
+    SndMask = J - 1;
 
     /* Allocate audio buffers */
-    SndData = (sample*)malloc(SndSize * sizeof(sample));
+    SndData = (sample*)malloc((SndMask + 1) * sizeof(sample));
 
     if (!SndData)
         return (0);
 
-    /* Set SDL audio settings */
+    /* Set SDL audio settings, device period ~1/4 of latency */
+    for (J = 64; (J << 1) <= (SndSize >> 2); J <<= 1)
+        ;
     AudioFormat.freq = Rate;
     AudioFormat.format = AUDIO_S16MSB;
     AudioFormat.channels = 2;
-    AudioFormat.samples = SndSize << 1;
+    AudioFormat.samples = J;
     AudioFormat.callback = AudioHandler;
     AudioFormat.userdata = 0;
 
@@ -123,8 +189,7 @@ unsigned int InitAudio(unsigned int Rate, unsigned int Latency) {
     }
 
     /* Clear audio buffers */
-    for (J = 0; J < SndSize; ++J)
-        SndData[J] = 0;
+    ClearAudio();
 
     /* Callback expects valid SndRate!=0 at the start */
     SndRate = Rate;
@@ -154,8 +219,9 @@ void TrashAudio(void) {
     /* Sound trashed */
     SndData = 0;
     SndSize = 0;
-    RPtr = 0;
-    WPtr = 0;
+    SndMask = 0;
+    RCount = 0;
+    WCount = 0;
 }
 
 /** PauseAudio() *********************************************/
@@ -182,7 +248,14 @@ int PauseAudio(int Switch) {
 /** Get the amount of free samples in the audio buffer.     **/
 /*************************************************************/
 unsigned int GetFreeAudio(void) {
-    return (!SndRate ? 0 : RPtr >= WPtr ? RPtr - WPtr : RPtr - WPtr + SndSize);
+    unsigned int Fill;
+
+    if (!SndRate)
+        return (0);
+
+    /* May be called from a thread other than the writer's */
+    Fill = LoadCount(WCount) - LoadCount(RCount);
+    return (Fill < SndSize ? SndSize - Fill : 0);
 }
 
 /** WriteAudio() *********************************************/
@@ -190,33 +263,53 @@ unsigned int GetFreeAudio(void) {
 /** Returns the number of samples written.                  **/
 /*************************************************************/
 unsigned int WriteAudio(sample* Data, unsigned int Length) {
-    unsigned int J;
+    unsigned int W, Free, J, K;
 
     /* Require audio to be initialized */
     if (!SndRate)
         return (0);
 
-    /* Copy audio samples */
-    for (J = 0; (J < Length) && (RPtr != WPtr); ++J) {
-        SndData[WPtr++] = Data[J];
-        if (WPtr >= SndSize)
-            WPtr = 0;
+    /* Only write as much as the reader has freed */
+    W = WCount;
+    Free = W - LoadCount(RCount);
+    Free = Free < SndSize ? SndSize - Free : 0;
+    if (Length > Free) {
+        ++Overruns;
+        Length = Free;
     }
 
+    /* Copy audio samples in at most two contiguous runs */
+    for (J = 0; J < Length; J += K) {
+        K = SndMask + 1 - ((W + J) & SndMask);
+        if (K > Length - J)
+            K = Length - J;
+        memcpy(SndData + ((W + J) & SndMask), Data + J, K * sizeof(sample));
+    }
+
+    /* Publish the new samples to the reader */
+    StoreCount(WCount, W + Length);
+
     /* Return number of samples copied */
-    return (J);
+    return (Length);
 }
 
 /** ResetAudio() *********************************************/
 /** Resets the audio buffers.                               **/
 /*************************************************************/
 void ResetAudio() {
-    unsigned int J;
-    RPtr = 0;
-    WPtr = 0;
-    if (SndData) {
-        /* Clear audio buffers */
-        for (J = 0; J < SndSize; ++J)
-            SndData[J] = 0;
-    }
+    SDL_LockAudio();
+    ClearAudio();
+    SDL_UnlockAudio();
+}
+
+/** GetAudioStats() ******************************************/
+/** Fill Stats with the ring buffer telemetry. MinFill is   **/
+/** restarted on every call.                                **/
+/*************************************************************/
+void GetAudioStats(AudioStats* Stats) {
+    Stats->Size = SndSize;
+    Stats->Fill = SndRate ? WCount - LoadCount(RCount) : 0;
+    Stats->MinFill = __atomic_exchange_n(&MinFill, SndSize, __ATOMIC_RELAXED);
+    Stats->Underruns = Underruns;
+    Stats->Overruns = Overruns;
 }
@@ -0,0 +1,142 @@
+/** Z80: portable Z80 emulator *******************************/
+/**                                                         **/
+/**                        BreakZ80.c                       **/
+/**                                                         **/
+/** This file contains breakpoints and watchpoints. Each    **/
+/** address space has a map keeping breakpoint types per    **/
+/** address, summarized per page in BrkPages[] that callers **/
+/** check first via BreakZ80(). A page summary is rebuilt   **/
+/** from the map whenever a breakpoint is cleared.          **/
+/**                                                         **/
+/*************************************************************/
+#ifdef DEBUG
+
+#include "BreakZ80.h"
+
+#include <string.h>
+
+byte BrkPages[BRK_SPACES][BRK_PAGES]; /* Types set per page   */
+
+static byte MapMEM[0x10000];         /* Types set per address    */
+static byte MapIO[0x100];
+static byte MapVRAM[0x4000];
+
+static byte *Maps[BRK_SPACES] = { MapMEM,MapIO,MapVRAM };
+static const unsigned int Sizes[BRK_SPACES] =
+{ sizeof(MapMEM),sizeof(MapIO),sizeof(MapVRAM) };
+
+static int Muted    = 0;             /* 1: Do not report hits    */
+static byte HitType = 0;             /* Last hit type, or 0      */
+static int HitSpace = 0;             /* Last hit space           */
+static word HitAddr = 0;             /* Last hit address         */
+
+/** HitBreakZ80() ********************************************/
+/** Check breakpoint map for access of type T to address A  **/
+/** of space S. Returns 1 and remembers the hit for         **/
+/** LastBreakZ80() if there is a breakpoint, 0 otherwise.   **/
+/*************************************************************/
+int HitBreakZ80(int S,word A,byte T)
+{
+  if(Muted||(A>=Sizes[S])||!(Maps[S][A]&T)) return(0);
+  HitType  = Maps[S][A]&T;
+  HitSpace = S;
+  HitAddr  = A;
+  return(1);
+}
+
+/** SetBreakZ80() ********************************************/
+/** Set breakpoints of types T at address A of space S,     **/
+/** keeping types already set there. Returns 1 on success,  **/
+/** 0 if A is out of space S.                               **/
+/*************************************************************/
+int SetBreakZ80(int S,word A,byte T)
+{
+  if((S<0)||(S>=BRK_SPACES)||(A>=Sizes[S])) return(0);
+  Maps[S][A]               |= T&BRK_ANY;
+  BrkPages[S][A>>BRK_SHIFT]|= T&BRK_ANY;
+  return(1);
+}
+
+/** ClrBreakZ80() ********************************************/
+/** Clear breakpoints of types T at address A of space S.   **/
+/*************************************************************/
+void ClrBreakZ80(int S,word A,byte T)
+{
+  unsigned int J,N;
+  byte *P,V;
+
+  if((S<0)||(S>=BRK_SPACES)||(A>=Sizes[S])) return;
+  Maps[S][A]&=~T;
+
+  /* Rebuild page summary */
+  J = A&~((1<<BRK_SHIFT)-1);
+  N = Sizes[S]-J<(1<<BRK_SHIFT)? Sizes[S]-J:(1<<BRK_SHIFT);
+  for(P=Maps[S]+J,V=0;N;--N) V|=*P++;
+  BrkPages[S][A>>BRK_SHIFT]=V;
+}
+
+/** GetBreakZ80() ********************************************/
+/** Return breakpoint types set at address A of space S.    **/
+/*************************************************************/
+byte GetBreakZ80(int S,word A)
+{
+  return((S>=0)&&(S<BRK_SPACES)&&(A<Sizes[S])? Maps[S][A]:0);
+}
+
+/** ResetBreakZ80() ******************************************/
+/** Clear all breakpoints in all spaces.                    **/
+/*************************************************************/
+void ResetBreakZ80(void)
+{
+  int J;
+
+  for(J=0;J<BRK_SPACES;++J) memset(Maps[J],0,Sizes[J]);
+  memset(BrkPages,0,sizeof(BrkPages));
+  HitType = 0;
+}
+
+/** NextBreakZ80() *******************************************/
+/** Return the first address at or after A in space S that  **/
+/** has breakpoints, or -1 if there are none. Use it to     **/
+/** list breakpoints.                                       **/
+/*************************************************************/
+int NextBreakZ80(int S,int A)
+{
+  if((S<0)||(S>=BRK_SPACES)) return(-1);
+
+  for(A=A<0? 0:A;A<Sizes[S];)
+    if(!BrkPages[S][A>>BRK_SHIFT]) A=(A|((1<<BRK_SHIFT)-1))+1;
+    else if(Maps[S][A]) return(A);
+    else ++A;
+
+  return(-1);
+}
+
+/** MuteBreakZ80() *******************************************/
+/** Stop (Switch=1) or resume (Switch=0) reporting hits, so **/
+/** that the debugger can read memory without hitting its   **/
+/** own watchpoints. Returns previous state.                **/
+/*************************************************************/
+int MuteBreakZ80(int Switch)
+{
+  int J = Muted;
+  Muted = Switch;
+  return(J);
+}
+
+/** LastBreakZ80() *******************************************/
+/** Return type of the last breakpoint hit, with its space  **/
+/** in *S and address in *A, and forget it. Returns 0 if    **/
+/** there were no hits since the last call.                 **/
+/*************************************************************/
+byte LastBreakZ80(int *S,word *A)
+{
+  byte J = HitType;
+
+  if(S) *S=HitSpace;
+  if(A) *A=HitAddr;
+  HitType = 0;
+  return(J);
+}
+
+#endif /* DEBUG */
@@ -0,0 +1,108 @@
+/** Z80: portable Z80 emulator *******************************/
+/**                                                         **/
+/**                        BreakZ80.h                       **/
+/**                                                         **/
+/** This file contains declarations for breakpoints and     **/
+/** watchpoints, compiled in when DEBUG is #defined. Every  **/
+/** address space keeps a map of breakpoints per address    **/
+/** and a summary per 256-byte page, so that accesses to    **/
+/** pages without breakpoints only cost one table lookup.   **/
+/** See BreakZ80.c for the implementation.                  **/
+/**                                                         **/
+/*************************************************************/
+#ifndef BREAKZ80_H
+#define BREAKZ80_H
+
+#include "Z80.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+                               /* Address spaces:            */
+#define BRK_MEM     0          /* Z80 memory, 64kB           */
+#define BRK_IO      1          /* Z80 I/O ports, 256         */
+#define BRK_VRAM    2          /* Video memory, 16kB         */
+#define BRK_SPACES  3
+
+                               /* Breakpoint types:          */
+#define BRK_EXEC    0x01       /* Executing from address     */
+#define BRK_READ    0x02       /* Reading address or port    */
+#define BRK_WRITE   0x04       /* Writing address or port    */
+#define BRK_ANY     0x07
+
+#define BRK_SHIFT   8          /* Page size is 1<<BRK_SHIFT  */
+#define BRK_PAGES   256        /* Pages per address space    */
+
+#ifdef DEBUG
+
+/** BrkPages[] ***********************************************/
+/** Breakpoint types set anywhere on each page. Only read   **/
+/** this table, via BreakZ80().                             **/
+/*************************************************************/
+extern byte BrkPages[BRK_SPACES][BRK_PAGES];
+
+/** BreakZ80() ***********************************************/
+/** Check if access of type T to address A of space S hits  **/
+/** a breakpoint. Only pages with breakpoints of type T get **/
+/** to call HitBreakZ80().                                  **/
+/*************************************************************/
+#define BreakZ80(S,A,T) \
+  ((BrkPages[S][((A)>>BRK_SHIFT)&(BRK_PAGES-1)]&(T))&&HitBreakZ80(S,A,T))
+
+/** HitBreakZ80() ********************************************/
+/** Check breakpoint map for access of type T to address A  **/
+/** of space S. Returns 1 and remembers the hit for         **/
+/** LastBreakZ80() if there is a breakpoint, 0 otherwise.   **/
+/*************************************************************/
+int HitBreakZ80(int S,word A,byte T);
+
+/** SetBreakZ80() ********************************************/
+/** Set breakpoints of types T at address A of space S,     **/
+/** keeping types already set there. Returns 1 on success,  **/
+/** 0 if A is out of space S.                               **/
+/*************************************************************/
+int SetBreakZ80(int S,word A,byte T);
+
+/** ClrBreakZ80() ********************************************/
+/** Clear breakpoints of types T at address A of space S.   **/
+/*************************************************************/
+void ClrBreakZ80(int S,word A,byte T);
+
+/** GetBreakZ80() ********************************************/
+/** Return breakpoint types set at address A of space S.    **/
+/*************************************************************/
+byte GetBreakZ80(int S,word A);
+
+/** ResetBreakZ80() ******************************************/
+/** Clear all breakpoints in all spaces.                    **/
+/*************************************************************/
+void ResetBreakZ80(void);
+
+/** NextBreakZ80() *******************************************/
+/** Return the first address at or after A in space S that  **/
+/** has breakpoints, or -1 if there are none. Use it to     **/
+/** list breakpoints.                                       **/
+/*************************************************************/
+int NextBreakZ80(int S,int A);
+
+/** MuteBreakZ80() *******************************************/
+/** Stop (Switch=1) or resume (Switch=0) reporting hits, so **/
+/** that the debugger can read memory without hitting its   **/
+/** own watchpoints. Returns previous state.                **/
+/*************************************************************/
+int MuteBreakZ80(int Switch);
+
+/** LastBreakZ80() *******************************************/
+/** Return type of the last breakpoint hit, with its space  **/
+/** in *S and address in *A, and forget it. Returns 0 if    **/
+/** there were no hits since the last call.                 **/
+/*************************************************************/
+byte LastBreakZ80(int *S,word *A);
+
+#endif /* DEBUG */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* BREAKZ80_H */
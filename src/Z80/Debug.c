@@ -4,17 +4,22 @@
 /**                                                         **/
 /** This file contains the built-in debugging routine for   **/
 /** the Z80 emulator which is called on each Z80 step when  **/
-/** Trap!=0.                                                **/
+/** Trap!=0. DAsm() is also used by the guest profiler      **/
+/** and the trace decoder.                                  **/
 /**                                                         **/
 /** Copyright (C) Marat Fayzullin 1995-2019                 **/
 /**     You are not allowed to distribute this software     **/
 /**     commercially. Please, notify me, if you make any    **/
 /**     changes to this file.                               **/
 /*************************************************************/
-#ifdef DEBUG
+#if defined(DEBUG) || defined(PROFZ80) || defined(TRACEZ80)
 
 #include "Z80.h"
 
+#ifdef DEBUG
+#include "BreakZ80.h"
+#endif
+
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
@@ -241,7 +246,7 @@ static const char *MnemonicsXCB[256] =
 /** the output text into S. It will return the number of    **/
 /** bytes disassembled.                                     **/
 /*************************************************************/
-static int DAsm(char *S,word A)
+int DAsm(char *S,word A)
 {
   char R[128],H[10],C,*P;
   const char *T;
@@ -306,16 +311,69 @@ static int DAsm(char *S,word A)
   return(B-A);
 }
 
-/** DebugZ80() ***********************************************/
-/** This function should exist if DEBUG is #defined. When   **/
-/** Trace!=0, it is called after each command executed by   **/
-/** the CPU, and given the Z80 registers.                   **/
+#ifdef DEBUG
+static const char *SpaceNames[BRK_SPACES] = { "memory","port","VRAM" };
+
+/** ToggleBreak() ********************************************/
+/** Toggle breakpoints of types T in space Sp at address    **/
+/** given in string S.                                      **/
 /*************************************************************/
-byte DebugZ80(Z80 *R)
+static void ToggleBreak(const char *S,int Sp,byte T)
+{
+  word A;
+
+  if(sscanf(S,"%hX",&A)!=1) { puts("Address missing");return; }
+
+  if(GetBreakZ80(Sp,A)&T)
+  { ClrBreakZ80(Sp,A,T);printf("Cleared %s %04Xh\n",SpaceNames[Sp],A); }
+  else if(SetBreakZ80(Sp,A,T))
+    printf("Set %s %04Xh\n",SpaceNames[Sp],A);
+  else
+    printf("No %s %04Xh\n",SpaceNames[Sp],A);
+}
+
+/** ListBreaks() *********************************************/
+/** Print out all breakpoints.                              **/
+/*************************************************************/
+static void ListBreaks(void)
+{
+  int Sp,A,N;
+  byte T;
+
+  for(Sp=N=0;Sp<BRK_SPACES;++Sp)
+    for(A=NextBreakZ80(Sp,0);A>=0;A=NextBreakZ80(Sp,A+1),++N)
+    {
+      T=GetBreakZ80(Sp,A);
+      printf
+      (
+        "%-6s %04X: %c%c%c\n",SpaceNames[Sp],A,
+        T&BRK_READ? 'r':'-',T&BRK_WRITE? 'w':'-',T&BRK_EXEC? 'x':'-'
+      );
+    }
+
+  if(!N) puts("No breakpoints");
+}
+
+/** Debugger() ***********************************************/
+/** DebugZ80() calls this with breakpoint hits muted, so    **/
+/** that looking at memory does not trigger them.           **/
+/*************************************************************/
+static byte Debugger(Z80 *R)
 {
   static const char Flags[9] = "SZ.H.PNC";
   char S[128],T[10];
   byte J,I;
+  word A;
+  int Sp;
+
+  J=LastBreakZ80(&Sp,&A);
+  if(J)
+    printf
+    (
+      "Breakpoint: %s %s %04Xh\n",
+      J&BRK_EXEC? "executing":J&BRK_WRITE? "writing":"reading",
+      SpaceNames[Sp],A
+    );
 
   DAsm(S,R->PC.W);
   for(J=0,I=R->AF.B.l;J<8;J++,I<<=1) T[J]=I&0x80? Flags[J]:'.';
@@ -357,6 +415,13 @@ byte DebugZ80(Z80 *R)
         puts("j <addr>   : Continue from addr");
         puts("m <addr>   : Memory dump at addr");
         puts("d <addr>   : Disassembly at addr");
+        puts("b <addr>   : Toggle break executing addr");
+        puts("r <addr>   : Toggle break reading addr");
+        puts("w <addr>   : Toggle break writing addr");
+        puts("p <port>   : Toggle break on IN/OUT port");
+        puts("v <addr>   : Toggle break accessing VRAM addr");
+        puts("l          : List breakpoints");
+        puts("x          : Clear all breakpoints");
         puts("?,h        : Show this help text");
         puts("q          : Exit Z80 emulation");
         break;
@@ -378,6 +443,14 @@ byte DebugZ80(Z80 *R)
       case 'C':  R->Trap=0xFFFF;R->Trace=0;return(1);
       case 'Q':  return(0);
 
+      case 'B':  ToggleBreak(S+1,BRK_MEM,BRK_EXEC);break;
+      case 'R':  ToggleBreak(S+1,BRK_MEM,BRK_READ);break;
+      case 'W':  ToggleBreak(S+1,BRK_MEM,BRK_WRITE);break;
+      case 'P':  ToggleBreak(S+1,BRK_IO,BRK_READ|BRK_WRITE);break;
+      case 'V':  ToggleBreak(S+1,BRK_VRAM,BRK_READ|BRK_WRITE);break;
+      case 'L':  ListBreaks();break;
+      case 'X':  ResetBreakZ80();puts("Cleared all breakpoints");break;
+
       case 'M':
         {
           word Addr;
@@ -430,4 +503,20 @@ byte DebugZ80(Z80 *R)
   return(1);
 }
 
+/** DebugZ80() ***********************************************/
+/** This function should exist if DEBUG is #defined. When   **/
+/** Trace!=0, it is called after each command executed by   **/
+/** the CPU, and given the Z80 registers. Breakpoints set   **/
+/** Trace when hit, see BreakZ80.h.                         **/
+/*************************************************************/
+byte DebugZ80(Z80 *R)
+{
+  int Muted = MuteBreakZ80(1);
+  byte J    = Debugger(R);
+
+  MuteBreakZ80(Muted);
+  return(J);
+}
 #endif /* DEBUG */
+
+#endif /* DEBUG || PROFZ80 || TRACEZ80 */
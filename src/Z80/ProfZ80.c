@@ -0,0 +1,480 @@
+/** Z80: portable Z80 emulator *******************************/
+/**                                                         **/
+/**                        ProfZ80.c                        **/
+/**                                                         **/
+/** This file contains the guest code profiler. Cycles are  **/
+/** counted per ROM bank and PC in a hash table. CALLs,     **/
+/** RSTs, and interrupts push frames on a shadow stack that **/
+/** RETs unwind by SP, so that code dropping its return     **/
+/** address does not throw the stack off for good.          **/
+/**                                                         **/
+/*************************************************************/
+#ifdef PROFZ80
+
+#include "ProfZ80.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY(Bank,A)  (((unsigned int)(Bank)<<16)|(A))
+#define EMPTY        0xFFFFFFFF      /* Free hash table slot     */
+#define INITSIZE     4096            /* Initial hash table size  */
+
+#define OP_CALL      1               /* CALL, CALL cc, RST       */
+#define OP_RET       2               /* RET, RET cc, RETI, RETN  */
+
+/** Profiling Data *******************************************/
+/** PCEntry keeps cycles spent by one instruction and, when **/
+/** it starts a function, cycles spent by the function with **/
+/** all functions it called. CallEntry keeps calls from one **/
+/** site to one function.                                   **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Key;                  /* Bank<<16|PC, or EMPTY    */
+  unsigned int Count;                /* Times executed           */
+  unsigned long long Cycles;         /* Cycles spent             */
+  unsigned int Calls;                /* Times called             */
+  unsigned long long Incl;           /* Cycles spent with calls  */
+} PCEntry;
+
+typedef struct
+{
+  unsigned int Site;                 /* Bank<<16|PC of the call  */
+  unsigned int Callee;               /* Bank<<16|PC of function  */
+  unsigned int Count;                /* Times called             */
+  unsigned long long Incl;           /* Cycles spent with calls  */
+} CallEntry;
+
+typedef struct
+{
+  unsigned int Site;                 /* Bank<<16|PC of the call  */
+  unsigned int Callee;               /* Bank<<16|PC of function  */
+  word SP;                           /* SP after the call        */
+  unsigned long long Start;          /* Total when last counted  */
+} FrameEntry;
+
+static PCEntry *PCs          = 0;    /* PC hash table            */
+static unsigned int PCSize   = 0;    /* PCs[] size (power of 2)  */
+static unsigned int PCCount  = 0;    /* Used PCs[] entries       */
+static CallEntry *Calls      = 0;    /* Call hash table          */
+static unsigned int CallSize = 0;    /* Calls[] size (power of 2)*/
+static unsigned int CallCount= 0;    /* Used Calls[] entries     */
+
+static FrameEntry Stack[PROFZ80_DEPTH]; /* Shadow stack          */
+static unsigned int Depth    = 0;    /* Frames in Stack[]        */
+
+static unsigned long long Total = 0; /* Cycles counted           */
+static unsigned long long Instrs = 0;/* Instructions counted     */
+static unsigned int Lost     = 0;    /* Steps/calls not recorded */
+static int Paused            = 0;    /* 1: Not counting          */
+static byte OpKind[256];             /* OP_CALL/OP_RET/0         */
+
+/** Hash() ***************************************************/
+/** Scramble a key for hash table lookups.                  **/
+/*************************************************************/
+static unsigned int Hash(unsigned int K)
+{
+  K *= 0x9E3779B1;
+  return(K^(K>>15));
+}
+
+/** GetPC() **************************************************/
+/** Find or add PCs[] entry for a given key, growing PCs[]  **/
+/** when half full. Returns 0 when out of memory.           **/
+/*************************************************************/
+static PCEntry *GetPC(unsigned int Key)
+{
+  PCEntry *Old,*P;
+  unsigned int J,N,Size;
+
+  if(PCCount*2>=PCSize)
+  {
+    Size = PCSize? PCSize*2:INITSIZE;
+    P    = malloc(Size*sizeof(PCEntry));
+    if(!P) return(0);
+    for(J=0;J<Size;++J) P[J].Key=EMPTY;
+    Old=PCs;N=PCSize;PCs=P;PCSize=Size;
+    for(J=0;J<N;++J)
+      if(Old[J].Key!=EMPTY)
+      {
+        for(P=PCs+(Hash(Old[J].Key)&(Size-1));P->Key!=EMPTY;)
+          P = P+1<PCs+Size? P+1:PCs;
+        *P=Old[J];
+      }
+    free(Old);
+  }
+
+  for(J=Hash(Key)&(PCSize-1);PCs[J].Key!=Key;J=(J+1)&(PCSize-1))
+    if(PCs[J].Key==EMPTY)
+    {
+      memset(&PCs[J],0,sizeof(PCEntry));
+      PCs[J].Key=Key;
+      ++PCCount;
+      break;
+    }
+
+  return(&PCs[J]);
+}
+
+/** GetCall() ************************************************/
+/** Find or add Calls[] entry for a given site and callee,  **/
+/** growing Calls[] when half full. Returns 0 when out of   **/
+/** memory.                                                 **/
+/*************************************************************/
+static CallEntry *GetCall(unsigned int Site,unsigned int Callee)
+{
+  CallEntry *Old,*P;
+  unsigned int J,N,Size;
+
+  if(CallCount*2>=CallSize)
+  {
+    Size = CallSize? CallSize*2:INITSIZE;
+    P    = malloc(Size*sizeof(CallEntry));
+    if(!P) return(0);
+    for(J=0;J<Size;++J) P[J].Site=EMPTY;
+    Old=Calls;N=CallSize;Calls=P;CallSize=Size;
+    for(J=0;J<N;++J)
+      if(Old[J].Site!=EMPTY)
+      {
+        P=Calls+(Hash(Old[J].Site^Hash(Old[J].Callee))&(Size-1));
+        while(P->Site!=EMPTY) P = P+1<Calls+Size? P+1:Calls;
+        *P=Old[J];
+      }
+    free(Old);
+  }
+
+  J=Hash(Site^Hash(Callee))&(CallSize-1);
+  for(;(Calls[J].Site!=Site)||(Calls[J].Callee!=Callee);J=(J+1)&(CallSize-1))
+    if(Calls[J].Site==EMPTY)
+    {
+      memset(&Calls[J],0,sizeof(CallEntry));
+      Calls[J].Site   = Site;
+      Calls[J].Callee = Callee;
+      ++CallCount;
+      break;
+    }
+
+  return(&Calls[J]);
+}
+
+/** Count() **************************************************/
+/** Count cycles spent in a frame since it was last counted **/
+/** towards its function and call site.                     **/
+/*************************************************************/
+static void Count(FrameEntry *F)
+{
+  PCEntry *P;
+  CallEntry *C;
+
+  if((P=GetPC(F->Callee))) P->Incl+=Total-F->Start;
+  if((C=GetCall(F->Site,F->Callee))) C->Incl+=Total-F->Start;
+  F->Start = Total;
+}
+
+/** Call() ***************************************************/
+/** Push a frame for a call from Site to PC, leaving SP at  **/
+/** a given value. Frames at or below SP are dead, as their **/
+/** return addresses have been overwritten.                 **/
+/*************************************************************/
+static void Call(unsigned int Site,word PC,word SP)
+{
+  unsigned int Callee;
+  PCEntry *P;
+  CallEntry *C;
+
+  while(Depth&&(Stack[Depth-1].SP<=SP)) Count(&Stack[--Depth]);
+
+  Callee = KEY(BankZ80(PC),PC);
+  if((P=GetPC(Callee))) ++P->Calls;
+  if((C=GetCall(Site,Callee))) ++C->Count;
+
+  if(Depth>=PROFZ80_DEPTH) { ++Lost;return; }
+  Stack[Depth].Site   = Site;
+  Stack[Depth].Callee = Callee;
+  Stack[Depth].SP     = SP;
+  Stack[Depth].Start  = Total;
+  ++Depth;
+}
+
+/** ProfZ80Reset() *******************************************/
+/** Drop all data collected so far, e.g. when a new ROM is  **/
+/** loaded.                                                 **/
+/*************************************************************/
+void ProfZ80Reset(void)
+{
+  ProfZ80Trash();
+  Depth  = 0;
+  Total  = 0;
+  Instrs = 0;
+  Lost   = 0;
+}
+
+/** ProfZ80Trash() *******************************************/
+/** Free all memory taken by the profiler.                  **/
+/*************************************************************/
+void ProfZ80Trash(void)
+{
+  if(PCs)   { free(PCs);PCs=0; }
+  if(Calls) { free(Calls);Calls=0; }
+  PCSize=PCCount=CallSize=CallCount=0;
+}
+
+/** ProfZ80Pause() *******************************************/
+/** Stop (Switch=1) or resume (Switch=0) counting, e.g. for **/
+/** run-ahead frames that get rolled back. Returns previous **/
+/** state.                                                  **/
+/*************************************************************/
+int ProfZ80Pause(int Switch)
+{
+  int J = Paused;
+  Paused = Switch;
+  return(J);
+}
+
+/** ProfZ80Step() ********************************************/
+/** RunZ80() calls this after each instruction, given the   **/
+/** PC, SP, and opcode it started with and cycles it took.  **/
+/*************************************************************/
+void ProfZ80Step(Z80 *R,word PC,word SP,byte Op,int Cycles)
+{
+  unsigned int Key,J;
+  PCEntry *P;
+
+  if(Paused) return;
+
+  /* Classify opcodes on the first call */
+  if(!OpKind[0xCD])
+  {
+    for(J=0xC0;J<=0xF8;J+=8)
+    {
+      OpKind[J]   = OP_RET;          /* RET cc                   */
+      OpKind[J+4] = OP_CALL;         /* CALL cc,nn               */
+      OpKind[J+7] = OP_CALL;         /* RST n                    */
+    }
+    OpKind[0xC9] = OP_RET;           /* RET                      */
+    OpKind[0xCD] = OP_CALL;          /* CALL nn                  */
+    OpKind[0xED] = OP_RET;           /* RETI, RETN               */
+  }
+
+  Key = KEY(BankZ80(PC),PC);
+  if((P=GetPC(Key))) { ++P->Count;P->Cycles+=Cycles; }
+  else ++Lost;
+  Total += Cycles;
+  ++Instrs;
+
+  /* Only taken calls and returns move SP by a word */
+  switch(OpKind[Op])
+  {
+    case OP_CALL:
+      if(R->SP.W==(word)(SP-2)) Call(Key,R->PC.W,R->SP.W);
+      break;
+    case OP_RET:
+      if(R->SP.W==(word)(SP+2))
+        while(Depth&&(Stack[Depth-1].SP<R->SP.W)) Count(&Stack[--Depth]);
+      break;
+  }
+}
+
+/** ProfZ80Int() *********************************************/
+/** RunZ80() calls this after IntZ80(), given the PC and SP **/
+/** before the interrupt.                                   **/
+/*************************************************************/
+void ProfZ80Int(Z80 *R,word PC,word SP)
+{
+  if(!Paused&&(R->SP.W==(word)(SP-2)))
+    Call(KEY(BankZ80(PC),PC),R->PC.W,R->SP.W);
+}
+
+/** Sorting **************************************************/
+/** Comparison functions for qsort().                       **/
+/*************************************************************/
+static int ByKey(const void *A,const void *B)
+{
+  unsigned int KA = (*(const PCEntry **)A)->Key;
+  unsigned int KB = (*(const PCEntry **)B)->Key;
+  return(KA<KB? -1:KA>KB? 1:0);
+}
+
+static int BySite(const void *A,const void *B)
+{
+  unsigned int KA = (*(const CallEntry **)A)->Site;
+  unsigned int KB = (*(const CallEntry **)B)->Site;
+  return(KA<KB? -1:KA>KB? 1:0);
+}
+
+static int ByCycles(const void *A,const void *B)
+{
+  unsigned long long CA = (*(const PCEntry **)A)->Cycles;
+  unsigned long long CB = (*(const PCEntry **)B)->Cycles;
+  return(CA>CB? -1:CA<CB? 1:0);
+}
+
+static int ByIncl(const void *A,const void *B)
+{
+  unsigned long long CA = (*(const PCEntry **)A)->Incl;
+  unsigned long long CB = (*(const PCEntry **)B)->Incl;
+  return(CA>CB? -1:CA<CB? 1:0);
+}
+
+/** CountOpen() **********************************************/
+/** Count cycles spent so far in frames still open. Called  **/
+/** before any lists of entries are made, as it may grow    **/
+/** the hash tables.                                        **/
+/*************************************************************/
+static void CountOpen(void)
+{
+  unsigned int J;
+  for(J=0;J<Depth;++J) Count(&Stack[J]);
+}
+
+/** Sorted() *************************************************/
+/** Return a list of PCs[] entries (all, or only functions) **/
+/** sorted by a given function. Returns 0 when out of       **/
+/** memory.                                                 **/
+/*************************************************************/
+static PCEntry **Sorted(unsigned int *N,int Functions,int (*Cmp)(const void *,const void *))
+{
+  PCEntry **L;
+  unsigned int J;
+
+  L = malloc((PCCount+1)*sizeof(PCEntry *));
+  if(!L) return(0);
+  for(J=*N=0;J<PCSize;++J)
+    if((PCs[J].Key!=EMPTY)&&(!Functions||PCs[J].Calls)) L[(*N)++]=&PCs[J];
+  qsort(L,*N,sizeof(PCEntry *),Cmp);
+  return(L);
+}
+
+/** FuncOf() *************************************************/
+/** Find the function containing a given key: the nearest   **/
+/** called address at or below it in the same 8kB page,     **/
+/** or the start of the page (e.g. code jumped to on        **/
+/** reset).                                                 **/
+/*************************************************************/
+static unsigned int FuncOf(PCEntry **F,unsigned int N,unsigned int Key)
+{
+  unsigned int L,H,M;
+
+  for(L=0,H=N;L<H;)
+  {
+    M=(L+H)/2;
+    if(F[M]->Key<=Key) L=M+1; else H=M;
+  }
+
+  return(L&&((F[L-1]->Key>>13)==(Key>>13))? F[L-1]->Key:Key&0xFFFFE000);
+}
+
+/** Name() ***************************************************/
+/** Print a key as [bank:]address.                          **/
+/*************************************************************/
+static const char *Name(char *S,unsigned int Key)
+{
+  if(Key>>16) sprintf(S,"%02X:%04X",Key>>16,Key&0xFFFF);
+  else sprintf(S,"%04X",Key);
+  return(S);
+}
+
+/** ProfZ80Save() ********************************************/
+/** Save collected data to a callgrind format file, with    **/
+/** ROM bank and PC as instruction positions. Calls still   **/
+/** open are counted up to now. Returns 1 on success, 0 on  **/
+/** failure.                                                **/
+/*************************************************************/
+int ProfZ80Save(const char *FileName)
+{
+  PCEntry **L,**F;
+  CallEntry **C;
+  unsigned int J,N,NF,NC,Fn,Cur;
+  char S[16];
+  FILE *Out;
+  int Result;
+
+  CountOpen();
+  L = Sorted(&N,0,ByKey);
+  F = Sorted(&NF,1,ByKey);
+  C = malloc((CallCount+1)*sizeof(CallEntry *));
+  Out = L&&F&&C? fopen(FileName,"wb"):0;
+  if(!Out) { free(L);free(F);free(C);return(0); }
+
+  for(J=NC=0;J<CallSize;++J)
+    if(Calls[J].Site!=EMPTY) C[NC++]=&Calls[J];
+  qsort(C,NC,sizeof(CallEntry *),BySite);
+
+  fprintf(Out,"version: 1\ncreator: ColEm guest profiler\n");
+  fprintf(Out,"positions: instr\nevents: Cycles Instructions\n");
+  fprintf(Out,"summary: %llu %llu\n",Total,Instrs);
+
+  /* Cycles spent by each instruction */
+  for(J=0,Cur=EMPTY;J<N;++J)
+  {
+    Fn = FuncOf(F,NF,L[J]->Key);
+    if(Fn!=Cur) { fprintf(Out,"\nfn=%s\n",Name(S,Fn));Cur=Fn; }
+    fprintf(Out,"0x%X %llu %u\n",L[J]->Key,L[J]->Cycles,L[J]->Count);
+  }
+
+  /* Cycles spent in functions called by each instruction */
+  for(J=0,Cur=EMPTY;J<NC;++J)
+  {
+    Fn = FuncOf(F,NF,C[J]->Site);
+    if(Fn!=Cur) { fprintf(Out,"\nfn=%s\n",Name(S,Fn));Cur=Fn; }
+    fprintf(Out,"cfn=%s\n",Name(S,C[J]->Callee));
+    fprintf(Out,"calls=%u 0x%X\n",C[J]->Count,C[J]->Callee);
+    fprintf(Out,"0x%X %llu\n",C[J]->Site,C[J]->Incl);
+  }
+
+  Result = !ferror(Out);
+  if(fclose(Out)) Result=0;
+  free(L);free(F);free(C);
+  return(Result);
+}
+
+/** ProfZ80Report() ******************************************/
+/** Save a text report of the hottest instructions, with    **/
+/** their disassembly, and functions. Returns 1 on success, **/
+/** 0 on failure.                                           **/
+/*************************************************************/
+int ProfZ80Report(const char *FileName)
+{
+  PCEntry **L,**F;
+  unsigned int J,N,NF,A;
+  char S[16],D[128];
+  double T;
+  FILE *Out;
+  int Result;
+
+  CountOpen();
+  L = Sorted(&N,0,ByCycles);
+  F = Sorted(&NF,1,ByIncl);
+  Out = L&&F? fopen(FileName,"wb"):0;
+  if(!Out) { free(L);free(F);return(0); }
+
+  T = Total? (double)Total:1.0;
+  fprintf(Out,"%llu cycles, %llu instructions",Total,Instrs);
+  if(Lost) fprintf(Out,", %u steps or calls not recorded",Lost);
+  fprintf(Out,"\n\nHottest instructions:\n");
+  fprintf(Out,"  %-8s %12s %6s %10s  %s\n","Address","Cycles","%","Count","Code");
+  for(J=0;(J<N)&&(J<PROFZ80_TOP);++J)
+  {
+    /* Only disassemble code that is mapped in right now */
+    A = L[J]->Key&0xFFFF;
+    if((A<PROFZ80_DASMTOP)&&(BankZ80(A)==(L[J]->Key>>16))) DAsm(D,A);
+    else strcpy(D,"?");
+    fprintf(Out,"  %-8s %12llu %5.1f%% %10u  %s\n",Name(S,L[J]->Key),
+      L[J]->Cycles,100.0*L[J]->Cycles/T,L[J]->Count,D);
+  }
+
+  fprintf(Out,"\nHottest functions, with the functions they call:\n");
+  fprintf(Out,"  %-8s %12s %6s %10s\n","Address","Cycles","%","Calls");
+  for(J=0;(J<NF)&&(J<PROFZ80_TOP);++J)
+    fprintf(Out,"  %-8s %12llu %5.1f%% %10u\n",Name(S,F[J]->Key),
+      F[J]->Incl,100.0*F[J]->Incl/T,F[J]->Calls);
+
+  Result = !ferror(Out);
+  if(fclose(Out)) Result=0;
+  free(L);free(F);
+  return(Result);
+}
+
+#endif /* PROFZ80 */
@@ -0,0 +1,80 @@
+/** Z80: portable Z80 emulator *******************************/
+/**                                                         **/
+/**                        ProfZ80.h                        **/
+/**                                                         **/
+/** This file contains declarations for the guest code      **/
+/** profiler, compiled in when PROFZ80 is #defined. It      **/
+/** counts cycles per ROM bank and PC, and follows CALLs,   **/
+/** RSTs, interrupts, and RETs on a shadow stack to count   **/
+/** inclusive cycles per function. See ProfZ80.c for the    **/
+/** implementation.                                         **/
+/**                                                         **/
+/*************************************************************/
+#ifndef PROFZ80_H
+#define PROFZ80_H
+
+#include "Z80.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROFZ80_DEPTH  256     /* Max shadow stack depth     */
+#define PROFZ80_TOP    64      /* Entries in the text report */
+#ifndef PROFZ80_DASMTOP
+#define PROFZ80_DASMTOP 0xFF80 /* Not disassembled from here */
+#endif                         /* on, as reads may page ROM  */
+
+#ifdef PROFZ80
+
+/** ProfZ80Reset() *******************************************/
+/** Drop all data collected so far, e.g. when a new ROM is  **/
+/** loaded.                                                 **/
+/*************************************************************/
+void ProfZ80Reset(void);
+
+/** ProfZ80Trash() *******************************************/
+/** Free all memory taken by the profiler.                  **/
+/*************************************************************/
+void ProfZ80Trash(void);
+
+/** ProfZ80Pause() *******************************************/
+/** Stop (Switch=1) or resume (Switch=0) counting, e.g. for **/
+/** run-ahead frames that get rolled back. Returns previous **/
+/** state.                                                  **/
+/*************************************************************/
+int ProfZ80Pause(int Switch);
+
+/** ProfZ80Step() ********************************************/
+/** RunZ80() calls this after each instruction, given the   **/
+/** PC, SP, and opcode it started with and cycles it took.  **/
+/*************************************************************/
+void ProfZ80Step(Z80 *R,word PC,word SP,byte Op,int Cycles);
+
+/** ProfZ80Int() *********************************************/
+/** RunZ80() calls this after IntZ80(), given the PC and SP **/
+/** before the interrupt.                                   **/
+/*************************************************************/
+void ProfZ80Int(Z80 *R,word PC,word SP);
+
+/** ProfZ80Save() ********************************************/
+/** Save collected data to a callgrind format file, with    **/
+/** ROM bank and PC as instruction positions. Calls still   **/
+/** open are counted up to now. Returns 1 on success, 0 on  **/
+/** failure.                                                **/
+/*************************************************************/
+int ProfZ80Save(const char *FileName);
+
+/** ProfZ80Report() ******************************************/
+/** Save a text report of the hottest instructions, with    **/
+/** their disassembly, and functions. Returns 1 on success, **/
+/** 0 on failure.                                           **/
+/*************************************************************/
+int ProfZ80Report(const char *FileName);
+
+#endif /* PROFZ80 */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* PROFZ80_H */
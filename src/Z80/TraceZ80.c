@@ -0,0 +1,150 @@
+/** Z80: portable Z80 emulator *******************************/
+/**                                                         **/
+/**                        TraceZ80.c                       **/
+/**                                                         **/
+/** This file contains the binary trace. RunZ80() fills the **/
+/** ring buffer inline, this file allocates it, handles the **/
+/** trigger, and saves the buffer to be decoded offline by  **/
+/** the z80trace tool (see ColEm/Host/Z80Trace.c).          **/
+/**                                                         **/
+/*************************************************************/
+#ifdef TRACEZ80
+
+#include "TraceZ80.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PutINT(P,V) \
+  { (P)[0]=(V)&0xFF;(P)[1]=((V)>>8)&0xFF;(P)[2]=((V)>>16)&0xFF;(P)[3]=((V)>>24)&0xFF; }
+
+#define PutWORD(P,V) \
+  { (P)[0]=(V)&0xFF;(P)[1]=((V)>>8)&0xFF; }
+
+/** Trace Files **********************************************/
+/** A 12-byte header ("TRZ\032\001", 3 zero bytes, 32bit    **/
+/** number of entries) is followed by 24-byte entries,      **/
+/** oldest first: 32bit cycle stamp, PC, SP, AF, BC, DE,    **/
+/** HL, IX, IY as 16bit words, and four bytes at PC. All    **/
+/** numbers are little-endian.                              **/
+/*************************************************************/
+TraceZ80Entry *TrcBuf = 0;           /* Ring buffer, or 0        */
+unsigned int TrcMask  = 0;           /* Ring buffer entries-1    */
+unsigned long long TrcPos = 0;       /* Entries logged, no wrap  */
+unsigned int TrcClock = 0;           /* Cycle stamp base         */
+unsigned int TrcLeft  = 0;           /* Entries to log, or 0     */
+int TrcTrigger        = -1;          /* Trigger PC, or -1        */
+int TrcOn             = 0;           /* 1: Logging instructions  */
+
+static unsigned int TrcAfter = 0;    /* Entries after trigger    */
+
+/** TraceZ80Init() *******************************************/
+/** Allocate ring buffer for at least given number of       **/
+/** entries (rounded up to a power of 2) and start tracing. **/
+/** Returns 1 on success, 0 on failure.                     **/
+/*************************************************************/
+int TraceZ80Init(unsigned int Entries)
+{
+  unsigned int N;
+
+  TraceZ80Trash();
+
+  for(N=1;(N<Entries)&&(N<0x80000000);N<<=1);
+  if(!(TrcBuf=malloc(N*sizeof(TraceZ80Entry)))) return(0);
+
+  TrcMask  = N-1;
+  TrcClock = 0;
+  TraceZ80Reset();
+  return(1);
+}
+
+/** TraceZ80Trash() ******************************************/
+/** Stop tracing and free the ring buffer.                  **/
+/*************************************************************/
+void TraceZ80Trash(void)
+{
+  TrcOn = 0;
+  if(TrcBuf) { free(TrcBuf);TrcBuf=0; }
+  TrcMask = TrcPos = TrcLeft = 0;
+}
+
+/** TraceZ80Reset() ******************************************/
+/** Drop all entries logged so far and resume tracing, e.g. **/
+/** when a new ROM is loaded or after saving a trigger.     **/
+/*************************************************************/
+void TraceZ80Reset(void)
+{
+  TrcPos  = 0;
+  TrcLeft = 0;
+  TrcOn   = TrcBuf!=0;
+}
+
+/** TraceZ80Trigger() ****************************************/
+/** Freeze the trace After instructions after reaching PC,  **/
+/** so that it keeps the instructions leading to PC. Give   **/
+/** PC=-1 to remove the trigger.                            **/
+/*************************************************************/
+void TraceZ80Trigger(int PC,unsigned int After)
+{
+  TrcTrigger = PC;
+  TrcAfter   = After;
+  TrcLeft    = 0;
+}
+
+/** TraceZ80Fire() *******************************************/
+/** RunZ80() calls this after logging the trigger PC.       **/
+/*************************************************************/
+void TraceZ80Fire(void)
+{
+  /* Count the trigger instruction itself */
+  if(!TrcLeft) TrcLeft=TrcAfter+1;
+}
+
+/** TraceZ80Frozen() *****************************************/
+/** Return 1 if a trigger has frozen the trace, 0 if it is  **/
+/** running or not initialized.                             **/
+/*************************************************************/
+int TraceZ80Frozen(void) { return(TrcBuf&&!TrcOn); }
+
+/** TraceZ80Save() *******************************************/
+/** Save entries in the ring buffer, oldest first, into a   **/
+/** given file. Returns 1 on success, 0 on failure.         **/
+/*************************************************************/
+int TraceZ80Save(const char *FileName)
+{
+  byte Buf[TRACEZ80_ENTRY];
+  const TraceZ80Entry *E;
+  unsigned long long J;
+  unsigned int N;
+  FILE *F;
+
+  if(!TrcBuf||!(F=fopen(FileName,"wb"))) return(0);
+
+  /* Only the last TrcMask+1 entries are kept */
+  N = TrcPos>TrcMask? TrcMask+1:(unsigned int)TrcPos;
+
+  Buf[0]='T';Buf[1]='R';Buf[2]='Z';Buf[3]='\032';
+  Buf[4]=1;Buf[5]=Buf[6]=Buf[7]=0;
+  PutINT(Buf+8,N);
+  if(fwrite(Buf,1,12,F)!=12) { fclose(F);return(0); }
+
+  for(J=TrcPos-N;J!=TrcPos;++J)
+  {
+    E = TrcBuf+(J&TrcMask);
+    PutINT(Buf,E->Clock);
+    PutWORD(Buf+2*2,E->PC);
+    PutWORD(Buf+2*3,E->SP);
+    PutWORD(Buf+2*4,E->AF);
+    PutWORD(Buf+2*5,E->BC);
+    PutWORD(Buf+2*6,E->DE);
+    PutWORD(Buf+2*7,E->HL);
+    PutWORD(Buf+2*8,E->IX);
+    PutWORD(Buf+2*9,E->IY);
+    Buf[20]=E->Op[0];Buf[21]=E->Op[1];Buf[22]=E->Op[2];Buf[23]=E->Op[3];
+    if(fwrite(Buf,1,TRACEZ80_ENTRY,F)!=TRACEZ80_ENTRY) { fclose(F);return(0); }
+  }
+
+  return(!fclose(F));
+}
+
+#endif /* TRACEZ80 */
@@ -0,0 +1,98 @@
+/** Z80: portable Z80 emulator *******************************/
+/**                                                         **/
+/**                        TraceZ80.h                       **/
+/**                                                         **/
+/** This file contains declarations for the binary trace,   **/
+/** compiled in when TRACEZ80 is #defined. RunZ80() logs PC **/
+/** opcode bytes, registers, and a cycle stamp of each      **/
+/** instruction into a ring buffer, that can be saved at    **/
+/** any time or frozen by a trigger. See TraceZ80.c for the **/
+/** implementation and the file format.                     **/
+/**                                                         **/
+/*************************************************************/
+#ifndef TRACEZ80_H
+#define TRACEZ80_H
+
+#include "Z80.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACEZ80_SIZE   0x100000 /* Default entries, 24MB    */
+#define TRACEZ80_ENTRY  24       /* Entry size in trace files */
+
+/** TraceZ80Entry ********************************************/
+/** One traced instruction: cycle stamp and registers taken **/
+/** before it executed, and four bytes at its PC.           **/
+/*************************************************************/
+typedef struct
+{
+  unsigned int Clock;          /* Cycles since TraceZ80Init() */
+  word PC,SP,AF,BC,DE,HL,IX,IY;
+  byte Op[4];                  /* Opcode and operand bytes    */
+} TraceZ80Entry;
+
+#ifdef TRACEZ80
+
+/** Trace State **********************************************/
+/** RunZ80() logs into TrcBuf[] while TrcOn is set. Only    **/
+/** read these, via the functions below.                    **/
+/*************************************************************/
+extern TraceZ80Entry *TrcBuf;  /* Ring buffer, or 0           */
+extern unsigned int TrcMask;   /* Ring buffer entries-1       */
+extern unsigned long long TrcPos; /* Logged so far, 64bit so  */
+                               /* that it never wraps         */
+extern unsigned int TrcClock;  /* Cycle stamp base            */
+extern unsigned int TrcLeft;   /* Entries to log, or 0        */
+extern int TrcTrigger;         /* Trigger PC, or -1           */
+extern int TrcOn;              /* 1: Logging instructions     */
+
+/** TraceZ80Init() *******************************************/
+/** Allocate ring buffer for at least given number of       **/
+/** entries (rounded up to a power of 2) and start tracing. **/
+/** Returns 1 on success, 0 on failure.                     **/
+/*************************************************************/
+int TraceZ80Init(unsigned int Entries);
+
+/** TraceZ80Trash() ******************************************/
+/** Stop tracing and free the ring buffer.                  **/
+/*************************************************************/
+void TraceZ80Trash(void);
+
+/** TraceZ80Reset() ******************************************/
+/** Drop all entries logged so far and resume tracing, e.g. **/
+/** when a new ROM is loaded or after saving a trigger.     **/
+/*************************************************************/
+void TraceZ80Reset(void);
+
+/** TraceZ80Trigger() ****************************************/
+/** Freeze the trace After instructions after reaching PC,  **/
+/** so that it keeps the instructions leading to PC. Give   **/
+/** PC=-1 to remove the trigger.                            **/
+/*************************************************************/
+void TraceZ80Trigger(int PC,unsigned int After);
+
+/** TraceZ80Frozen() *****************************************/
+/** Return 1 if a trigger has frozen the trace, 0 if it is  **/
+/** running or not initialized.                             **/
+/*************************************************************/
+int TraceZ80Frozen(void);
+
+/** TraceZ80Fire() *******************************************/
+/** RunZ80() calls this after logging the trigger PC.       **/
+/*************************************************************/
+void TraceZ80Fire(void);
+
+/** TraceZ80Save() *******************************************/
+/** Save entries in the ring buffer, oldest first, into a   **/
+/** given file. Returns 1 on success, 0 on failure.         **/
+/*************************************************************/
+int TraceZ80Save(const char *FileName);
+
+#endif /* TRACEZ80 */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* TRACEZ80_H */
@@ -17,6 +17,18 @@
 #include "Tables.h"
 #include <stdio.h>
 
+#ifdef PROFZ80
+#include "ProfZ80.h"
+#endif
+
+#ifdef DEBUG
+#include "BreakZ80.h"
+#endif
+
+#ifdef TRACEZ80
+#include "TraceZ80.h"
+#endif
+
 /** INLINE ***************************************************/
 /** C99 standard has "inline", but older compilers used     **/
 /** __inline for the same purpose.                          **/
@@ -75,6 +87,30 @@ INLINE void WrZ80(word A,byte V) { if(Page[A>>14]<ROM) Page[A>>14][A&0x3FFF]=V;
 #define OpZ80(A) RdZ80(A)
 #endif
 
+#ifdef TRACEZ80
+/** TraceStep() **********************************************/
+/** Log instruction at PC into the trace ring buffer, or    **/
+/** stop logging when a fired trigger runs out. The cycle   **/
+/** stamp leaves out cycles that EI holds in IBackup.       **/
+/*************************************************************/
+INLINE void TraceStep(Z80 *R)
+{
+  register TraceZ80Entry *E;
+  register word A = R->PC.W;
+
+  if(TrcLeft&&!--TrcLeft) { TrcOn=0;return; }
+
+  E = TrcBuf+(TrcPos++&TrcMask);
+  E->Clock = TrcClock-R->ICount-(R->IFF&IFF_EI? R->IBackup-1:0);
+  E->PC=A;E->SP=R->SP.W;E->AF=R->AF.W;E->BC=R->BC.W;
+  E->DE=R->DE.W;E->HL=R->HL.W;E->IX=R->IX.W;E->IY=R->IY.W;
+  E->Op[0]=OpZ80(A);E->Op[1]=OpZ80(A+1);
+  E->Op[2]=OpZ80(A+2);E->Op[3]=OpZ80(A+3);
+
+  if(A==TrcTrigger) TraceZ80Fire();
+}
+#endif
+
 #define S(Fl)        R->AF.B.l|=Fl
 #define R(Fl)        R->AF.B.l&=~(Fl)
 #define FLAGS(Rg,Fl) R->AF.B.l=Fl|ZSTable[Rg]
@@ -547,8 +583,8 @@ int ExecZ80(register Z80 *R,register int RunCycles)
     while(R->ICount>0)
     {
 #ifdef DEBUG
-      /* Turn tracing on when reached trap address */
-      if(R->PC.W==R->Trap) R->Trace=1;
+      /* Turn tracing on when reached trap address or breakpoint */
+      if((R->PC.W==R->Trap)||BreakZ80(BRK_MEM,R->PC.W,BRK_EXEC)) R->Trace=1;
       /* Call single-step debugger, exit if requested */
       if(R->Trace)
         if(!DebugZ80(R)) return(R->ICount);
@@ -661,17 +697,31 @@ word RunZ80(Z80 *R)
 {
   register byte I;
   register pair J;
+#ifdef PROFZ80
+  word PPC,PSP;
+  int PCycles;
+#endif
 
   for(;;)
   {
 #ifdef DEBUG
-    /* Turn tracing on when reached trap address */
-    if(R->PC.W==R->Trap) R->Trace=1;
+    /* Turn tracing on when reached trap address or breakpoint */
+    if((R->PC.W==R->Trap)||BreakZ80(BRK_MEM,R->PC.W,BRK_EXEC)) R->Trace=1;
     /* Call single-step debugger, exit if requested */
     if(R->Trace)
       if(!DebugZ80(R)) return(R->PC.W);
 #endif
 
+#ifdef PROFZ80
+    /* Keep state the profiler needs */
+    PPC=R->PC.W;PSP=R->SP.W;PCycles=R->ICount;
+#endif
+
+#ifdef TRACEZ80
+    /* Log instruction into the trace */
+    if(TrcOn) TraceStep(R);
+#endif
+
     /* Read opcode and count cycles */
     I=OpZ80(R->PC.W++);
     R->ICount-=Cycles[I];
@@ -687,6 +737,11 @@ word RunZ80(Z80 *R)
       case PFX_FD: CodesFD(R);break;
       case PFX_DD: CodesDD(R);break;
     }
+
+#ifdef PROFZ80
+    /* Count cycles and follow calls in guest code */
+    ProfZ80Step(R,PPC,PSP,I,PCycles-R->ICount);
+#endif
  
     /* If cycle counter expired... */
     if(R->ICount<=0)
@@ -704,6 +759,9 @@ word RunZ80(Z80 *R)
         {
           J.W=LoopZ80(R);        /* Call periodic handler    */
           R->ICount+=R->IPeriod; /* Reset the cycle counter  */
+#ifdef TRACEZ80
+          TrcClock+=R->IPeriod;  /* Keep cycle stamps going  */
+#endif
           if(J.W==INT_NONE) J.W=R->IRequest;  /* Pending IRQ */
         }
       }
@@ -711,11 +769,19 @@ word RunZ80(Z80 *R)
       {
         J.W=LoopZ80(R);          /* Call periodic handler    */
         R->ICount+=R->IPeriod;   /* Reset the cycle counter  */
+#ifdef TRACEZ80
+        TrcClock+=R->IPeriod;    /* Keep cycle stamps going  */
+#endif
         if(J.W==INT_NONE) J.W=R->IRequest;    /* Pending IRQ */
       }
 
       if(J.W==INT_QUIT) return(R->PC.W); /* Exit if INT_QUIT */
+#ifdef PROFZ80
+      if(J.W!=INT_NONE)                  /* Int-pt if needed */
+      { PPC=R->PC.W;PSP=R->SP.W;IntZ80(R,J.W);ProfZ80Int(R,PPC,PSP); }
+#else
       if(J.W!=INT_NONE) IntZ80(R,J.W);   /* Int-pt if needed */
+#endif
     }
   }
 
@@ -19,6 +19,8 @@ extern "C" {
 
                                /* Compilation options:       */
 /* #define DEBUG */            /* Compile debugging version  */
+/* #define PROFZ80 */          /* Compile guest profiler     */
+/* #define TRACEZ80 */         /* Compile binary trace       */
 /* #define LSB_FIRST */        /* Compile for low-endian CPU */
 /* #define MSB_FIRST */        /* Compile for hi-endian CPU  */
 
@@ -156,7 +158,8 @@ void PatchZ80(register Z80 *R);
 /** This function should exist if DEBUG is #defined. When   **/
 /** Trace!=0, it is called after each command executed by   **/
 /** the CPU, and given the Z80 registers. Emulation exits   **/
-/** if DebugZ80() returns 0.                                **/
+/** if DebugZ80() returns 0. Breakpoints set Trace when     **/
+/** hit, see BreakZ80.h.                                    **/
 /*************************************************************/
 #ifdef DEBUG
 byte DebugZ80(register Z80 *R);
@@ -182,6 +185,25 @@ word LoopZ80(register Z80 *R);
 void JumpZ80(word PC);
 #endif
 
+/** BankZ80() ************************************************/
+/** Guest profiler calls this function to find out which    **/
+/** ROM bank is mapped at address A, so that code from      **/
+/** different banks at the same address is told apart.      **/
+/** Return 0 if A is not banked.                            **/
+/************************************ TO BE WRITTEN BY USER **/
+#ifdef PROFZ80
+unsigned int BankZ80(word A);
+#endif
+
+/** DAsm() ***************************************************/
+/** Disassemble the code at address A into S, returning the **/
+/** number of bytes disassembled. Exists when DEBUG,        **/
+/** PROFZ80, or TRACEZ80 is #defined, see Debug.c.          **/
+/*************************************************************/
+#if defined(DEBUG) || defined(PROFZ80) || defined(TRACEZ80)
+int DAsm(char *S,word A);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
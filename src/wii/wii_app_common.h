@@ -114,7 +114,10 @@ enum NODETYPE {
     NODETYPE_FILTER,
     NODETYPE_GX_VI_SCALER,
     NODETYPE_DOUBLE_STRIKE,
-    NODETYPE_TRAP_FILTER
+    NODETYPE_TRAP_FILTER,
+    NODETYPE_FRAME_PACING,
+    NODETYPE_RUN_AHEAD,
+    NODETYPE_HOLD_ACTION
 };
 
 #endif
@@ -34,8 +34,12 @@
 #include "wii_input.h"
 #include "wii_sdl.h"
 #include "wii_coleco.h"
+#include "wii_coleco_catalog.h"
+#include "wii_coleco_config.h"
 #include "wii_coleco_keypad.h"
 #include "wii_coleco_menu.h"
+#include "wii_coleco_romlist.h"
+#include "wii_coleco_snapshot.h"
 #include "wii_gx.h"
 #include "wii_main.h"
 
@@ -82,6 +86,18 @@ BOOL wii_super_game_module = TRUE;
 u8 wii_volume = 7;
 /** Maximum frame rate */
 u8 wii_max_frames = 60;
+/** Audio buffering latency (ms) */
+u16 wii_audio_latency = 150;
+/** How frames are paced (audio clock or timer) */
+u8 wii_frame_pacing = FRAME_PACING_AUDIO;
+/** Whether to synthesize audio on its own thread */
+BOOL wii_audio_thread = TRUE;
+/** Rewind history size (MB, 0 disables) */
+u8 wii_rewind_size = 4;
+/** Frames to run ahead of input (0 disables) */
+u8 wii_run_ahead = 0;
+/** What holding the minus button does (rewind or fast-forward) */
+u8 wii_hold_action = HOLD_ACTION_REWIND;
 /** The screen X size */
 int wii_screen_x = DEFAULT_SCREEN_X;
 /** The screen Y size */
@@ -151,7 +167,7 @@ const char* wii_get_data_path() {
  * Initializes the application
  */
 void wii_handle_init() {
-    wii_read_config();
+    wii_coleco_config_read();
 
     // Startup the SDL
     if (!wii_sdl_init()) {
@@ -159,6 +175,9 @@ void wii_handle_init() {
         exit(EXIT_FAILURE);
     }
 
+    // The database is also read by the catalog scanner
+    wii_coleco_db_init();
+
     // FreeTypeGX
     InitFreeType((uint8_t*)font_ttf, (FT_Long)font_ttf_size);
 
@@ -235,6 +254,11 @@ void wii_set_video_mode(BOOL allowVi) {
  * Frees resources prior to the application exiting
  */
 void wii_handle_free_resources() {
+    wii_snapshot_flush();
+    wii_catalog_stop();
+    wii_catalog_flush();
+    wii_coleco_db_compact();
+    wii_romlist_flush();
     wii_sdl_free_resources();
     wii_keypad_free_resources();
     SDL_Quit();
@@ -269,7 +293,7 @@ void wii_handle_run() {
     }
 
     // Write the config settings, free resources, and exit
-    wii_write_config();
+    wii_coleco_config_write(TRUE);
 }
 
 /**
@@ -50,6 +50,21 @@
 #define WII_WIDTH_DIV2 320
 #define WII_HEIGHT_DIV2 240
 
+// Frame pacing modes
+#define FRAME_PACING_TIMER 0
+#define FRAME_PACING_AUDIO 1
+
+// Maximum frames to run ahead of input
+#define RUN_AHEAD_MAX 3
+
+// Audio latency bounds (ms), the buffer has to hold a couple of frames
+#define AUDIO_LATENCY_MIN 40
+#define AUDIO_LATENCY_MAX 1000
+
+// What holding the minus button does
+#define HOLD_ACTION_REWIND 0
+#define HOLD_ACTION_FAST_FORWARD 1
+
 // ColecoVision button mappings
 #define WII_BUTTON_CV_SHOW_KEYPAD   (WPAD_BUTTON_PLUS | WPAD_CLASSIC_BUTTON_PLUS)
 #define GC_BUTTON_CV_SHOW_KEYPAD    (PAD_BUTTON_START)
@@ -85,6 +100,9 @@
 #define WII_CLASSIC_CV_7    (WPAD_CLASSIC_BUTTON_ZR)
 #define WII_CLASSIC_CV_8    (WPAD_CLASSIC_BUTTON_ZL)
 
+// Hold to rewind or fast-forward
+#define WII_BUTTON_CV_HOLD  (WPAD_BUTTON_MINUS | WPAD_CLASSIC_BUTTON_MINUS)
+
 /** The last ColecoVision cartridge hash */
 extern char wii_cartridge_hash[33];
 /** The current ColecoVision Mode */
@@ -107,6 +125,18 @@ extern BOOL wii_super_game_module;
 extern u8 wii_volume;
 /** Maximum frame rate */
 extern u8 wii_max_frames;
+/** Audio buffering latency (ms) */
+extern u16 wii_audio_latency;
+/** How frames are paced (audio clock or timer) */
+extern u8 wii_frame_pacing;
+/** Whether to synthesize audio on its own thread */
+extern BOOL wii_audio_thread;
+/** Rewind history size (MB, 0 disables) */
+extern u8 wii_rewind_size;
+/** Frames to run ahead of input (0 disables) */
+extern u8 wii_run_ahead;
+/** What holding the minus button does (rewind or fast-forward) */
+extern u8 wii_hold_action;
 /** The screen X size */
 extern int wii_screen_x;
 /** The screen Y size */
@@ -0,0 +1,626 @@
+//---------------------------------------------------------------------------//
+//   __      __.__.___________        .__                                    //
+//  /  \    /  \__|__\_   ___ \  ____ |  |   ____   _____                    //
+//  \   \/\/   /  |  /    \  \/ /  _ \|  | _/ __ \ /     \                   //
+//   \        /|  |  \     \___(  <_> )  |_\  ___/|  Y Y  \                  //
+//    \__/\  / |__|__|\______  /\____/|____/\___  >__|_|  /                  //
+//         \/                \/                 \/      \/                   //
+//     WiiColem by raz0red                                                   //
+//     Port of the ColEm emulator by Marat Fayzullin                         //
+//                                                                           //
+//     [github.com/raz0red/wiicolem]                                         //
+//                                                                           //
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  Copyright (C) 2019 raz0red                                               //
+//                                                                           //
+//  The license for ColEm as indicated by Marat Fayzullin, the author of     //
+//  ColEm is detailed below:                                                 //
+//                                                                           //
+//  ColEm sources are available under three conditions:                      //
+//                                                                           //
+//  1) You are not using them for a commercial project.                      //
+//  2) You provide a proper reference to Marat Fayzullin as the author of    //
+//     the original source code.                                             //
+//  3) You provide a link to http://fms.komkon.org/ColEm/                    //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <ogc/lwp.h>
+
+#ifdef ZLIB
+#include <zlib.h>
+#endif
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "Coleco.h"
+#include "CRC32.h"
+
+#include "wii_app_common.h"
+#include "wii_app.h"
+#include "wii_hash.h"
+#include "wii_util.h"
+#include "wii_coleco.h"
+#include "wii_coleco_catalog.h"
+
+#define CATALOG_FILE_PATH WII_FILES_DIR "wiicolem.cat"
+#define CATALOG_TMP_FILE_PATH WII_FILES_DIR "wiicolem.cat.tmp"
+
+#define CATALOG_INDEX_INITIAL 256      /* Initial slots in the path index */
+#define CATALOG_MAX_SIZE (128 * 0x4000) /* Largest rom, as in LoadROM() */
+#define CATALOG_PRIORITY 8             /* Scanner thread priority (low) */
+#define CATALOG_YIELD_MS 10            /* Pause after each rom scanned */
+
+/** A rom in the catalog */
+typedef struct {
+    char* path;                // The path of the rom file
+    u32 pass;                  // The last scan that saw the rom file
+    ColecoCatalogEntry entry;  // What is known about the rom
+} catalog_item;
+
+/** The catalog file */
+static char cat_file[WII_MAX_PATH] = "";
+/** The catalog temp file */
+static char cat_tmp_file[WII_MAX_PATH] = "";
+
+/** The roms in the catalog */
+static catalog_item** cat_items = NULL;
+/** The number of roms in the catalog */
+static int cat_count = 0;
+/** The number of roms there is room for */
+static int cat_size = 0;
+/** Open addressing hash table of paths, holds item numbers (0 if empty) */
+static int* cat_index = NULL;
+/** The number of slots in the index (power of two) */
+static int cat_index_size = 0;
+
+/** Guards the catalog, shared by the menu and the scanner */
+static SDL_mutex* cat_mutex = NULL;
+/** The scanner thread (NULL if not scanning) */
+static SDL_Thread* cat_scanner = NULL;
+/** Set to stop the scanner */
+static volatile BOOL cat_stop = FALSE;
+/** The directory being scanned */
+static char cat_dir[WII_MAX_PATH] = "";
+/** The number of the current scan */
+static u32 cat_pass = 0;
+/** Whether the catalog file has been read */
+static BOOL cat_loaded = FALSE;
+/** Whether the catalog differs from the catalog file */
+static BOOL cat_dirty = FALSE;
+
+/**
+ * Returns the path to the catalog file
+ *
+ * @return  The path to the catalog file
+ */
+static char* get_catalog_path() {
+    if (cat_file[0] == '\0') {
+        snprintf(cat_file, WII_MAX_PATH, "%s%s", wii_get_fs_prefix(),
+                 CATALOG_FILE_PATH);
+    }
+    return cat_file;
+}
+
+/**
+ * Returns the path to the catalog temporary file
+ *
+ * @return  The path to the catalog temporary file
+ */
+static char* get_catalog_tmp_path() {
+    if (cat_tmp_file[0] == '\0') {
+        snprintf(cat_tmp_file, WII_MAX_PATH, "%s%s", wii_get_fs_prefix(),
+                 CATALOG_TMP_FILE_PATH);
+    }
+    return cat_tmp_file;
+}
+
+/**
+ * Returns the index slot for the specified path: either the slot holding it,
+ * or the empty slot it would go into.
+ *
+ * @param   path The path of the rom file
+ * @return  The index slot for the path
+ */
+static int* find_slot(const char* path) {
+    u32 hash = 2166136261u;
+    for (const char* ptr = path; *ptr; ptr++) {
+        hash = (hash ^ (u8)*ptr) * 16777619u;
+    }
+
+    u32 slot = hash & (cat_index_size - 1);
+    while (cat_index[slot] != 0 &&
+           strcmp(cat_items[cat_index[slot] - 1]->path, path)) {
+        slot = (slot + 1) & (cat_index_size - 1);
+    }
+    return &cat_index[slot];
+}
+
+/**
+ * Returns the catalog item of the specified path (catalog locked)
+ *
+ * @param   path The path of the rom file
+ * @return  The item (NULL if the rom is not in the catalog)
+ */
+static catalog_item* find_item(const char* path) {
+    if (cat_index_size == 0) {
+        return NULL;
+    }
+    int item = *find_slot(path);
+    return item ? cat_items[item - 1] : NULL;
+}
+
+/**
+ * Rebuilds the index from the items (catalog locked)
+ */
+static void reindex() {
+    memset(cat_index, 0, cat_index_size * sizeof(int));
+    for (int i = 0; i < cat_count; i++) {
+        *find_slot(cat_items[i]->path) = i + 1;
+    }
+}
+
+/**
+ * Adds a rom to the catalog, or replaces its entry (catalog locked)
+ *
+ * @param   path The path of the rom file
+ * @param   entry The entry of the rom
+ * @param   pass The scan that saw the rom
+ * @return  Whether the rom was added
+ */
+static BOOL add_item(const char* path,
+                     const ColecoCatalogEntry* entry,
+                     u32 pass) {
+    catalog_item* item = find_item(path);
+    if (item) {
+        item->entry = *entry;
+        item->pass = pass;
+        return TRUE;
+    }
+
+    // Keep the index at most half full
+    if ((cat_count + 1) * 2 > cat_index_size) {
+        int size = cat_index_size ? cat_index_size * 2 : CATALOG_INDEX_INITIAL;
+        int* index = (int*)malloc(size * sizeof(int));
+        if (!index) {
+            return FALSE;
+        }
+        free(cat_index);
+        cat_index = index;
+        cat_index_size = size;
+        reindex();
+    }
+    if (cat_count == cat_size) {
+        int size = cat_size ? cat_size * 2 : CATALOG_INDEX_INITIAL;
+        catalog_item** items =
+            (catalog_item**)realloc(cat_items, size * sizeof(catalog_item*));
+        if (!items) {
+            return FALSE;
+        }
+        cat_items = items;
+        cat_size = size;
+    }
+
+    item = (catalog_item*)malloc(sizeof(catalog_item));
+    if (!item) {
+        return FALSE;
+    }
+    item->path = strdup(path);
+    if (!item->path) {
+        free(item);
+        return FALSE;
+    }
+    item->entry = *entry;
+    item->pass = pass;
+
+    cat_items[cat_count++] = item;
+    *find_slot(path) = cat_count;
+    return TRUE;
+}
+
+/**
+ * Drops the roms of the specified directory that the specified scan did not
+ * see, they are gone (catalog locked)
+ *
+ * @param   dir The directory that was scanned
+ * @param   pass The scan
+ */
+static void remove_unseen(const char* dir, u32 pass) {
+    int len = strlen(dir);
+    int count = 0;
+    for (int i = 0; i < cat_count; i++) {
+        catalog_item* item = cat_items[i];
+        if (item->pass != pass && !strncmp(item->path, dir, len) &&
+            !strchr(item->path + len, '/')) {
+            free(item->path);
+            free(item);
+        } else {
+            cat_items[count++] = item;
+        }
+    }
+
+    if (count != cat_count) {
+        cat_count = count;
+        reindex();
+        cat_dirty = TRUE;
+    }
+}
+
+/**
+ * Reads the catalog file. Each line holds the path, size, modification time,
+ * type, CRC, guessed modes, hash and database name of a rom, separated by
+ * tabs.
+ */
+static void load_catalog() {
+    char buff[WII_MAX_PATH + 512];
+
+    FILE* fp = fopen(get_catalog_path(), "r");
+    if (!fp) {
+        return;
+    }
+
+    BOOL line_start = TRUE;
+    while (!cat_stop && fgets(buff, sizeof(buff), fp) != 0) {
+        char* fields[8];
+        int count = 0;
+        char* ptr = strchr(buff, '\n');
+        BOOL skip = !line_start || !ptr;  // Skip lines that are too long
+        line_start = ptr != NULL;
+        if (skip) {
+            continue;
+        }
+        *ptr = '\0';
+
+        // The name comes last, it may hold tabs of its own
+        fields[count++] = buff;
+        while (count < 8 && (ptr = strchr(fields[count - 1], '\t')) != NULL) {
+            *ptr = '\0';
+            fields[count++] = ptr + 1;
+        }
+        if (count != 8) {
+            continue;
+        }
+
+        ColecoCatalogEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.size = strtoul(fields[1], NULL, 10);
+        entry.mtime = strtoul(fields[2], NULL, 10);
+        entry.type = strtoul(fields[3], NULL, 10);
+        entry.crc = strtoul(fields[4], NULL, 16);
+        entry.mode = strtoul(fields[5], NULL, 16);
+        Util_strlcpy(entry.hash, fields[6], sizeof(entry.hash));
+        Util_strlcpy(entry.name, fields[7], sizeof(entry.name));
+
+        SDL_LockMutex(cat_mutex);
+        if (!find_item(fields[0])) {
+            add_item(fields[0], &entry, 0);
+        }
+        SDL_UnlockMutex(cat_mutex);
+    }
+    fclose(fp);
+}
+
+/**
+ * Returns whether the specified bytes hold the magic number of a
+ * ColecoVision cartridge
+ *
+ * @param   data The bytes
+ * @return  Whether the bytes hold the magic number of a cartridge
+ */
+static BOOL is_cartridge(const u8* data) {
+    return (data[0] == 0x55 && data[1] == 0xAA) ||
+           (data[0] == 0xAA && data[1] == 0x55);
+}
+
+/**
+ * Reads the contents of the specified rom file. Gzipped roms are unpacked,
+ * as LoadROM() reads them through zlib too.
+ *
+ * @param   path The path of the rom file
+ * @param   size The number of bytes read, CATALOG_MAX_SIZE + 1 for files
+ *          larger than any rom (out)
+ * @return  The contents (to be freed by the caller), or NULL if the file
+ *          could not be read
+ */
+static u8* read_rom(const char* path, int* size) {
+#ifdef ZLIB
+    gzFile fp = gzopen(path, "rb");
+#else
+    FILE* fp = fopen(path, "rb");
+#endif
+    if (!fp) {
+        return NULL;
+    }
+
+    // The unpacked size is not known up front, read until past the largest
+    int alloc = 0;
+    int count = 0;
+    int n;
+    u8* data = NULL;
+    do {
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 0x4000;
+            if (alloc > CATALOG_MAX_SIZE + 1) {
+                alloc = CATALOG_MAX_SIZE + 1;
+            }
+            u8* grown = (u8*)realloc(data, alloc);
+            if (!grown) {
+                n = -1;
+                break;
+            }
+            data = grown;
+        }
+#ifdef ZLIB
+        n = gzread(fp, data + count, alloc - count);
+#else
+        n = fread(data + count, 1, alloc - count, fp);
+#endif
+        if (n > 0) {
+            count += n;
+        }
+    } while (n > 0 && count <= CATALOG_MAX_SIZE);
+
+#ifdef ZLIB
+    gzclose(fp);
+#else
+    fclose(fp);
+#endif
+    if (n < 0) {
+        free(data);
+        return NULL;
+    }
+    *size = count;
+    return data;
+}
+
+/**
+ * Reads the specified rom file and fills in its catalog entry, recognizing
+ * the rom the same way LoadROM() does
+ *
+ * @param   path The path of the rom file
+ * @param   st The status of the rom file
+ * @param   entry The entry to fill in (out)
+ * @return  Whether the rom file was read
+ */
+static BOOL scan_rom(const char* path,
+                     const struct stat* st,
+                     ColecoCatalogEntry* entry) {
+    memset(entry, 0, sizeof(ColecoCatalogEntry));
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtime;
+    if (st->st_size <= 2) {
+        // Not a rom, there is nothing more to know
+        return TRUE;
+    }
+
+    // Sizes are checked unpacked, as LoadROM() checks them
+    int size = 0;
+    u8* data = read_rom(path, &size);
+    if (!data) {
+        return FALSE;
+    }
+    if (size <= 2 || size > CATALOG_MAX_SIZE) {
+        // Not a rom, there is nothing more to know
+        free(data);
+        return TRUE;
+    }
+
+    // MegaCarts have the magic number in their last 16kB page
+    if (is_cartridge(data)) {
+        entry->type = CATALOG_CARTRIDGE;
+    } else if (data[0] == 0x66 && data[1] == 0x99) {
+        entry->type = CATALOG_EXPANSION;
+    } else if (size > 0x8000 && is_cartridge(data + (size & ~0x3FFF) - 0x4000)) {
+        entry->type = CATALOG_MEGACART;
+    }
+
+    if (entry->type != CATALOG_UNKNOWN) {
+        entry->crc = ComputeCRC32(0, data, size);
+        entry->mode = GuessCRC(entry->crc);
+    }
+    if (entry->type == CATALOG_CARTRIDGE || entry->type == CATALOG_MEGACART) {
+        // Hashed as the loaded cartridge is, to look it up in the database
+        wii_hash_compute(data, size, entry->hash);
+
+        ColecoDBEntry db_entry;
+        wii_coleco_db_get_entry(entry->hash, &db_entry);
+        if (db_entry.loaded) {
+            Util_strlcpy(entry->name, db_entry.name, sizeof(entry->name));
+        }
+    }
+
+    free(data);
+    return TRUE;
+}
+
+/**
+ * The scanner thread. Reads the catalog file the first time around, then
+ * walks the directory, scanning the roms that are new or have changed.
+ *
+ * @param   data Unused
+ * @return  0
+ */
+static int catalog_scanner(void* data) {
+    // Only run while the menu thread is waiting
+    LWP_SetThreadPriority(LWP_GetSelf(), CATALOG_PRIORITY);
+
+    if (!cat_loaded) {
+        load_catalog();
+        cat_loaded = !cat_stop;
+    }
+
+    DIR* dir = opendir(cat_dir);
+    if (!dir) {
+        return 0;
+    }
+
+    u32 pass = ++cat_pass;
+    char path[WII_MAX_PATH];
+    struct dirent* ent = NULL;
+    while (!cat_stop && (ent = readdir(dir)) != NULL) {
+        if (ent->d_type == DT_DIR) {
+            continue;
+        }
+
+        struct stat st;
+        snprintf(path, sizeof(path), "%s%s", cat_dir, ent->d_name);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+
+        SDL_LockMutex(cat_mutex);
+        catalog_item* item = find_item(path);
+        BOOL current = item && item->entry.size == st.st_size &&
+                       item->entry.mtime == st.st_mtime;
+        if (current) {
+            item->pass = pass;
+        }
+        SDL_UnlockMutex(cat_mutex);
+        if (current) {
+            continue;
+        }
+
+        ColecoCatalogEntry entry;
+        if (scan_rom(path, &st, &entry)) {
+            SDL_LockMutex(cat_mutex);
+            add_item(path, &entry, pass);
+            cat_dirty = TRUE;
+            SDL_UnlockMutex(cat_mutex);
+        }
+        SDL_Delay(CATALOG_YIELD_MS);
+    }
+    closedir(dir);
+
+    if (!cat_stop) {
+        SDL_LockMutex(cat_mutex);
+        remove_unseen(cat_dir, pass);
+        SDL_UnlockMutex(cat_mutex);
+    }
+    return 0;
+}
+
+/**
+ * Starts scanning the specified directory in the background, replacing any
+ * scan in progress
+ *
+ * @param   dir The directory to scan
+ */
+void wii_catalog_scan(const char* dir) {
+    wii_catalog_stop();
+
+    if (!cat_mutex && !(cat_mutex = SDL_CreateMutex())) {
+        return;
+    }
+    Util_strlcpy(cat_dir, dir, sizeof(cat_dir));
+    cat_stop = FALSE;
+    cat_scanner = SDL_CreateThread(catalog_scanner, NULL);
+}
+
+/**
+ * Stops the background scan (if any), waiting for the scanner to finish the
+ * rom it is on
+ */
+void wii_catalog_stop() {
+    if (cat_scanner) {
+        cat_stop = TRUE;
+        SDL_WaitThread(cat_scanner, NULL);
+        cat_scanner = NULL;
+    }
+}
+
+/**
+ * Returns the catalog entry of the specified rom file
+ *
+ * @param   path The path of the rom file
+ * @param   entry The entry to populate (out)
+ * @return  Whether the rom is in the catalog
+ */
+BOOL wii_catalog_get_entry(const char* path, ColecoCatalogEntry* entry) {
+    if (!cat_mutex) {
+        return FALSE;
+    }
+
+    SDL_LockMutex(cat_mutex);
+    catalog_item* item = find_item(path);
+    if (item) {
+        *entry = item->entry;
+    }
+    SDL_UnlockMutex(cat_mutex);
+    return item != NULL;
+}
+
+/**
+ * Updates the database name of the roms with the specified hash. Copies of
+ * a rom share its database entry.
+ *
+ * @param   hash The hash of the rom, its key in the database
+ * @param   name The name of the game ('\0' if it is not in the database)
+ */
+void wii_catalog_set_name(const char* hash, const char* name) {
+    if (!cat_mutex) {
+        return;
+    }
+
+    SDL_LockMutex(cat_mutex);
+    for (int i = 0; i < cat_count; i++) {
+        ColecoCatalogEntry* entry = &cat_items[i]->entry;
+        if (!strcmp(entry->hash, hash) && strcmp(entry->name, name)) {
+            Util_strlcpy(entry->name, name, sizeof(entry->name));
+            cat_dirty = TRUE;
+        }
+    }
+    SDL_UnlockMutex(cat_mutex);
+}
+
+/**
+ * Writes the catalog out, if it has changed. It is written to a temporary
+ * file first, so a partial write never replaces the catalog.
+ */
+void wii_catalog_flush() {
+    if (!cat_dirty || !cat_mutex) {
+        return;
+    }
+
+    FILE* fp = fopen(get_catalog_tmp_path(), "w");
+    if (!fp) {
+        return;
+    }
+
+    // Changes made while writing are picked up by the next flush
+    SDL_LockMutex(cat_mutex);
+    cat_dirty = FALSE;
+    for (int i = 0; i < cat_count; i++) {
+        catalog_item* item = cat_items[i];
+        if (strpbrk(item->path, "\t\n")) {
+            continue;
+        }
+        ColecoCatalogEntry* entry = &item->entry;
+        fprintf(fp, "%s\t%lu\t%lu\t%d\t%08x\t%x\t%s\t%s\n", item->path,
+                (unsigned long)entry->size, (unsigned long)entry->mtime,
+                entry->type, entry->crc, entry->mode, entry->hash,
+                entry->name);
+    }
+    SDL_UnlockMutex(cat_mutex);
+
+    BOOL written = !ferror(fp);
+    if (fclose(fp) == 0 && written) {
+        remove(get_catalog_path());
+        written = rename(get_catalog_tmp_path(), get_catalog_path()) == 0;
+    } else {
+        written = FALSE;
+    }
+
+    if (!written) {
+        SDL_LockMutex(cat_mutex);
+        cat_dirty = TRUE;
+        SDL_UnlockMutex(cat_mutex);
+    }
+}
@@ -0,0 +1,97 @@
+//---------------------------------------------------------------------------//
+//   __      __.__.___________        .__                                    //
+//  /  \    /  \__|__\_   ___ \  ____ |  |   ____   _____                    //
+//  \   \/\/   /  |  /    \  \/ /  _ \|  | _/ __ \ /     \                   //
+//   \        /|  |  \     \___(  <_> )  |_\  ___/|  Y Y  \                  //
+//    \__/\  / |__|__|\______  /\____/|____/\___  >__|_|  /                  //
+//         \/                \/                 \/      \/                   //
+//     WiiColem by raz0red                                                   //
+//     Port of the ColEm emulator by Marat Fayzullin                         //
+//                                                                           //
+//     [github.com/raz0red/wiicolem]                                         //
+//                                                                           //
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  Copyright (C) 2019 raz0red                                               //
+//                                                                           //
+//  The license for ColEm as indicated by Marat Fayzullin, the author of     //
+//  ColEm is detailed below:                                                 //
+//                                                                           //
+//  ColEm sources are available under three conditions:                      //
+//                                                                           //
+//  1) You are not using them for a commercial project.                      //
+//  2) You provide a proper reference to Marat Fayzullin as the author of    //
+//     the original source code.                                             //
+//  3) You provide a link to http://fms.komkon.org/ColEm/                    //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#ifndef WII_COLECO_CATALOG_H
+#define WII_COLECO_CATALOG_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <gctypes.h>
+
+#include "wii_util.h"
+
+// Types of rom files
+#define CATALOG_UNKNOWN 0    // Not a rom
+#define CATALOG_CARTRIDGE 1  // ColecoVision cartridge
+#define CATALOG_MEGACART 2   // ColecoVision MegaCart
+#define CATALOG_EXPANSION 3  // Coleco Adam expansion rom
+
+/**
+ * Catalog entry, what is known about a rom file without loading it
+ */
+typedef struct ColecoCatalogEntry {
+    off_t size;      // Size of the rom file when it was scanned
+    time_t mtime;    // Modification time of the rom file when it was scanned
+    u8 type;         // The type of rom (CATALOG_CARTRIDGE, etc.)
+    u32 crc;         // CRC32 of the rom
+    u32 mode;        // Hardware modes guessed from the CRC (CV_EEPROM, etc.)
+    char hash[33];   // MD5 of the rom, its key in the database
+    char name[255];  // The name of the game in the database ('\0' if none)
+} ColecoCatalogEntry;
+
+/**
+ * Starts scanning the specified directory in the background, replacing any
+ * scan in progress. Roms whose size and modification time match their
+ * catalog entries are skipped.
+ *
+ * @param   dir The directory to scan
+ */
+void wii_catalog_scan(const char* dir);
+
+/**
+ * Stops the background scan (if any), waiting for the scanner to finish the
+ * rom it is on
+ */
+void wii_catalog_stop();
+
+/**
+ * Returns the catalog entry of the specified rom file. Only the catalog in
+ * memory is looked at, the rom file itself is not.
+ *
+ * @param   path The path of the rom file
+ * @param   entry The entry to populate (out)
+ * @return  Whether the rom is in the catalog
+ */
+BOOL wii_catalog_get_entry(const char* path, ColecoCatalogEntry* entry);
+
+/**
+ * Updates the database name of the roms with the specified hash, after
+ * their database entry has been saved or deleted
+ *
+ * @param   hash The hash of the rom, its key in the database
+ * @param   name The name of the game ('\0' if it is not in the database)
+ */
+void wii_catalog_set_name(const char* hash, const char* name);
+
+/**
+ * Writes the catalog out, if it has changed
+ */
+void wii_catalog_flush();
+
+#endif
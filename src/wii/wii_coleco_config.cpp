@@ -27,13 +27,38 @@
 //---------------------------------------------------------------------------//
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
+#include <ogc/lwp.h>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "wii_app.h"
 #include "wii_util.h"
 #include "wii_coleco.h"
+#include "wii_coleco_config.h"
 #include "wii_config.h"
 
 #include "networkop.h"
 
+#define CONFIG_TMP_EXT ".tmp"
+#define CONFIG_WRITER_PRIORITY 8  // Writer thread priority (low)
+
+/** What the configuration file holds (as last read or written) */
+static char* config_written = NULL;
+/** The size of what the configuration file holds */
+static size_t config_written_size = 0;
+
+/** The configuration being written by the writer thread */
+static char* config_pending = NULL;
+/** The size of the configuration being written */
+static size_t config_pending_size = 0;
+/** The writer thread (NULL if not writing) */
+static SDL_Thread* config_writer = NULL;
+
 /**
  * Handles reading a particular configuration value
  *
@@ -63,6 +88,24 @@ void wii_config_handle_read_value(char* name, char* value) {
         wii_volume = Util_sscandec(value);
     } else if (strcmp(name, "max_frames") == 0) {
         wii_max_frames = Util_sscandec(value);
+    } else if (strcmp(name, "audio_latency") == 0) {
+        int latency = Util_sscandec(value);
+        if (latency < AUDIO_LATENCY_MIN) {
+            latency = AUDIO_LATENCY_MIN;
+        } else if (latency > AUDIO_LATENCY_MAX) {
+            latency = AUDIO_LATENCY_MAX;
+        }
+        wii_audio_latency = latency;
+    } else if (strcmp(name, "frame_pacing") == 0) {
+        wii_frame_pacing = Util_sscandec(value);
+    } else if (strcmp(name, "audio_thread") == 0) {
+        wii_audio_thread = Util_sscandec(value);
+    } else if (strcmp(name, "rewind_size") == 0) {
+        wii_rewind_size = Util_sscandec(value);
+    } else if (strcmp(name, "run_ahead") == 0) {
+        wii_run_ahead = Util_sscandec(value);
+    } else if (strcmp(name, "hold_action") == 0) {
+        wii_hold_action = Util_sscandec(value);
     } else if (strcmp(name, "screen_size_x") == 0) {
         wii_screen_x = Util_sscandec(value);
     } else if (strcmp(name, "screen_size_y") == 0) {
@@ -104,6 +147,160 @@ void wii_config_handle_read_value(char* name, char* value) {
     }
 }
 
+/**
+ * Returns the path to the configuration file
+ *
+ * @param   path The buffer to receive the path
+ * @param   tmp Whether to return the path to the temporary file instead
+ */
+static void get_config_path(char* path, BOOL tmp) {
+    snprintf(path, WII_MAX_PATH, "%s%s%s", wii_get_fs_prefix(),
+             wii_get_config_file_path(), tmp ? CONFIG_TMP_EXT : "");
+}
+
+/**
+ * Renders the configuration, as it would be written to the configuration
+ * file, into memory
+ *
+ * @param   size The size of the configuration (out)
+ * @return  The configuration (NULL if it could not be rendered), to be
+ *          freed by the caller
+ */
+static char* render_config(size_t* size) {
+    char* config = NULL;
+    FILE* fp = open_memstream(&config, size);
+    if (!fp) {
+        return NULL;
+    }
+    wii_config_handle_write_config(fp);
+    fclose(fp);
+    return config;
+}
+
+/**
+ * Writes the specified configuration to the temporary file, then renames it
+ * over the configuration file. On success, it becomes what the configuration
+ * file holds.
+ *
+ * @param   config The configuration (taken over by this function)
+ * @param   size The size of the configuration
+ * @return  Whether the configuration was written
+ */
+static BOOL write_config_file(char* config, size_t size) {
+    char path[WII_MAX_PATH];
+    char tmp_path[WII_MAX_PATH];
+    get_config_path(path, FALSE);
+    get_config_path(tmp_path, TRUE);
+
+    BOOL written = FALSE;
+    FILE* fp = fopen(tmp_path, "w");
+    if (fp) {
+        written = fwrite(config, 1, size, fp) == size;
+        if (fclose(fp) != 0) {
+            written = FALSE;
+        }
+    }
+    if (written) {
+        remove(path);
+        written = rename(tmp_path, path) == 0;
+    }
+
+    if (written) {
+        free(config_written);
+        config_written = config;
+        config_written_size = size;
+    } else {
+        // Still differs from the file, the next write tries again
+        free(config);
+    }
+    return written;
+}
+
+/**
+ * The writer thread, writes out the pending configuration
+ *
+ * @param   data Unused
+ * @return  0
+ */
+static int config_writer_thread(void* data) {
+    // Stay out of the way of the rom being loaded
+    LWP_SetThreadPriority(LWP_GetSelf(), CONFIG_WRITER_PRIORITY);
+
+    write_config_file(config_pending, config_pending_size);
+    config_pending = NULL;
+    return 0;
+}
+
+/**
+ * Waits for the writer thread (if any) to finish
+ */
+static void wait_config_writer() {
+    if (config_writer) {
+        SDL_WaitThread(config_writer, NULL);
+        config_writer = NULL;
+    }
+}
+
+/**
+ * Reads the configuration file, recovering it from the temporary file if a
+ * write was cut short, and remembers what it holds
+ */
+void wii_coleco_config_read() {
+    char path[WII_MAX_PATH];
+    char tmp_path[WII_MAX_PATH];
+    get_config_path(path, FALSE);
+    get_config_path(tmp_path, TRUE);
+
+    // The temporary file is complete once the configuration file is removed
+    struct stat st;
+    if (stat(path, &st) != 0 && stat(tmp_path, &st) == 0) {
+        rename(tmp_path, path);
+    }
+
+    wii_read_config();
+
+    // Values missing from the file are left as their defaults, they only get
+    // written out once something changes
+    free(config_written);
+    config_written = render_config(&config_written_size);
+}
+
+/**
+ * Writes the configuration file, if any value has changed since it was last
+ * read or written. The file is written to a temporary file and renamed over
+ * the configuration file, so a partial write never replaces it.
+ *
+ * @param   wait Whether to wait for the write (otherwise it is done by a
+ *          background thread)
+ * @return  Whether the configuration is (or is being) written
+ */
+BOOL wii_coleco_config_write(BOOL wait) {
+    wait_config_writer();
+
+    size_t size = 0;
+    char* config = render_config(&size);
+    if (!config) {
+        return FALSE;
+    }
+    if (config_written && size == config_written_size &&
+        !memcmp(config, config_written, size)) {
+        // Nothing has changed
+        free(config);
+        return TRUE;
+    }
+
+    if (!wait) {
+        config_pending = config;
+        config_pending_size = size;
+        config_writer = SDL_CreateThread(config_writer_thread, NULL);
+        if (config_writer) {
+            return TRUE;
+        }
+        config_pending = NULL;
+    }
+    return write_config_file(config, size);
+}
+
 /**
  * Handles the writing of the configuration file
  *
@@ -122,6 +319,12 @@ void wii_config_handle_write_config(FILE* fp) {
     fprintf(fp, "use_overlay=%d\n", wii_use_overlay);
     fprintf(fp, "volume=%d\n", wii_volume);
     fprintf(fp, "max_frames=%d\n", wii_max_frames);
+    fprintf(fp, "audio_latency=%d\n", wii_audio_latency);
+    fprintf(fp, "frame_pacing=%d\n", wii_frame_pacing);
+    fprintf(fp, "audio_thread=%d\n", wii_audio_thread);
+    fprintf(fp, "rewind_size=%d\n", wii_rewind_size);
+    fprintf(fp, "run_ahead=%d\n", wii_run_ahead);
+    fprintf(fp, "hold_action=%d\n", wii_hold_action);
     fprintf(fp, "screen_size_x=%d\n", wii_screen_x);
     fprintf(fp, "screen_size_y=%d\n", wii_screen_y);
     fprintf(fp, "sel_offset=%d\n", wii_menu_sel_offset);
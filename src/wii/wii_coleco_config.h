@@ -0,0 +1,51 @@
+//---------------------------------------------------------------------------//
+//   __      __.__.___________        .__                                    //
+//  /  \    /  \__|__\_   ___ \  ____ |  |   ____   _____                    //
+//  \   \/\/   /  |  /    \  \/ /  _ \|  | _/ __ \ /     \                   //
+//   \        /|  |  \     \___(  <_> )  |_\  ___/|  Y Y  \                  //
+//    \__/\  / |__|__|\______  /\____/|____/\___  >__|_|  /                  //
+//         \/                \/                 \/      \/                   //
+//     WiiColem by raz0red                                                   //
+//     Port of the ColEm emulator by Marat Fayzullin                         //
+//                                                                           //
+//     [github.com/raz0red/wiicolem]                                         //
+//                                                                           //
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  Copyright (C) 2019 raz0red                                               //
+//                                                                           //
+//  The license for ColEm as indicated by Marat Fayzullin, the author of     //
+//  ColEm is detailed below:                                                 //
+//                                                                           //
+//  ColEm sources are available under three conditions:                      //
+//                                                                           //
+//  1) You are not using them for a commercial project.                      //
+//  2) You provide a proper reference to Marat Fayzullin as the author of    //
+//     the original source code.                                             //
+//  3) You provide a link to http://fms.komkon.org/ColEm/                    //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#ifndef WII_COLECO_CONFIG_H
+#define WII_COLECO_CONFIG_H
+
+#include "wii_util.h"
+
+/**
+ * Reads the configuration file, recovering it from the temporary file if a
+ * write was cut short, and remembers what it holds
+ */
+void wii_coleco_config_read();
+
+/**
+ * Writes the configuration file, if any value has changed since it was last
+ * read or written. The file is written to a temporary file and renamed over
+ * the configuration file, so a partial write never replaces it.
+ *
+ * @param   wait Whether to wait for the write (otherwise it is done by a
+ *          background thread)
+ * @return  Whether the configuration is (or is being) written
+ */
+BOOL wii_coleco_config_write(BOOL wait);
+
+#endif
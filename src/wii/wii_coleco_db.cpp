@@ -27,6 +27,12 @@
 //---------------------------------------------------------------------------//
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <SDL.h>
 
 #include "Coleco.h"
 
@@ -44,6 +50,7 @@
 #define DB_FILE_PATH WII_FILES_DIR "wiicolem.db"
 #define DB_TMP_FILE_PATH WII_FILES_DIR "wiicolem.db.tmp"
 #define DB_OLD_FILE_PATH WII_FILES_DIR "wiicolem.db.old"
+#define DB_LOG_FILE_PATH WII_FILES_DIR "wiicolem.db.log"
 
 /** The database file */
 static char db_file[WII_MAX_PATH] = "";
@@ -51,6 +58,97 @@ static char db_file[WII_MAX_PATH] = "";
 static char db_tmp_file[WII_MAX_PATH] = "";
 /** The database old file */
 static char db_old_file[WII_MAX_PATH] = "";
+/** The database log file, changes not yet folded into the database file */
+static char db_log_file[WII_MAX_PATH] = "";
+/** Serializes access to the database (the catalog scanner reads it too) */
+static SDL_mutex* db_mutex = NULL;
+
+/** Length of a cartridge hash (MD5 in hex) */
+#define DB_HASH_LENGTH 32
+/** Initial number of slots in the database index */
+#define DB_INDEX_INITIAL 256
+/** Size of the log past which it is folded into the database file */
+#define DB_LOG_COMPACT_SIZE (16 * 1024)
+/** Line closing a record in the log, a record without it is ignored */
+#define DB_LOG_END "#end"
+/** Line closing the deletion of a record in the log */
+#define DB_LOG_DELETED "#deleted"
+
+/** Where the current version of a record lives */
+enum {
+    RECORD_NONE = 0,  // Not in the database
+    RECORD_DB,        // In the database file
+    RECORD_LOG,       // In the log
+    RECORD_DELETED,   // Deleted in the log
+    RECORD_WRITTEN    // Already written out while compacting
+};
+
+/** Database index slot, maps a cartridge hash to its current record */
+typedef struct {
+    char hash[DB_HASH_LENGTH + 1];  // The hash ('\0' if the slot is empty)
+    u8 state;                       // Where the record lives (RECORD_DB...)
+    long offset;                    // Offset of the record's [hash] line
+} db_index_slot;
+
+/** Open addressing hash table of the records in the database */
+static db_index_slot* db_index = NULL;
+/** The number of slots in the index (power of two) */
+static int db_index_size = 0;
+/** The number of records in the index */
+static int db_index_count = 0;
+/** Whether the index matches the database file and the log */
+static BOOL db_index_valid = FALSE;
+/** Modification time of the database file when it was indexed */
+static time_t db_index_mtime = 0;
+/** Size of the database file when it was indexed */
+static off_t db_index_fsize = 0;
+/** Modification time of the log when it was indexed */
+static time_t db_log_mtime = 0;
+/** Size of the log when it was indexed */
+static off_t db_log_fsize = 0;
+
+/** Keys of database entry values */
+enum {
+    KEY_NONE = 0,
+    KEY_NAME,
+    KEY_CONTROLS_MODE,
+    KEY_WM_HORIZONTAL,
+    KEY_FLAGS,
+    KEY_EEPROM,
+    KEY_KEYPAD_PAUSE,
+    KEY_KEYPAD_SIZE,
+    KEY_SENSITIVITY,
+    KEY_CYCLE_ADJUST,
+    KEY_MAX_FRAMES,
+    KEY_OVERLAY_MODE,
+    KEY_SEL_KEY_W,
+    KEY_SEL_KEY_H,
+    KEY_OFF_X,
+    KEY_OFF_Y,
+    KEY_GAP_X,
+    KEY_GAP_Y,
+    KEY_SEL_KEY_RGBA,
+    KEY_OVERLAY,
+    KEY_BUTTON,  // "button<index>", MAPPED_BUTTON_COUNT keys
+    KEY_BUTTON_DESC = KEY_BUTTON + MAPPED_BUTTON_COUNT,  // "buttonDesc<value>"
+    KEY_COUNT = KEY_BUTTON_DESC + COLECO_BUTTON_NAME_COUNT
+};
+
+/** Size of the key lookup table (power of two, over twice KEY_COUNT) */
+#define KEY_TABLE_SIZE 128
+
+/** Names of the keys, the button ones are filled in by init_keys() */
+static const char* db_keys[KEY_COUNT] = {
+    NULL,          "name",        "controlsMode", "wmHorizontal",
+    "flags",       "eeprom",      "keypadPause",  "keypadSize",
+    "sensitivity", "cycleAdjust", "maxFrames",    "overlayMode",
+    "keypSelKeyW", "keypSelKeyH", "keypOffX",     "keypOffY",
+    "keypGapX",    "keypGapY",    "keypSelKeyRgba", "keypOverlay"
+};
+/** Storage for the names of the button keys */
+static char db_button_keys[KEY_COUNT - KEY_BUTTON][24];
+/** Key lookup table, holds key numbers (KEY_NONE if the slot is empty) */
+static u8 db_key_table[KEY_TABLE_SIZE];
 
 /**
  * Descriptions of the different Wii mappable buttons. 
@@ -147,6 +245,19 @@ static char* get_db_old_path() {
     return db_old_file;
 }
 
+/**
+ * Returns the path to the database log file
+ *
+ * @return  The path to the database log file
+ */
+static char* get_db_log_path() {
+    if (db_log_file[0] == '\0') {
+        snprintf(db_log_file, WII_MAX_PATH, "%s%s", wii_get_fs_prefix(),
+                 DB_LOG_FILE_PATH);
+    }
+    return db_log_file;
+}
+
 /**
  * Whether to pause the keypad if it is displayed
  *
@@ -209,6 +320,68 @@ void wii_coleco_db_get_defaults(ColecoDBEntry* entry, BOOL fullClear) {
     }
 }
 
+/**
+ * Returns the FNV-1a hash of the specified string
+ *
+ * @param   str The string
+ * @return  The hash of the string
+ */
+static u32 hash_string(const char* str) {
+    u32 hash = 2166136261u;
+    while (*str) {
+        hash = (hash ^ (u8)*str++) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Builds the key lookup table. The button key names are generated here once,
+ * rather than for every line read.
+ */
+static void init_keys() {
+    int i;
+    for (i = 0; i < MAPPED_BUTTON_COUNT; i++) {
+        snprintf(db_button_keys[i], sizeof(db_button_keys[i]), "button%d", i);
+        db_keys[KEY_BUTTON + i] = db_button_keys[i];
+    }
+    for (i = 0; i < COLECO_BUTTON_NAME_COUNT; i++) {
+        char* key = db_button_keys[MAPPED_BUTTON_COUNT + i];
+        snprintf(key, sizeof(db_button_keys[0]), "buttonDesc%d",
+                 ButtonNames[i].button);
+        db_keys[KEY_BUTTON_DESC + i] = key;
+    }
+
+    for (i = KEY_NONE + 1; i < KEY_COUNT; i++) {
+        u32 slot = hash_string(db_keys[i]) & (KEY_TABLE_SIZE - 1);
+        while (db_key_table[slot] != KEY_NONE) {
+            slot = (slot + 1) & (KEY_TABLE_SIZE - 1);
+        }
+        db_key_table[slot] = i;
+    }
+}
+
+/**
+ * Returns the key with the specified name
+ *
+ * @param   name The name of the key
+ * @return  The key (KEY_NONE if there is no such key)
+ */
+static int lookup_key(const char* name) {
+    if (db_keys[KEY_BUTTON] == NULL) {
+        init_keys();
+    }
+
+    u32 slot = hash_string(name) & (KEY_TABLE_SIZE - 1);
+    int key;
+    while ((key = db_key_table[slot]) != KEY_NONE) {
+        if (!strcmp(db_keys[key], name)) {
+            return key;
+        }
+        slot = (slot + 1) & (KEY_TABLE_SIZE - 1);
+    }
+    return KEY_NONE;
+}
+
 /**
  * Attempts to locate a hash in the specified source string. If it
  * is found, it is copied into dest.
@@ -400,24 +573,352 @@ static void write_entry(FILE* file, char* hash, ColecoDBEntry* entry) {
 }
 
 /**
- * Returns the database entry for the game with the specified hash
+ * Returns the index slot for the specified hash: either the slot holding it,
+ * or the empty slot it would go into.
  *
  * @param   hash The hash of the game
- * @param   entry The entry to populate for the specified game
+ * @return  The index slot for the hash
  */
-void wii_coleco_db_get_entry(char* hash, ColecoDBEntry* entry) {
+static db_index_slot* find_index_slot(const char* hash) {
+    u32 slot = hash_string(hash) & (db_index_size - 1);
+    while (db_index[slot].hash[0] != '\0' &&
+           strcmp(db_index[slot].hash, hash)) {
+        slot = (slot + 1) & (db_index_size - 1);
+    }
+    return &db_index[slot];
+}
+
+/**
+ * Adds a record to the database index. In the database file only the first
+ * record of a hash counts, the same one a scan of the file would find. In the
+ * log each record replaces the ones before it.
+ *
+ * @param   hash The hash of the record
+ * @param   state Where the record lives (RECORD_DB, RECORD_LOG, ...)
+ * @param   offset The offset of the record in its file
+ * @param   replace Whether to replace a record already in the index
+ * @return  Whether the record was added
+ */
+static BOOL add_index_slot(const char* hash, int state, long offset,
+                           BOOL replace) {
+    // Keep the index at most half full
+    if ((db_index_count + 1) * 2 > db_index_size) {
+        int old_size = db_index_size;
+        db_index_slot* old_index = db_index;
+        int size = old_size ? old_size * 2 : DB_INDEX_INITIAL;
+        db_index_slot* index =
+            (db_index_slot*)calloc(size, sizeof(db_index_slot));
+        if (!index) {
+            return FALSE;
+        }
+
+        db_index = index;
+        db_index_size = size;
+        for (int i = 0; i < old_size; i++) {
+            if (old_index[i].hash[0] != '\0') {
+                *find_index_slot(old_index[i].hash) = old_index[i];
+            }
+        }
+        free(old_index);
+    }
+
+    db_index_slot* slot = find_index_slot(hash);
+    if (slot->hash[0] == '\0') {
+        Util_strlcpy(slot->hash, hash, sizeof(slot->hash));
+        db_index_count++;
+    } else if (!replace) {
+        return TRUE;
+    }
+    slot->state = state;
+    slot->offset = offset;
+    return TRUE;
+}
+
+/**
+ * Returns the modification time and size of the specified file
+ *
+ * @param   path The path to the file
+ * @param   mtime The modification time (out, 0 if there is no file)
+ * @param   fsize The size (out, -1 if there is no file)
+ */
+static void get_file_stat(const char* path, time_t* mtime, off_t* fsize) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        *mtime = st.st_mtime;
+        *fsize = st.st_size;
+    } else {
+        *mtime = 0;
+        *fsize = -1;
+    }
+}
+
+/**
+ * Reads up to the end of the next record in the log. A record only counts
+ * once its closing line is in the file, so one cut short by a crash is
+ * skipped.
+ *
+ * @param   log_file The log file
+ * @param   hash The hash of the record (out)
+ * @param   offset The offset of the record's [hash] line (out)
+ * @return  RECORD_LOG or RECORD_DELETED (RECORD_NONE at the end of the log)
+ */
+static int next_log_record(FILE* log_file, char* hash, long* offset) {
+    char buff[255];     // The buffer to use when reading the file
+    char db_hash[255];  // A hash found in the file we are reading from
+
+    BOOL line_start = TRUE;
+    long line_offset = ftell(log_file);
+    hash[0] = '\0';
+    while (fgets(buff, sizeof(buff), log_file) != 0) {
+        if (line_start) {
+            if (get_hash(buff, db_hash)) {
+                if (strlen(db_hash) <= DB_HASH_LENGTH) {
+                    strcpy(hash, db_hash);
+                    *offset = line_offset;
+                } else {
+                    hash[0] = '\0';
+                }
+            } else if (hash[0] != '\0') {
+                if (!strncmp(buff, DB_LOG_END, strlen(DB_LOG_END))) {
+                    return RECORD_LOG;
+                }
+                if (!strncmp(buff, DB_LOG_DELETED, strlen(DB_LOG_DELETED))) {
+                    return RECORD_DELETED;
+                }
+            }
+        }
+        line_start = strchr(buff, '\n') != NULL;
+        line_offset = ftell(log_file);
+    }
+    return RECORD_NONE;
+}
+
+/**
+ * Makes sure the database index matches the database file and the log,
+ * rebuilding it with a single pass over both if either has changed.
+ *
+ * @param   db_file The open database file (NULL if there is none)
+ * @param   log_file The open log file (NULL if there is none)
+ * @return  Whether the index is valid
+ */
+static BOOL update_index(FILE* db_file, FILE* log_file) {
+    char buff[255];     // The buffer to use when reading the file
+    char db_hash[255];  // A hash found in the file we are reading from
+    time_t db_mtime, log_mtime;
+    off_t db_fsize, log_fsize;
+
+    get_file_stat(get_db_path(), &db_mtime, &db_fsize);
+    get_file_stat(get_db_log_path(), &log_mtime, &log_fsize);
+    if (db_index_valid && db_index_mtime == db_mtime &&
+        db_index_fsize == db_fsize && db_log_mtime == log_mtime &&
+        db_log_fsize == log_fsize) {
+        return TRUE;
+    }
+
+    // Start over
+    if (db_index) {
+        memset(db_index, 0, db_index_size * sizeof(db_index_slot));
+    }
+    db_index_count = 0;
+    db_index_valid = FALSE;
+
+    if (db_file) {
+        BOOL line_start = TRUE;
+        long offset = ftell(db_file);
+        while (fgets(buff, sizeof(buff), db_file) != 0) {
+            // Long lines are read in pieces, only look at their start
+            if (line_start && get_hash(buff, db_hash) &&
+                strlen(db_hash) <= DB_HASH_LENGTH) {
+                if (!add_index_slot(db_hash, RECORD_DB, offset, FALSE)) {
+                    return FALSE;
+                }
+            }
+            line_start = strchr(buff, '\n') != NULL;
+            offset = ftell(db_file);
+        }
+    }
+
+    if (log_file) {
+        char hash[DB_HASH_LENGTH + 1];
+        long offset;
+        int state;
+        while ((state = next_log_record(log_file, hash, &offset)) !=
+               RECORD_NONE) {
+            if (!add_index_slot(hash, state, offset, TRUE)) {
+                return FALSE;
+            }
+        }
+    }
+
+    db_index_valid = TRUE;
+    db_index_mtime = db_mtime;
+    db_index_fsize = db_fsize;
+    db_log_mtime = log_mtime;
+    db_log_fsize = log_fsize;
+    return TRUE;
+}
+
+/**
+ * Reads the values of a database record into the specified entry, up to the
+ * next record
+ *
+ * @param   db_file The database file, positioned past the [hash] line
+ * @param   entry The entry to populate
+ */
+static void read_entry(FILE* db_file, ColecoDBEntry* entry) {
     char buff[255];     // The buffer to use when reading the file
-    FILE* db_file;      // The database file
     char db_hash[255];  // A hash found in the file we are reading from
-    int read_mode = 0;  // The current read mode
     char* ptr;          // Pointer into the current entry value
+    int key;
+
+    while (fgets(buff, sizeof(buff), db_file) != 0) {
+        if (get_hash(buff, db_hash)) {
+            // We moved past the current record, exit.
+            break;
+        }
+
+        ptr = strchr(buff, '=');
+        if (!ptr) {
+            continue;
+        }
+        *ptr++ = '\0';
+        Util_trim(buff);
+        Util_trim(ptr);
+
+        switch (key = lookup_key(buff)) {
+            case KEY_NAME:
+                Util_strlcpy(entry->name, ptr, sizeof(entry->name));
+                break;
+            case KEY_CONTROLS_MODE:
+                entry->controlsMode = Util_sscandec(ptr);
+                break;
+            case KEY_WM_HORIZONTAL:
+                entry->wiiMoteHorizontal = Util_sscandec(ptr);
+                break;
+            case KEY_FLAGS:
+                entry->flags = Util_sscandec(ptr);
+                break;
+            case KEY_EEPROM:
+                entry->eeprom = Util_sscandec(ptr);
+                break;
+            case KEY_KEYPAD_PAUSE:
+                entry->keypadPause = Util_sscandec(ptr);
+                break;
+            case KEY_KEYPAD_SIZE:
+                entry->keypadSize = Util_sscandec(ptr);
+                break;
+            case KEY_SENSITIVITY:
+                entry->sensitivity = Util_sscandec(ptr);
+                break;
+            case KEY_CYCLE_ADJUST:
+                entry->cycleAdjust = Util_sscandec(ptr);
+                break;
+            case KEY_MAX_FRAMES:
+                entry->maxFrames = Util_sscandec(ptr);
+                break;
+            case KEY_OVERLAY_MODE:
+                entry->overlayMode = Util_sscandec(ptr);
+                break;
+            case KEY_SEL_KEY_W:
+                entry->overlay.keypSelKeyW = Util_sscandec(ptr);
+                break;
+            case KEY_SEL_KEY_H:
+                entry->overlay.keypSelKeyH = Util_sscandec(ptr);
+                break;
+            case KEY_OFF_X:
+                entry->overlay.keypOffX = Util_sscandec(ptr);
+                break;
+            case KEY_OFF_Y:
+                entry->overlay.keypOffY = Util_sscandec(ptr);
+                break;
+            case KEY_GAP_X:
+                entry->overlay.keypGapX = Util_sscandec(ptr);
+                break;
+            case KEY_GAP_Y:
+                entry->overlay.keypGapY = Util_sscandec(ptr);
+                break;
+            case KEY_SEL_KEY_RGBA:
+                Util_hextorgba(ptr, &(entry->overlay.keypSelKeyRgba));
+                break;
+            case KEY_OVERLAY:
+                Util_strlcpy(entry->overlay.keypOverlay, ptr,
+                             sizeof(entry->overlay.keypOverlay));
+                break;
+            default:
+                if (key >= KEY_BUTTON_DESC) {
+                    int i = key - KEY_BUTTON_DESC;
+                    Util_strlcpy(entry->buttonDesc[i], ptr,
+                                 sizeof(entry->buttonDesc[i]));
+                } else if (key >= KEY_BUTTON) {
+                    entry->button[key - KEY_BUTTON] = Util_sscandec(ptr);
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * Restores the database file from the old file if a compaction was cut short
+ * between its two renames. The log still holds every change made since.
+ */
+static void recover_db() {
+    struct stat st;
+    if (stat(get_db_path(), &st) != 0 && stat(get_db_old_path(), &st) == 0 &&
+        stat(get_db_tmp_path(), &st) == 0) {
+        rename(get_db_old_path(), get_db_path());
+    }
+}
+
+/**
+ * Creates the lock serializing access to the database. Must be called before
+ * the database is used from more than one thread.
+ */
+void wii_coleco_db_init() {
+    if (!db_mutex) {
+        db_mutex = SDL_CreateMutex();
+    }
+}
+
+/**
+ * Locks the database
+ */
+static void lock_db() {
+    if (db_mutex) {
+        SDL_LockMutex(db_mutex);
+    }
+}
+
+/**
+ * Unlocks the database
+ */
+static void unlock_db() {
+    if (db_mutex) {
+        SDL_UnlockMutex(db_mutex);
+    }
+}
+
+/**
+ * Reads the database entry for the game with the specified hash, with the
+ * database locked
+ *
+ * @param   hash The hash of the game
+ * @param   entry The entry to populate for the specified game
+ */
+static void read_db_entry(const char* hash, ColecoDBEntry* entry) {
+    char buff[255];     // The buffer to use when reading the file
+    char db_hash[255];  // A hash found in the file we are reading from
+    FILE* db_file;      // The database file
+    FILE* log_file;     // The database log file
+    FILE* file = 0;     // The file holding the record
 
     // Populate the entry with the defaults
     memset(entry, 0x0, sizeof(ColecoDBEntry));
     entry->controlsMode = CONTROLS_MODE_STANDARD;
     wii_coleco_db_get_defaults(entry, TRUE);
 
+    recover_db();
     db_file = fopen(get_db_path(), "r");
+    log_file = fopen(get_db_log_path(), "r");
 
 #ifdef WII_NETTRACE
     char val[256];
@@ -425,205 +926,324 @@ void wii_coleco_db_get_entry(char* hash, ColecoDBEntry* entry) {
     net_print_string(__FILE__, __LINE__, val);
 #endif
 
-    if (db_file != 0) {
-        while (fgets(buff, sizeof(buff), db_file) != 0) {
-            if (read_mode == 2) {
-                // We moved past the current record, exit.
-                break;
+    if (update_index(db_file, log_file)) {
+        db_index_slot* slot =
+            db_index_count > 0 ? find_index_slot(hash) : NULL;
+        if (slot && slot->hash[0] != '\0') {
+            if (slot->state == RECORD_DB) {
+                file = db_file;
+            } else if (slot->state == RECORD_LOG) {
+                file = log_file;
             }
-            if (read_mode == 1) {
-                // Read from the matching database entry
-                ptr = strchr(buff, '=');
-                if (ptr) {
-                    *ptr++ = '\0';
-                    Util_trim(buff);
-                    Util_trim(ptr);
-
-                    if (!strcmp(buff, "name")) {
-                        Util_strlcpy(entry->name, ptr, sizeof(entry->name));
-                    } else if (!strcmp(buff, "controlsMode")) {
-                        entry->controlsMode = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "wmHorizontal")) {
-                        entry->wiiMoteHorizontal = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "flags")) {
-                        entry->flags = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "eeprom")) {
-                        entry->eeprom = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypadPause")) {
-                        entry->keypadPause = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypadSize")) {
-                        entry->keypadSize = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "sensitivity")) {
-                        entry->sensitivity = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "cycleAdjust")) {
-                        entry->cycleAdjust = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "maxFrames")) {
-                        entry->maxFrames = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "overlayMode")) {
-                        entry->overlayMode = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypSelKeyW")) {
-                        entry->overlay.keypSelKeyW = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypSelKeyH")) {
-                        entry->overlay.keypSelKeyH = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypOffX")) {
-                        entry->overlay.keypOffX = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypOffY")) {
-                        entry->overlay.keypOffY = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypGapX")) {
-                        entry->overlay.keypGapX = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypGapY")) {
-                        entry->overlay.keypGapY = Util_sscandec(ptr);
-                    } else if (!strcmp(buff, "keypSelKeyRgba")) {
-                        Util_hextorgba(ptr, &(entry->overlay.keypSelKeyRgba));
-                    } else if (!strcmp(buff, "keypOverlay")) {
-                        Util_strlcpy(entry->overlay.keypOverlay, ptr,
-                                     sizeof(entry->overlay.keypOverlay));
-                    }
+        }
 
-                    int i;
-                    char button[255];
-                    for (i = 0; i < MAPPED_BUTTON_COUNT; i++) {
-                        snprintf(button, sizeof(button), "button%d", i);
-                        if (!strcmp(buff, button)) {
-                            entry->button[i] = Util_sscandec(ptr);
-                        }
-                    }
-                    for (i = 0; i < COLECO_BUTTON_NAME_COUNT; i++) {
-                        snprintf(button, sizeof(button), "buttonDesc%d",
-                                 ButtonNames[i].button);
-                        if (!strcmp(buff, button)) {
-                            Util_strlcpy(entry->buttonDesc[i], ptr,
-                                         sizeof(entry->buttonDesc[i]));
-                        }
-                    }
+        // Jump straight to the record, skipping its [hash] line
+        if (file && fseek(file, slot->offset, SEEK_SET) == 0 &&
+            fgets(buff, sizeof(buff), file) != 0) {
+            entry->loaded = 1;
+            read_entry(file, entry);
+        }
+    } else {
+        // No index (out of memory), search the log for the latest record
+        int state = RECORD_NONE;
+        long offset = 0;
+        if (log_file && fseek(log_file, 0, SEEK_SET) == 0) {
+            char log_hash[DB_HASH_LENGTH + 1];
+            long log_offset;
+            int log_state;
+            while ((log_state = next_log_record(log_file, log_hash,
+                                                &log_offset)) != RECORD_NONE) {
+                if (!strcmp(hash, log_hash)) {
+                    state = log_state;
+                    offset = log_offset;
                 }
             }
+        }
 
-            // Search for the hash
-            if (get_hash(buff, db_hash) && read_mode < 2) {
-                if (read_mode || !strcmp(hash, db_hash)) {
+        if (state == RECORD_LOG) {
+            if (fseek(log_file, offset, SEEK_SET) == 0 &&
+                fgets(buff, sizeof(buff), log_file) != 0) {
+                entry->loaded = 1;
+                read_entry(log_file, entry);
+            }
+        } else if (state == RECORD_NONE && db_file &&
+                   fseek(db_file, 0, SEEK_SET) == 0) {
+            // Then search the database file for the hash
+            while (fgets(buff, sizeof(buff), db_file) != 0) {
+                if (get_hash(buff, db_hash) && !strcmp(hash, db_hash)) {
                     entry->loaded = 1;
-                    read_mode++;
+                    read_entry(db_file, entry);
+                    break;
                 }
             }
         }
+    }
+
+    if (db_file) {
         fclose(db_file);
     }
+    if (log_file) {
+        fclose(log_file);
+    }
 }
 
 /**
- * Deletes the entry from the database with the specified hash
+ * Returns the database entry for the game with the specified hash
  *
  * @param   hash The hash of the game
- * @return  Whether the delete was successful
+ * @param   entry The entry to populate for the specified game
  */
-int wii_coleco_db_delete_entry(char* hash) {
-    return wii_coleco_db_write_entry(hash, 0);
+void wii_coleco_db_get_entry(char* hash, ColecoDBEntry* entry) {
+    lock_db();
+    read_db_entry(hash, entry);
+    unlock_db();
 }
 
 /**
- * Writes the specified entry to the database for the game with the specified
- * hash.
+ * Copies a record from the log to the specified file, leaving out its
+ * closing line
  *
- * @param   hash The hash of the game
- * @param   entryThe entry to write to the database (null to delete the entry)
- * @return  Whether the write was successful
+ * @param   log_file The log file
+ * @param   offset The offset of the record's [hash] line
+ * @param   file The file to copy the record to
  */
-int wii_coleco_db_write_entry(char* hash, ColecoDBEntry* entry) {
+static void copy_record(FILE* log_file, long offset, FILE* file) {
+    char buff[255];  // The buffer to use when reading the file
+
+    if (fseek(log_file, offset, SEEK_SET) != 0 ||
+        fgets(buff, sizeof(buff), log_file) == 0) {
+        return;
+    }
+    fputs(buff, file);
+
+    BOOL line_start = strchr(buff, '\n') != NULL;
+    while (fgets(buff, sizeof(buff), log_file) != 0) {
+        if (line_start && !strncmp(buff, DB_LOG_END, strlen(DB_LOG_END))) {
+            break;
+        }
+        fputs(buff, file);
+        line_start = strchr(buff, '\n') != NULL;
+    }
+}
+
+/**
+ * Folds the log into the database file, with the database locked. The new
+ * database file is written to the temp file and swapped in through the old
+ * file, then the log is removed. Should that last step fail, replaying the
+ * log changes nothing.
+ *
+ * @return  Whether the compaction was successful
+ */
+static int compact_db() {
     char buff[255];      // The buffer to use when reading the file
     char db_hash[255];   // A hash found in the file we are reading from
-    int copy_mode = 0;   // The current copy mode
     FILE* tmp_file = 0;  // The temp file
     FILE* old_file = 0;  // The old file
 
-    // The database file
-    FILE* db_file = fopen(get_db_path(), "r");
-
-    // A database file doesn't exist, create a new one
-    if (!db_file) {
-        db_file = fopen(get_db_path(), "w");
-        if (!db_file) {
-            // Unable to create DB file
-            return 0;
-        }
+    recover_db();
 
-        // Write the entry
-        write_entry(db_file, hash, entry);
+    FILE* log_file = fopen(get_db_log_path(), "r");
+    if (!log_file) {
+        // Nothing to compact
+        return 1;
+    }
+    FILE* db_file = fopen(get_db_path(), "r");
 
-        fclose(db_file);
-    } else {
-        //
-        // A database exists, search for the appropriate hash while copying
-        // its current contents to a temp file
-        //
-
-        // Open up the temp file
-        tmp_file = fopen(get_db_tmp_path(), "w");
-        if (!tmp_file) {
+    if (!update_index(db_file, log_file) ||
+        !(tmp_file = fopen(get_db_tmp_path(), "w"))) {
+        if (db_file) {
             fclose(db_file);
-
-            // Unable to create temp file
-            return 0;
         }
+        fclose(log_file);
+        return 0;
+    }
+
+    // The slots are updated below as records are written out
+    db_index_valid = FALSE;
 
-        //
-        // Loop and copy
-        //
+    //
+    // Copy the database file, writing records changed in the log in place
+    // of the originals
+    //
 
+    if (db_file && fseek(db_file, 0, SEEK_SET) == 0) {
+        BOOL line_start = TRUE;
+        BOOL copy = TRUE;
+        long offset = 0;
         while (fgets(buff, sizeof(buff), db_file) != 0) {
-            // Check if we found a hash
-            if (copy_mode < 2 && get_hash(buff, db_hash)) {
-                if (copy_mode) {
-                    copy_mode++;
-                } else if (!strcmp(hash, db_hash)) {
-                    // We have matching hashes, write out the new entry
-                    write_entry(tmp_file, hash, entry);
-                    copy_mode++;
+            if (line_start && get_hash(buff, db_hash)) {
+                if (strlen(db_hash) <= DB_HASH_LENGTH) {
+                    db_index_slot* slot = find_index_slot(db_hash);
+                    copy = slot->state == RECORD_DB && slot->offset == offset;
+                    if (slot->state == RECORD_LOG) {
+                        copy_record(log_file, slot->offset, tmp_file);
+                        slot->state = RECORD_WRITTEN;
+                    }
+                } else {
+                    copy = TRUE;
                 }
             }
-
-            if (copy_mode != 1) {
-                fprintf(tmp_file, "%s", buff);
+            if (copy) {
+                fputs(buff, tmp_file);
             }
+            line_start = strchr(buff, '\n') != NULL;
+            offset = ftell(db_file);
         }
+    }
+
+    //
+    // Add the records that are new, in the order they were saved
+    //
 
-        if (!copy_mode) {
-            // We didn't find the hash in the database, add it
-            write_entry(tmp_file, hash, entry);
+    if (fseek(log_file, 0, SEEK_SET) == 0) {
+        char hash[DB_HASH_LENGTH + 1];
+        long offset;
+        while (next_log_record(log_file, hash, &offset) != RECORD_NONE) {
+            db_index_slot* slot = find_index_slot(hash);
+            if (slot->state == RECORD_LOG && slot->offset == offset) {
+                long next = ftell(log_file);
+                copy_record(log_file, offset, tmp_file);
+                fseek(log_file, next, SEEK_SET);
+            }
         }
+    }
 
+    BOOL exists = db_file != 0;
+    if (db_file) {
         fclose(db_file);
-        fclose(tmp_file);
-
-        //
-        // Make sure the temporary file exists
-        // We do this due to the instability of the Wii SD card
-        //
-        tmp_file = fopen(get_db_tmp_path(), "r");
-        if (!tmp_file) {
-            // Unable to find temp file
-            return 0;
-        }
-        fclose(tmp_file);
+    }
+    fclose(log_file);
+    BOOL written = !ferror(tmp_file);
+    if (fclose(tmp_file) != 0 || !written) {
+        return 0;
+    }
 
-        // Delete old file (if it exists)
-        if ((old_file = fopen(get_db_old_path(), "r")) != 0) {
-            fclose(old_file);
-            if (remove(get_db_old_path()) != 0) {
-                return 0;
-            }
-        }
+    //
+    // Make sure the temporary file exists
+    // We do this due to the instability of the Wii SD card
+    //
+    tmp_file = fopen(get_db_tmp_path(), "r");
+    if (!tmp_file) {
+        // Unable to find temp file
+        return 0;
+    }
+    fclose(tmp_file);
 
-        // Rename database file to old file
-        if (rename(get_db_path(), get_db_old_path()) != 0) {
+    // Delete old file (if it exists)
+    if ((old_file = fopen(get_db_old_path(), "r")) != 0) {
+        fclose(old_file);
+        if (remove(get_db_old_path()) != 0) {
             return 0;
         }
+    }
 
-        // Rename temp file to database file
-        if (rename(get_db_tmp_path(), get_db_path()) != 0) {
-            return 0;
-        }
+    // Rename database file to old file
+    if (exists && rename(get_db_path(), get_db_old_path()) != 0) {
+        return 0;
+    }
+
+    // Rename temp file to database file
+    if (rename(get_db_tmp_path(), get_db_path()) != 0) {
+        return 0;
+    }
+
+    // The database file now holds everything in the log
+    return remove(get_db_log_path()) == 0;
+}
+
+/**
+ * Folds the log of saved and deleted entries into the database file
+ *
+ * @return  Whether the compaction was successful
+ */
+int wii_coleco_db_compact() {
+    lock_db();
+    int result = compact_db();
+    unlock_db();
+    return result;
+}
+
+/**
+ * Deletes the entry from the database with the specified hash
+ *
+ * @param   hash The hash of the game
+ * @return  Whether the delete was successful
+ */
+int wii_coleco_db_delete_entry(char* hash) {
+    return wii_coleco_db_write_entry(hash, 0);
+}
+
+/**
+ * Appends the specified entry to the log, with the database locked. The log
+ * is folded into the database file once it grows past DB_LOG_COMPACT_SIZE.
+ *
+ * @param   hash The hash of the game
+ * @param   entry The entry to write to the database (null to delete the entry)
+ * @return  Whether the write was successful
+ */
+static int append_entry(char* hash, ColecoDBEntry* entry) {
+    time_t mtime;
+    off_t fsize;
+
+    // Whether the index can be updated in place rather than rebuilt
+    BOOL keep_index = db_index_valid;
+    if (keep_index) {
+        get_file_stat(get_db_log_path(), &mtime, &fsize);
+        keep_index = mtime == db_log_mtime && fsize == db_log_fsize;
+    }
+    db_index_valid = FALSE;
+
+    FILE* log_file = fopen(get_db_log_path(), "a");
+    if (!log_file) {
+        // Unable to open the log file
+        return 0;
+    }
+
+    // Start on a line of its own, in case a crash cut the last record short
+    fseek(log_file, 0, SEEK_END);
+    long offset = ftell(log_file) + 1;
+    fprintf(log_file, "\n");
+
+    if (entry) {
+        write_entry(log_file, hash, entry);
+        fprintf(log_file, "%s\n", DB_LOG_END);
+    } else {
+        fprintf(log_file, "[%s]\n%s\n", hash, DB_LOG_DELETED);
+    }
+
+    BOOL written = !ferror(log_file);
+    if (fclose(log_file) != 0 || !written) {
+        return 0;
+    }
+
+    get_file_stat(get_db_log_path(), &mtime, &fsize);
+    if (keep_index && strlen(hash) <= DB_HASH_LENGTH &&
+        add_index_slot(hash, entry ? RECORD_LOG : RECORD_DELETED, offset,
+                       TRUE)) {
+        db_index_valid = TRUE;
+        db_log_mtime = mtime;
+        db_log_fsize = fsize;
+    }
+
+    // The entry is safe in the log, a failed compaction is retried later
+    if (fsize > DB_LOG_COMPACT_SIZE) {
+        compact_db();
     }
 
     return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * Writes the specified entry to the database for the game with the specified
+ * hash. Only the entry is written, it is appended to the log.
+ *
+ * @param   hash The hash of the game
+ * @param   entry The entry to write to the database (null to delete the entry)
+ * @return  Whether the write was successful
+ */
+int wii_coleco_db_write_entry(char* hash, ColecoDBEntry* entry) {
+    lock_db();
+    int result = append_entry(hash, entry);
+    unlock_db();
+    return result;
+}
@@ -169,6 +169,12 @@ void wii_coleco_db_get_button_name(char* buff,
  */
 int wii_coleco_db_get_button_index(u32 value);
 
+/**
+ * Creates the lock serializing access to the database. Must be called before
+ * the database is used from more than one thread.
+ */
+void wii_coleco_db_init();
+
 /**
  * Returns the database entry for the game with the specified hash
  *
@@ -195,6 +201,13 @@ int wii_coleco_db_write_entry(char* hash, ColecoDBEntry* entry);
  */
 int wii_coleco_db_delete_entry(char* hash);
 
+/**
+ * Folds the log of saved and deleted entries into the database file
+ *
+ * @return  Whether the compaction was successful
+ */
+int wii_coleco_db_compact();
+
 /**
  * Populates the specified entry with default values. The default values
  * are based on the "controlsMode" in the specified entry.
@@ -29,6 +29,7 @@
 #include <wiiuse/wpad.h>
 
 #include "Coleco.h"
+#include "Rewind.h"
 #include "Sound.h"
 
 #include "wii_app_common.h"
@@ -40,6 +41,7 @@
 #include "wii_snapshot.h"
 
 #include "wii_coleco.h"
+#include "wii_coleco_config.h"
 #include "wii_coleco_keypad.h"
 #include "wii_coleco_snapshot.h"
 
@@ -49,6 +51,10 @@ extern int MasterSwitch;
 /** Reset cycle timing extern form ColEm */
 extern void ResetCycleTiming(void);
 
+/** Audio thread externs from ColEm */
+extern void StartAudioThread(void);
+extern void StopAudioThread(void);
+
 /** SDL Video external references */
 extern "C" {
 void WII_VideoStop();
@@ -89,13 +95,18 @@ BOOL wii_start_emulation(char* romfile,
                          const char* savefile,
                          BOOL reset,
                          BOOL resume) {
-    // Write out the current config
-    wii_write_config();
+    // Write out the current config (if it has changed), without holding up
+    // the start of the game
+    wii_coleco_config_write(FALSE);
 
     // Whether emulation successfully started
     BOOL succeeded = TRUE;
     BOOL loadsave = FALSE;
 
+    // Resets and state loads set up sound channels, which the audio thread
+    // may be rendering with
+    StopAudioThread();
+
     // Start emulation
     if (!reset && !resume) {
         // Whether to load a save file
@@ -132,6 +143,8 @@ BOOL wii_start_emulation(char* romfile,
 
             // Attempt to load the save file if applicable
             if (loadsave) {
+                // The save may still be being written in the background
+                wii_snapshot_flush();
                 // Ensure the save is valid
                 int sscheck = wii_check_snapshot(savefile);
                 if (sscheck < 0) {
@@ -160,6 +173,11 @@ BOOL wii_start_emulation(char* romfile,
         Mode = get_coleco_mode();
     }
 
+    // Rewind history does not carry over into a new or reset game
+    if (!resume) {
+        RWDReset();
+    }
+
     if (succeeded) {
         // Store the name of the last rom (for resuming later)
         // Do it in this order in case they passed in the pointer
@@ -190,6 +208,9 @@ BOOL wii_start_emulation(char* romfile,
         CPU.IPeriod = (Mode & CV_PAL ? TMS9929_LINE : TMS9918_LINE) +
                       (wii_coleco_db_entry.cycleAdjust) /*-23*/;
 
+        // Frames to run ahead of input
+        AheadFrames = wii_run_ahead;
+
         // Reset cycle timing information
         ResetCycleTiming();
 
@@ -220,6 +241,11 @@ BOOL wii_start_emulation(char* romfile,
             free(old_last);            
         }
     }
+
+    // Synthesize audio off the emulation thread again
+    if (wii_audio_thread) {
+        StartAudioThread();
+    }
     return succeeded;
 }
 
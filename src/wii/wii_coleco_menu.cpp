@@ -28,6 +28,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #include "Coleco.h"
 
@@ -42,7 +44,9 @@
 #include "networkop.h"
 
 #include "wii_coleco.h"
+#include "wii_coleco_catalog.h"
 #include "wii_coleco_emulation.h"
+#include "wii_coleco_romlist.h"
 #include "wii_coleco_snapshot.h"
 
 #include "gettext.h"
@@ -69,12 +73,55 @@ static BOOL games_read = FALSE;
 static BOOL mount_pending = TRUE;
 /** The index of the last rom that was run */
 static s16 last_rom_index = 1;
+/** The directory that was left for its parent, selected in the parent */
+static char last_dir_name[WII_MAX_PATH] = "";
 /** The roms menu */
 static TREENODE* roms_menu;
 
+/** A rom of the games list, with the name it is shown by */
+typedef struct {
+    const char* file;  // The file name of the rom
+    char name[255];    // The name of the game, or the file name
+} game_item;
+
 /** Forward refs */
 static void wii_read_game_list(TREENODE* menu);
 
+/**
+ * Returns the name of the game in the specified rom file of the roms
+ * directory, once the scanner has found it
+ *
+ * @param   file The file name of the rom
+ * @param   buffer The buffer to receive the name of the game
+ * @param   size The size of the buffer
+ * @return  Whether the name of the game is known
+ */
+static BOOL get_game_name(const char* file, char* buffer, size_t size) {
+    char path[WII_MAX_PATH];
+    ColecoCatalogEntry entry;
+    snprintf(path, sizeof(path), "%s%s", wii_get_roms_dir(), file);
+    if (!wii_catalog_get_entry(path, &entry) || entry.name[0] == '\0') {
+        return FALSE;
+    }
+    snprintf(buffer, size, "%s", entry.name);
+    return TRUE;
+}
+
+/**
+ * Used for comparing roms when sorting (qsort), by the names they are shown
+ * by. Roms shown by the same name are ordered by file name.
+ *
+ * @param   a The first rom to compare
+ * @param   b The second rom to compare
+ * @return  The result of the comparison
+ */
+static int compare_games(const void* a, const void* b) {
+    const game_item* aptr = (const game_item*)a;
+    const game_item* bptr = (const game_item*)b;
+    int result = strcasecmp(aptr->name, bptr->name);
+    return result != 0 ? result : strcmp(aptr->file, bptr->file);
+}
+
 /**
  * Returns the space node type
  *
@@ -263,6 +310,12 @@ void wii_coleco_menu_init() {
     wii_add_child(display, child);
 #endif    
 
+    child = wii_create_tree_node(NODETYPE_FRAME_PACING, "Frame pacing");
+    wii_add_child(display, child);
+
+    child = wii_create_tree_node(NODETYPE_RUN_AHEAD, "Run-ahead");
+    wii_add_child(display, child);
+
     child = wii_create_tree_node(NODETYPE_MAX_FRAMES, "Maximum frame rate");
     wii_add_child(display, child);
 
@@ -321,6 +374,9 @@ void wii_coleco_menu_init() {
         wii_create_tree_node(NODETYPE_WIIMOTE_MENU_ORIENT, "Wiimote (menu)");
     wii_add_child(advanced, child);
 
+    child = wii_create_tree_node(NODETYPE_HOLD_ACTION, "Hold minus button");
+    wii_add_child(advanced, child);
+
     child = wii_create_tree_node(NODETYPE_SPACER, "");
     wii_add_child(advanced, child);
 
@@ -413,11 +469,22 @@ void wii_menu_handle_get_node_name(TREENODE* node, char* buffer, char* value) {
         case NODETYPE_DIR:
             snprintf(buffer, WII_MENU_BUFF_SIZE, "[%s]", node->name);
             break;
+        case NODETYPE_ROM:
+            // Show the name of the game once the scanner has found it
+            get_game_name(node->name, buffer, WII_MENU_BUFF_SIZE);
+            break;
         case NODETYPE_CARTRIDGE_SAVE_STATES_SLOT: {
             BOOL isLatest;
             int current = wii_snapshot_current_index(&isLatest);
             current++;
-            if (!isLatest) {
+            int status = wii_snapshot_write_status();
+            if (status == SNAPSHOT_WRITE_PENDING) {
+                snprintf(value, WII_MENU_BUFF_SIZE, "%d (%s)", current,
+                         gettextmsg("Saving..."));
+            } else if (status == SNAPSHOT_WRITE_FAILED) {
+                snprintf(value, WII_MENU_BUFF_SIZE, "%d (%s)", current,
+                         gettextmsg("Save failed"));
+            } else if (!isLatest) {
                 snprintf(value, WII_MENU_BUFF_SIZE, "%d", current);
             } else {
                 snprintf(value, WII_MENU_BUFF_SIZE, "%d (%s)", current,
@@ -439,6 +506,25 @@ void wii_menu_handle_get_node_name(TREENODE* node, char* buffer, char* value) {
             snprintf(value, WII_MENU_BUFF_SIZE, "%s",
                      (wii_gx_vi_scaler ? "GX + VI" : "GX"));
             break;
+        case NODETYPE_FRAME_PACING:
+            snprintf(value, WII_MENU_BUFF_SIZE, "%s",
+                     (wii_frame_pacing == FRAME_PACING_AUDIO ? "Audio clock"
+                                                             : "Timer"));
+            break;
+        case NODETYPE_HOLD_ACTION:
+            snprintf(value, WII_MENU_BUFF_SIZE, "%s",
+                     (wii_hold_action == HOLD_ACTION_FAST_FORWARD
+                          ? "Fast-forward"
+                          : "Rewind"));
+            break;
+        case NODETYPE_RUN_AHEAD:
+            if (wii_run_ahead == 0) {
+                snprintf(value, WII_MENU_BUFF_SIZE, "Disabled");
+            } else {
+                snprintf(value, WII_MENU_BUFF_SIZE, "%d frame%s",
+                         wii_run_ahead, (wii_run_ahead > 1 ? "s" : ""));
+            }
+            break;
         case NODETYPE_16_9_CORRECTION:
         case NODETYPE_FULL_WIDESCREEN: {
             int val = node->node_type == NODETYPE_16_9_CORRECTION
@@ -779,6 +865,7 @@ void wii_menu_handle_select_node(TREENODE* node) {
                 wii_save_snapshot(NULL, TRUE);
                 break;
             case NODETYPE_DELETE_STATE:
+                wii_snapshot_flush();
                 wii_delete_snapshot();
                 wii_snapshot_refresh();
                 break;
@@ -853,6 +940,18 @@ void wii_menu_handle_select_node(TREENODE* node) {
             case NODETYPE_GX_VI_SCALER:
                 wii_gx_vi_scaler ^= 1;
                 break;
+            case NODETYPE_FRAME_PACING:
+                wii_frame_pacing ^= 1;
+                break;
+            case NODETYPE_HOLD_ACTION:
+                wii_hold_action ^= 1;
+                break;
+            case NODETYPE_RUN_AHEAD:
+                ++wii_run_ahead;
+                if (wii_run_ahead > RUN_AHEAD_MAX) {
+                    wii_run_ahead = 0;
+                }
+                break;
             case NODETYPE_TRAP_FILTER:
                 wii_trap_filter ^= 1;
                 break;
@@ -883,6 +982,8 @@ void wii_menu_handle_select_node(TREENODE* node) {
                         char dirpart[WII_MAX_PATH] = "";
                         char filepart[WII_MAX_PATH] = "";
                         Util_splitpath(romsDir, dirpart, filepart);
+                        Util_strlcpy(last_dir_name, filepart,
+                                     sizeof(last_dir_name));
                         len = strlen(dirpart);
                         if (len > 0) {
                             dirpart[len] = '/';
@@ -981,6 +1082,8 @@ void wii_menu_handle_select_node(TREENODE* node) {
                 if (wii_coleco_db_write_entry(wii_cartridge_hash,
                                               &wii_coleco_db_entry)) {
                     wii_coleco_db_entry.loaded = 1;
+                    wii_catalog_set_name(wii_cartridge_hash,
+                                         wii_coleco_db_entry.name);
                     wii_set_status_message(
                         "Successfully saved cartridge settings.");
                 } else {
@@ -990,6 +1093,7 @@ void wii_menu_handle_select_node(TREENODE* node) {
                 break;
             case NODETYPE_DELETE_CARTRIDGE_SETTINGS:
                 if (wii_coleco_db_delete_entry(wii_cartridge_hash)) {
+                    wii_catalog_set_name(wii_cartridge_hash, "");
                     wii_menu_reset_indexes();
                     wii_menu_move(wii_menu_stack[wii_menu_stack_head], 1);
                     wii_set_status_message(
@@ -1138,7 +1242,13 @@ void wii_menu_handle_update(TREENODE* menu) {
                 }
                 wii_read_game_list(roms_menu);
                 wii_menu_reset_indexes();
-                wii_menu_move(roms_menu, 1);
+
+                // Select the directory we came up from (after "[..]")
+                int index = last_dir_name[0] != '\0'
+                                ? wii_romlist_find(last_dir_name, TRUE)
+                                : -1;
+                wii_menu_move(roms_menu, index >= 0 ? index + 1 : 1);
+                last_dir_name[0] = '\0';
 
                 UNLOCK_RENDER_MUTEX();
             }
@@ -1150,21 +1260,11 @@ void wii_menu_handle_update(TREENODE* menu) {
 }
 
 /**
- * Used for comparing menu names when sorting (qsort)
- *
- * @param   a The first tree node to compare
- * @param   b The second tree node to compare
- * @return  The result of the comparison
- */
-static int game_name_compare(const void* a, const void* b) {
-    TREENODE** aptr = (TREENODE**)a;
-    TREENODE** bptr = (TREENODE**)b;
-    int type = (*aptr)->node_type - (*bptr)->node_type;
-    return type != 0 ? type : strcasecmp((*aptr)->name, (*bptr)->name);
-}
-
-/**
- * Reads the list of games into the specified menu
+ * Reads the list of games into the specified menu. The listing comes from
+ * the directory listing cache, already sorted. Directories keep that order,
+ * roms are sorted by the names they are shown by. Names the scanner finds
+ * later take effect the next time the list is read, so that roms do not
+ * move under the cursor.
  *
  * @param   menu The menu to read the games into
  */
@@ -1179,33 +1279,50 @@ static void wii_read_game_list(TREENODE* menu) {
 
     BOOL success = FALSE;
     if (strlen(roms) > 0) {
-        DIR* romdir = opendir(roms);
+        BOOL read = wii_romlist_read(roms);
 
 #ifdef WII_NETTRACE
-        net_print_string(NULL, 0, "OpenDir: %d\n", roms, romdir);
+        net_print_string(NULL, 0, "ReadDir: %d\n", roms, read);
 #endif
 
-        if (romdir != NULL) {
+        if (read) {
             wii_add_child(menu, wii_create_tree_node(NODETYPE_UPDIR, "[..]"));
 
-            struct dirent* entry = NULL;
-            while ((entry = readdir(romdir)) != NULL) {
-                if ((strcmp(".", entry->d_name) &&
-                     strcmp("..", entry->d_name))) {
-                    TREENODE* child = wii_create_tree_node(
-                        (entry->d_type == DT_DIR ? NODETYPE_DIR : NODETYPE_ROM),
-                        entry->d_name);
+            // Directories come first in the listing
+            int count = wii_romlist_count();
+            int dirs = 0;
+            while (dirs < count && wii_romlist_is_dir(dirs)) {
+                wii_add_child(menu, wii_create_tree_node(
+                                        NODETYPE_DIR, wii_romlist_name(dirs)));
+                dirs++;
+            }
 
-                    wii_add_child(menu, child);
+            int roms = count - dirs;
+            game_item* games =
+                roms > 0 ? (game_item*)malloc(roms * sizeof(game_item)) : NULL;
+            if (games) {
+                for (int i = 0; i < roms; i++) {
+                    games[i].file = wii_romlist_name(dirs + i);
+                    if (!get_game_name(games[i].file, games[i].name,
+                                       sizeof(games[i].name))) {
+                        Util_strlcpy(games[i].name, games[i].file,
+                                     sizeof(games[i].name));
+                    }
                 }
+                qsort(games, roms, sizeof(game_item), compare_games);
             }
-            closedir(romdir);
-
-            // Sort the games list
-            qsort(menu->children, menu->child_count, sizeof(*(menu->children)),
-                  game_name_compare);
+            for (int i = 0; i < roms; i++) {
+                wii_add_child(menu, wii_create_tree_node(
+                                        NODETYPE_ROM,
+                                        games ? games[i].file
+                                              : wii_romlist_name(dirs + i)));
+            }
+            free(games);
 
             success = TRUE;
+
+            // Fill in the names of the games in the background
+            wii_catalog_scan(roms);
         } else {
             char msg[256];
             snprintf(msg, sizeof(msg), "%s: %s", "Error opening", roms);
@@ -1229,6 +1346,9 @@ static void wii_read_game_list(TREENODE* menu) {
  * Invoked after exiting the menu loop
  */
 void wii_menu_handle_post_loop() {
+    // The scanner only runs while the menu is displayed
+    wii_catalog_stop();
+
     if (!ExitNow) {
         // Start the sound
         PauseAudio(0);
@@ -1249,6 +1369,12 @@ void wii_menu_handle_pre_loop() {
 
     // Stop the sound
     PauseAudio(1);
+
+    // Pick up the scan where it was stopped
+    const char* roms = wii_get_roms_dir();
+    if (games_read && roms[0] != '\0') {
+        wii_catalog_scan(roms);
+    }
 }
 
 /**
@@ -0,0 +1,556 @@
+//---------------------------------------------------------------------------//
+//   __      __.__.___________        .__                                    //
+//  /  \    /  \__|__\_   ___ \  ____ |  |   ____   _____                    //
+//  \   \/\/   /  |  /    \  \/ /  _ \|  | _/ __ \ /     \                   //
+//   \        /|  |  \     \___(  <_> )  |_\  ___/|  Y Y  \                  //
+//    \__/\  / |__|__|\______  /\____/|____/\___  >__|_|  /                  //
+//         \/                \/                 \/      \/                   //
+//     WiiColem by raz0red                                                   //
+//     Port of the ColEm emulator by Marat Fayzullin                         //
+//                                                                           //
+//     [github.com/raz0red/wiicolem]                                         //
+//                                                                           //
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  Copyright (C) 2019 raz0red                                               //
+//                                                                           //
+//  The license for ColEm as indicated by Marat Fayzullin, the author of     //
+//  ColEm is detailed below:                                                 //
+//                                                                           //
+//  ColEm sources are available under three conditions:                      //
+//                                                                           //
+//  1) You are not using them for a commercial project.                      //
+//  2) You provide a proper reference to Marat Fayzullin as the author of    //
+//     the original source code.                                             //
+//  3) You provide a link to http://fms.komkon.org/ColEm/                    //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "wii_app_common.h"
+#include "wii_app.h"
+#include "wii_util.h"
+#include "wii_coleco_romlist.h"
+
+#define ROMLIST_FILE_PATH WII_FILES_DIR "wiicolem.dirs"
+#define ROMLIST_TMP_FILE_PATH WII_FILES_DIR "wiicolem.dirs.tmp"
+
+/** The cache file */
+static char rl_file[WII_MAX_PATH] = "";
+/** The cache temp file */
+static char rl_tmp_file[WII_MAX_PATH] = "";
+
+/** The number of directory listings that are cached */
+#define ROMLIST_MAX_DIRS 8
+
+/** An entry of a directory listing */
+typedef struct {
+    char* name;  // The name of the entry
+    char* key;   // The name folded to lower case, for sorting and searching
+    BOOL dir;    // Whether the entry is a directory
+} romlist_entry;
+
+/** A cached directory listing */
+typedef struct {
+    char path[WII_MAX_PATH];  // The directory ('\0' if the listing is unused)
+    time_t mtime;             // Modification time of the directory when read
+    BOOL checked;             // Whether the directory was read this session
+    romlist_entry* entries;   // The entries, directories first, then by key
+    int count;                // The number of entries
+    u32 used;                 // When the listing was last used
+} romlist_dir;
+
+/** The cached directory listings */
+static romlist_dir rl_dirs[ROMLIST_MAX_DIRS];
+/** The current listing */
+static romlist_dir* rl_current = NULL;
+/** Incremented each time a listing is used, for picking one to evict */
+static u32 rl_clock = 0;
+/** Whether the cache file has been read */
+static BOOL rl_loaded = FALSE;
+/** Whether the listings differ from the cache file */
+static BOOL rl_dirty = FALSE;
+
+/**
+ * Creates a listing entry with the specified name
+ *
+ * @param   entry The entry to fill in
+ * @param   name The name of the entry
+ * @param   dir Whether the entry is a directory
+ * @return  Whether the entry was created
+ */
+static BOOL create_entry(romlist_entry* entry, const char* name, BOOL dir) {
+    int len = strlen(name) + 1;
+
+    // The name and its key share a single allocation
+    entry->name = (char*)malloc(len * 2);
+    if (!entry->name) {
+        return FALSE;
+    }
+    entry->key = entry->name + len;
+    for (int i = 0; i < len; i++) {
+        entry->name[i] = name[i];
+        entry->key[i] = tolower((u8)name[i]);
+    }
+    entry->dir = dir;
+    return TRUE;
+}
+
+/**
+ * Compares a directory flag and key with those of a listing entry
+ *
+ * @param   dir Whether the key is that of a directory
+ * @param   key The key
+ * @param   entry The entry
+ * @return  The result of the comparison
+ */
+static int compare_key(BOOL dir, const char* key, const romlist_entry* entry) {
+    if (dir != entry->dir) {
+        return dir ? -1 : 1;
+    }
+    return strcmp(key, entry->key);
+}
+
+/**
+ * Used for comparing listing entries when sorting (qsort). Names that only
+ * differ in case are ordered by the names themselves.
+ *
+ * @param   a The first entry to compare
+ * @param   b The second entry to compare
+ * @return  The result of the comparison
+ */
+static int compare_entries(const void* a, const void* b) {
+    const romlist_entry* aptr = (const romlist_entry*)a;
+    const romlist_entry* bptr = (const romlist_entry*)b;
+    int result = compare_key(aptr->dir, aptr->key, bptr);
+    return result != 0 ? result : strcmp(aptr->name, bptr->name);
+}
+
+/**
+ * Returns the index of the first entry of the listing that does not sort
+ * before the specified directory flag and key
+ *
+ * @param   list The listing
+ * @param   dir Whether the key is that of a directory
+ * @param   key The key
+ * @return  The index of the entry (the entry count if there is none)
+ */
+static int lower_bound(romlist_dir* list, BOOL dir, const char* key) {
+    int low = 0;
+    int high = list->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (compare_key(dir, key, &list->entries[mid]) > 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Frees the entries of the specified listing
+ *
+ * @param   list The listing
+ */
+static void free_entries(romlist_dir* list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->entries[i].name);
+    }
+    free(list->entries);
+    list->entries = NULL;
+    list->count = 0;
+}
+
+/**
+ * Returns the cached listing of the specified directory. If it is not cached,
+ * the least recently used listing is cleared and returned for it.
+ *
+ * @param   path The path of the directory
+ * @return  The listing of the directory
+ */
+static romlist_dir* get_dir(const char* path) {
+    romlist_dir* oldest = &rl_dirs[0];
+    for (int i = 0; i < ROMLIST_MAX_DIRS; i++) {
+        romlist_dir* list = &rl_dirs[i];
+        if (!strcmp(list->path, path)) {
+            return list;
+        }
+        if (list->used < oldest->used) {
+            oldest = list;
+        }
+    }
+
+    free_entries(oldest);
+    Util_strlcpy(oldest->path, path, sizeof(oldest->path));
+    oldest->mtime = 0;
+    oldest->checked = FALSE;
+    oldest->used = 0;
+    return oldest;
+}
+
+/**
+ * Returns the path to the cache file
+ *
+ * @return  The path to the cache file
+ */
+static char* get_cache_path() {
+    if (rl_file[0] == '\0') {
+        snprintf(rl_file, WII_MAX_PATH, "%s%s", wii_get_fs_prefix(),
+                 ROMLIST_FILE_PATH);
+    }
+    return rl_file;
+}
+
+/**
+ * Returns the path to the cache temporary file
+ *
+ * @return  The path to the cache temporary file
+ */
+static char* get_cache_tmp_path() {
+    if (rl_tmp_file[0] == '\0') {
+        snprintf(rl_tmp_file, WII_MAX_PATH, "%s%s", wii_get_fs_prefix(),
+                 ROMLIST_TMP_FILE_PATH);
+    }
+    return rl_tmp_file;
+}
+
+/**
+ * Reads the listings from the cache file. Each listing starts with a
+ * [path] line and the modification time of the directory, followed by a
+ * "d=<name>" line for each directory and a "f=<name>" line for each file.
+ */
+static void load_cache() {
+    char buff[WII_MAX_PATH + 8];
+    romlist_dir* list = NULL;
+    int size = 0;
+
+    rl_loaded = TRUE;
+    FILE* fp = fopen(get_cache_path(), "r");
+    if (!fp) {
+        return;
+    }
+
+    while (fgets(buff, sizeof(buff), fp) != 0) {
+        char* end = strchr(buff, '\n');
+        if (!end) {
+            // Line too long, skip the listing
+            list = NULL;
+            continue;
+        }
+        *end = '\0';
+
+        if (buff[0] == '[') {
+            end = strrchr(buff, ']');
+            if (end) {
+                *end = '\0';
+                list = get_dir(buff + 1);
+                free_entries(list);
+                list->used = ++rl_clock;
+                size = 0;
+            }
+        } else if (list && !strncmp(buff, "mtime=", 6)) {
+            list->mtime = strtoul(buff + 6, NULL, 10);
+        } else if (list && (buff[0] == 'd' || buff[0] == 'f') &&
+                   buff[1] == '=') {
+            if (list->count == size) {
+                int new_size = size ? size * 2 : 64;
+                romlist_entry* entries = (romlist_entry*)realloc(
+                    list->entries, new_size * sizeof(romlist_entry));
+                if (!entries) {
+                    break;
+                }
+                list->entries = entries;
+                size = new_size;
+            }
+            if (create_entry(&list->entries[list->count], buff + 2,
+                             buff[0] == 'd')) {
+                list->count++;
+            }
+        }
+    }
+    fclose(fp);
+
+    // The listings were written sorted, only sort them if edited by hand
+    for (int i = 0; i < ROMLIST_MAX_DIRS; i++) {
+        list = &rl_dirs[i];
+        for (int j = 1; j < list->count; j++) {
+            if (compare_entries(&list->entries[j - 1], &list->entries[j]) > 0) {
+                qsort(list->entries, list->count, sizeof(romlist_entry),
+                      compare_entries);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Reads the specified directory, merging its changes into the listing.
+ * Entries that are still there are kept, new ones are sorted on their own and
+ * merged in, so the listing is never sorted as a whole.
+ *
+ * @param   list The listing of the directory
+ * @param   dir The open directory
+ * @return  Whether the directory was read
+ */
+static BOOL update_dir(romlist_dir* list, DIR* dir) {
+    romlist_entry* added = NULL;  // Entries new to the listing
+    int added_count = 0;
+    int added_size = 0;
+    BOOL success = TRUE;
+
+    // Which of the current entries are still in the directory
+    u8* seen = (u8*)calloc(list->count + 1, sizeof(u8));
+    if (!seen) {
+        return FALSE;
+    }
+
+    struct dirent* ent = NULL;
+    while (success && (ent = readdir(dir)) != NULL) {
+        if (!strcmp(".", ent->d_name) || !strcmp("..", ent->d_name)) {
+            continue;
+        }
+
+        romlist_entry entry;
+        if (!create_entry(&entry, ent->d_name, ent->d_type == DT_DIR)) {
+            success = FALSE;
+            break;
+        }
+
+        // Look for the entry, several names can share a key
+        int i = lower_bound(list, entry.dir, entry.key);
+        while (i < list->count &&
+               !compare_key(entry.dir, entry.key, &list->entries[i]) &&
+               strcmp(entry.name, list->entries[i].name)) {
+            i++;
+        }
+        if (i < list->count &&
+            !compare_key(entry.dir, entry.key, &list->entries[i])) {
+            seen[i] = 1;
+            free(entry.name);
+            continue;
+        }
+
+        if (added_count == added_size) {
+            int new_size = added_size ? added_size * 2 : 64;
+            romlist_entry* entries = (romlist_entry*)realloc(
+                added, new_size * sizeof(romlist_entry));
+            if (!entries) {
+                free(entry.name);
+                success = FALSE;
+                break;
+            }
+            added = entries;
+            added_size = new_size;
+        }
+        added[added_count++] = entry;
+    }
+
+    romlist_entry* merged = NULL;
+    if (success) {
+        merged = (romlist_entry*)malloc((list->count + added_count + 1) *
+                                        sizeof(romlist_entry));
+        success = merged != NULL;
+    }
+
+    if (!success) {
+        for (int i = 0; i < added_count; i++) {
+            free(added[i].name);
+        }
+        free(added);
+        free(seen);
+        return FALSE;
+    }
+
+    qsort(added, added_count, sizeof(romlist_entry), compare_entries);
+
+    // Merge the remaining entries with the new ones
+    int count = 0;
+    int a = 0;
+    int removed = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (!seen[i]) {
+            free(list->entries[i].name);
+            removed++;
+            continue;
+        }
+        while (a < added_count &&
+               compare_entries(&added[a], &list->entries[i]) < 0) {
+            merged[count++] = added[a++];
+        }
+        merged[count++] = list->entries[i];
+    }
+    while (a < added_count) {
+        merged[count++] = added[a++];
+    }
+
+    if (removed || added_count) {
+        rl_dirty = TRUE;
+    }
+
+    free(list->entries);
+    list->entries = merged;
+    list->count = count;
+    free(added);
+    free(seen);
+    return TRUE;
+}
+
+/**
+ * Makes the listing of the specified directory current. A cached listing is
+ * used as is while the directory's modification time is unchanged since it
+ * was read in this session, otherwise the directory is read and the changes
+ * are merged into the listing. Listings from the cache file are read again
+ * once, as FAT does not reliably update a directory's modification time when
+ * files are copied onto the card elsewhere.
+ *
+ * @param   path The path of the directory
+ * @return  Whether the directory could be read
+ */
+BOOL wii_romlist_read(const char* path) {
+    if (!rl_loaded) {
+        load_cache();
+    }
+
+    // Not every file system has directory modification times (0)
+    struct stat st;
+    time_t mtime = stat(path, &st) == 0 ? st.st_mtime : 0;
+
+    romlist_dir* list = get_dir(path);
+    list->used = ++rl_clock;
+    rl_current = list;
+    if (list->checked && mtime != 0 && list->mtime == mtime) {
+        return TRUE;
+    }
+
+    DIR* dir = opendir(path);
+    if (!dir) {
+        free_entries(list);
+        list->path[0] = '\0';
+        rl_current = NULL;
+        return FALSE;
+    }
+    BOOL success = update_dir(list, dir);
+    closedir(dir);
+
+    if (!success) {
+        // Out of memory, drop the listing
+        free_entries(list);
+        list->path[0] = '\0';
+        rl_current = NULL;
+        return FALSE;
+    }
+
+    if (list->mtime != mtime) {
+        list->mtime = mtime;
+        rl_dirty = TRUE;
+    }
+    list->checked = TRUE;
+    return TRUE;
+}
+
+/**
+ * Returns the number of entries in the current listing
+ *
+ * @return  The number of entries in the current listing
+ */
+int wii_romlist_count() {
+    return rl_current ? rl_current->count : 0;
+}
+
+/**
+ * Returns the name of the entry at the specified index of the current
+ * listing
+ *
+ * @param   index The index of the entry
+ * @return  The name of the entry
+ */
+const char* wii_romlist_name(int index) {
+    return rl_current->entries[index].name;
+}
+
+/**
+ * Returns whether the entry at the specified index of the current listing
+ * is a directory
+ *
+ * @param   index The index of the entry
+ * @return  Whether the entry is a directory
+ */
+BOOL wii_romlist_is_dir(int index) {
+    return rl_current->entries[index].dir;
+}
+
+/**
+ * Returns the index of the first entry of the current listing whose name
+ * starts with the specified prefix (case-insensitive)
+ *
+ * @param   prefix The prefix of the name
+ * @param   dir Whether to look for a directory (or a file)
+ * @return  The index of the entry (-1 if there is none)
+ */
+int wii_romlist_find(const char* prefix, BOOL dir) {
+    char key[WII_MAX_PATH];
+    int len = 0;
+
+    if (!rl_current) {
+        return -1;
+    }
+
+    while (prefix[len] && len < (int)sizeof(key) - 1) {
+        key[len] = tolower((u8)prefix[len]);
+        len++;
+    }
+    key[len] = '\0';
+
+    int i = lower_bound(rl_current, dir, key);
+    if (i < rl_current->count && rl_current->entries[i].dir == dir &&
+        !strncmp(rl_current->entries[i].key, key, len)) {
+        return i;
+    }
+    return -1;
+}
+
+/**
+ * Writes the cached listings out, if they have changed. They are written to
+ * a temporary file first, so a partial write never replaces the cache.
+ */
+void wii_romlist_flush() {
+    if (!rl_dirty) {
+        return;
+    }
+
+    FILE* fp = fopen(get_cache_tmp_path(), "w");
+    if (!fp) {
+        return;
+    }
+    for (int i = 0; i < ROMLIST_MAX_DIRS; i++) {
+        romlist_dir* list = &rl_dirs[i];
+        if (list->path[0] == '\0' || list->mtime == 0) {
+            // Listings without a modification time are always re-read
+            continue;
+        }
+        fprintf(fp, "[%s]\n", list->path);
+        fprintf(fp, "mtime=%lu\n", (unsigned long)list->mtime);
+        for (int j = 0; j < list->count; j++) {
+            fprintf(fp, "%c=%s\n", list->entries[j].dir ? 'd' : 'f',
+                    list->entries[j].name);
+        }
+    }
+    BOOL written = !ferror(fp);
+    if (fclose(fp) != 0 || !written) {
+        return;
+    }
+
+    remove(get_cache_path());
+    if (rename(get_cache_tmp_path(), get_cache_path()) == 0) {
+        rl_dirty = FALSE;
+    }
+}
@@ -0,0 +1,88 @@
+//---------------------------------------------------------------------------//
+//   __      __.__.___________        .__                                    //
+//  /  \    /  \__|__\_   ___ \  ____ |  |   ____   _____                    //
+//  \   \/\/   /  |  /    \  \/ /  _ \|  | _/ __ \ /     \                   //
+//   \        /|  |  \     \___(  <_> )  |_\  ___/|  Y Y  \                  //
+//    \__/\  / |__|__|\______  /\____/|____/\___  >__|_|  /                  //
+//         \/                \/                 \/      \/                   //
+//     WiiColem by raz0red                                                   //
+//     Port of the ColEm emulator by Marat Fayzullin                         //
+//                                                                           //
+//     [github.com/raz0red/wiicolem]                                         //
+//                                                                           //
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  Copyright (C) 2019 raz0red                                               //
+//                                                                           //
+//  The license for ColEm as indicated by Marat Fayzullin, the author of     //
+//  ColEm is detailed below:                                                 //
+//                                                                           //
+//  ColEm sources are available under three conditions:                      //
+//                                                                           //
+//  1) You are not using them for a commercial project.                      //
+//  2) You provide a proper reference to Marat Fayzullin as the author of    //
+//     the original source code.                                             //
+//  3) You provide a link to http://fms.komkon.org/ColEm/                    //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#ifndef WII_COLECO_ROMLIST_H
+#define WII_COLECO_ROMLIST_H
+
+#include <gctypes.h>
+
+#include "wii_util.h"
+
+/**
+ * Makes the listing of the specified directory current. A cached listing is
+ * used as is while the directory's modification time is unchanged since it
+ * was read in this session, otherwise the directory is read and the changes
+ * are merged into the listing.
+ *
+ * @param   path The path of the directory
+ * @return  Whether the directory could be read
+ */
+BOOL wii_romlist_read(const char* path);
+
+/**
+ * Returns the number of entries in the current listing
+ *
+ * @return  The number of entries in the current listing
+ */
+int wii_romlist_count();
+
+/**
+ * Returns the name of the entry at the specified index of the current
+ * listing. Directories come first, then files, each sorted by name
+ * (case-insensitive).
+ *
+ * @param   index The index of the entry
+ * @return  The name of the entry
+ */
+const char* wii_romlist_name(int index);
+
+/**
+ * Returns whether the entry at the specified index of the current listing
+ * is a directory
+ *
+ * @param   index The index of the entry
+ * @return  Whether the entry is a directory
+ */
+BOOL wii_romlist_is_dir(int index);
+
+/**
+ * Returns the index of the first entry of the current listing whose name
+ * starts with the specified prefix (case-insensitive)
+ *
+ * @param   prefix The prefix of the name
+ * @param   dir Whether to look for a directory (or a file)
+ * @return  The index of the entry (-1 if there is none)
+ */
+int wii_romlist_find(const char* prefix, BOOL dir);
+
+/**
+ * Writes the cached listings out, if they have changed
+ */
+void wii_romlist_flush();
+
+#endif
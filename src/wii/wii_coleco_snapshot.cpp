@@ -27,9 +27,13 @@
 //---------------------------------------------------------------------------//
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <time.h>
 
+#include <SDL.h>
+#include <SDL_thread.h>
+
 #include "Coleco.h"
 
 #include "wii_app_common.h"
@@ -40,19 +44,36 @@
 #include "wii_coleco_emulation.h"
 #include "wii_coleco_snapshot.h"
 
-#define MAX_SNAPSHOTS 10
+#define LEGACY_SNAPSHOTS 10    /* Slots probed when there is no index */
+#define MAX_SNAPSHOTS 100      /* Upper bound on snapshot slots */
+#define SNAPSHOT_INDEX_EXT "idx"
+
+/** Snapshot index entry */
+typedef struct {
+    time_t mtime;  // When the snapshot was written
+    u32 size;      // Size of the snapshot file (0 if there is none)
+} snapshot_entry;
 
 /** The current snapshot index */
 static int ss_index = 0;
-/** Whether the snapshot associated with the current index exists */
-static int ss_exists = -1;
-/** The index of the latest snapshot */
-static int ss_latest = -1;
+/** The snapshot slots of the current rom */
+static snapshot_entry ss_entries[MAX_SNAPSHOTS];
+/** The rom the snapshot slots belong to */
+static char ss_entries_rom[WII_MAX_PATH] = "";
 /** The save name */
 static char savename[WII_MAX_PATH] = "";
 /** The file name */
 static char filename[WII_MAX_PATH] = "";
 
+// Background writer information
+static SDL_Thread* ss_writer = NULL;   /* Writes captured state out */
+static byte ss_image[MAX_STASIZE];     /* State captured for the writer */
+static unsigned int ss_image_size = 0; /* Size of the captured state */
+static char ss_write_name[WII_MAX_PATH] = "";  /* Snapshot being written */
+static char ss_write_rom[WII_MAX_PATH] = "";   /* The rom it belongs to */
+static int ss_write_slot = -1;         /* Its slot, -1 if not a slot */
+static volatile int ss_write_status = SNAPSHOT_WRITE_IDLE;
+
 /**
  * Returns the name of the snapshot associated with the specified romfile and
  * the snapshot index
@@ -70,11 +91,204 @@ static void get_snapshot_name(const char* romfile, int index, char* buffer) {
 }
 
 /**
- * Refreshes state of snapshot (does it exist, etc.)
+ * Returns the name of the snapshot index file of the specified romfile. The
+ * index lives next to the snapshots themselves.
+ *
+ * @param   romfile The rom file
+ * @param   buffer The output buffer to receive the name of the index file
+ *              (length must be WII_MAX_PATH)
+ */
+static void get_index_name(const char* romfile, char* buffer) {
+    char name[WII_MAX_PATH] = "";
+    Util_splitpath(romfile, NULL, name);
+    snprintf(buffer, WII_MAX_PATH, "%s%s.%s", wii_get_saves_dir(), name,
+             SNAPSHOT_INDEX_EXT);
+}
+
+/**
+ * Updates the entry of the specified slot from its snapshot file
+ *
+ * @param   slot The snapshot slot
+ * @param   name The name of the snapshot file
+ * @return  Whether the entry has changed
+ */
+static BOOL update_entry(int slot, const char* name) {
+    snapshot_entry entry = {0, 0};
+    struct stat st;
+    if (stat(name, &st) == 0) {
+        entry.mtime = st.st_mtime;
+        entry.size = st.st_size > 0 ? st.st_size : 1;
+    }
+
+    snapshot_entry* current = &ss_entries[slot];
+    if (current->mtime == entry.mtime && current->size == entry.size) {
+        return FALSE;
+    }
+    *current = entry;
+    return TRUE;
+}
+
+/**
+ * Writes out the snapshot index of the current rom. Each line holds the slot,
+ * the time it was written, and its size.
+ */
+static void save_index() {
+    char name[WII_MAX_PATH];
+    get_index_name(ss_entries_rom, name);
+
+    FILE* fp = fopen(name, "w");
+    if (fp) {
+        for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+            if (ss_entries[i].size) {
+                fprintf(fp, "%d %ld %u\n", i, (long)ss_entries[i].mtime,
+                        (unsigned int)ss_entries[i].size);
+            }
+        }
+        fclose(fp);
+    }
+}
+
+/**
+ * Loads the snapshot index of the specified rom, unless already loaded. The
+ * slots it lists are checked against their snapshot files, in case these
+ * have been changed or deleted since. When there is no index yet, the slots
+ * snapshots used to be limited to are probed once and the index is created
+ * from them.
+ *
+ * @param   romfile The rom file
+ */
+static void load_index(const char* romfile) {
+    if (!romfile || !strcmp(ss_entries_rom, romfile)) {
+        return;
+    }
+
+    snprintf(ss_entries_rom, WII_MAX_PATH, "%s", romfile);
+    memset(ss_entries, 0, sizeof(ss_entries));
+
+    char name[WII_MAX_PATH];
+    get_index_name(romfile, name);
+
+    FILE* fp = fopen(name, "r");
+    if (fp) {
+        char line[128];
+        while (fgets(line, sizeof(line), fp)) {
+            int slot;
+            long mtime;
+            unsigned int size;
+            if (sscanf(line, "%d %ld %u", &slot, &mtime, &size) == 3 &&
+                slot >= 0 && slot < MAX_SNAPSHOTS) {
+                ss_entries[slot].mtime = mtime;
+                ss_entries[slot].size = size;
+            }
+        }
+        fclose(fp);
+
+        BOOL changed = FALSE;
+        for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+            if (ss_entries[i].size) {
+                get_snapshot_name(romfile, i, name);
+                changed |= update_entry(i, name);
+            }
+        }
+        if (changed) {
+            save_index();
+        }
+    } else {
+        for (int i = 0; i < LEGACY_SNAPSHOTS; i++) {
+            get_snapshot_name(romfile, i, name);
+            update_entry(i, name);
+        }
+        save_index();
+    }
+}
+
+/**
+ * Writer thread. Compresses and writes out the captured state. The state is
+ * written to a temporary file first and renamed over the snapshot once
+ * complete, so that a failed write never leaves a truncated snapshot. The
+ * index is left to the main thread (see finish_write).
+ *
+ * @param   data Unused
+ * @return  Thread exit code
+ */
+static int snapshot_writer(void* data) {
+    char tmpname[WII_MAX_PATH];
+    snprintf(tmpname, WII_MAX_PATH, "%s.tmp", ss_write_name);
+
+    BOOL ok = WriteSTA(tmpname, ss_image, ss_image_size);
+    if (ok && rename(tmpname, ss_write_name) != 0) {
+        // Some file systems will not rename over an existing file
+        remove(ss_write_name);
+        ok = (rename(tmpname, ss_write_name) == 0);
+    }
+    if (!ok) {
+        remove(tmpname);
+    }
+
+    ss_write_status = ok ? SNAPSHOT_WRITE_DONE : SNAPSHOT_WRITE_FAILED;
+    return 0;
+}
+
+/**
+ * Brings the index in step with the slot of the snapshot just written (if
+ * any). Called on the main thread once the writer has finished.
+ */
+static void finish_write() {
+    if (ss_write_slot >= 0) {
+        load_index(ss_write_rom);
+        if (update_entry(ss_write_slot, ss_write_name)) {
+            save_index();
+        }
+        ss_write_slot = -1;
+    }
+}
+
+/**
+ * Waits for the snapshot being written in the background (if any)
+ */
+void wii_snapshot_flush() {
+    if (ss_writer) {
+        SDL_WaitThread(ss_writer, NULL);
+        ss_writer = NULL;
+    }
+    finish_write();
+}
+
+/**
+ * Cleans up after the writer thread once it has finished
+ */
+static void reap_writer() {
+    if (ss_writer && ss_write_status != SNAPSHOT_WRITE_PENDING) {
+        wii_snapshot_flush();
+    }
+}
+
+/**
+ * Returns the status of the latest snapshot written in the background
+ *
+ * @return  The status of the writer (SNAPSHOT_WRITE_xxx)
+ */
+int wii_snapshot_write_status() {
+    reap_writer();
+    return ss_write_status;
+}
+
+/**
+ * Re-checks the snapshot of the current slot against the file system (after
+ * it has been deleted, etc.), updating the index.
  */
 void wii_snapshot_refresh() {
-    ss_exists = -1;
-    ss_latest = -1;
+    if (!wii_last_rom) {
+        return;
+    }
+
+    wii_snapshot_flush();
+    load_index(wii_last_rom);
+    savename[0] = '\0';
+    wii_snapshot_handle_get_name(wii_last_rom, savename);
+    if (update_entry(ss_index, savename)) {
+        save_index();
+    }
 }
 
 /**
@@ -83,41 +297,52 @@ void wii_snapshot_refresh() {
  * @return  Whether the current snapshot exists
  */
 BOOL wii_snapshot_current_exists() {
-    if (ss_exists == -1) {
-        if (!wii_last_rom) {
-            ss_exists = FALSE;
-        } else {
-            savename[0] = '\0';
-            wii_snapshot_handle_get_name(wii_last_rom, savename);
-            ss_exists = Util_fileexists(savename);
-        }
+    if (!wii_last_rom) {
+        return FALSE;
     }
 
-    return ss_exists;
+    reap_writer();
+    load_index(wii_last_rom);
+    return ss_entries[ss_index].size > 0 ||
+           (ss_writer && ss_write_slot == ss_index);
 }
 
 /**
  * Determines the index of the latest snapshot
  *
- * @return  The index of the latest snapshot
+ * @return  The index of the latest snapshot (-1 if there are none)
  */
 static int get_latest_snapshot() {
-    if (ss_latest == -1 && wii_last_rom) {
-        ss_latest = -2;  // The check has been performed
-        time_t max = 0;        
+    int latest = -1;
+    if (wii_last_rom) {
+        reap_writer();
+        load_index(wii_last_rom);
+        time_t max = 0;
         for (int i = 0; i < MAX_SNAPSHOTS; i++) {
-            savename[0] = '\0';
-            get_snapshot_name(wii_last_rom, i, savename);
-            struct stat st;
-            if (stat(savename, &st) == 0) {
-                if (st.st_mtime > max) {
-                    max = st.st_mtime;
-                    ss_latest = i;
-                }
+            if (ss_entries[i].size && ss_entries[i].mtime > max) {
+                max = ss_entries[i].mtime;
+                latest = i;
             }
         }
     }
-    return ss_latest;
+    return latest;
+}
+
+/**
+ * Returns the number of snapshot slots to cycle through. This is the number
+ * of slots there used to be, or one past the highest slot in use, so that
+ * there is always a free slot to move on to.
+ *
+ * @return  The number of snapshot slots
+ */
+static int get_slot_count() {
+    int count = LEGACY_SNAPSHOTS;
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (ss_entries[i].size && i + 2 > count) {
+            count = i + 2;
+        }
+    }
+    return count < MAX_SNAPSHOTS ? count : MAX_SNAPSHOTS;
 }
 
 /**
@@ -133,14 +358,45 @@ void wii_snapshot_handle_get_name(const char* romfile, char* buffer) {
 }
 
 /**
- * Attempts to save the snapshot to the specified file name
+ * Attempts to save the snapshot to the specified file name. The state is
+ * captured right away, while compressing and writing it out is left to the
+ * writer thread (see wii_snapshot_write_status).
  *
  * @param   The name to save the snapshot to
  * @return  Whether the snapshot was successful
  */
 BOOL wii_snapshot_handle_save(char* filename) {
-    wii_snapshot_refresh();  // force recheck
-    return SaveSTA(filename);
+    // One snapshot is written at a time
+    wii_snapshot_flush();
+
+    ss_image_size = CaptureSTA(ss_image, sizeof(ss_image));
+    if (!ss_image_size) {
+        ss_write_status = SNAPSHOT_WRITE_FAILED;
+        return FALSE;
+    }
+
+    // Whether the index of the current slot is to be updated once written
+    ss_write_slot = -1;
+    if (wii_last_rom) {
+        savename[0] = '\0';
+        wii_snapshot_handle_get_name(wii_last_rom, savename);
+        if (!strcmp(savename, filename)) {
+            ss_write_slot = ss_index;
+            snprintf(ss_write_rom, WII_MAX_PATH, "%s", wii_last_rom);
+        }
+    }
+
+    snprintf(ss_write_name, WII_MAX_PATH, "%s", filename);
+    ss_write_status = SNAPSHOT_WRITE_PENDING;
+    ss_writer = SDL_CreateThread(snapshot_writer, NULL);
+    if (!ss_writer) {
+        // Write it out on this thread instead
+        snapshot_writer(NULL);
+        finish_write();
+        return ss_write_status == SNAPSHOT_WRITE_DONE;
+    }
+
+    return TRUE;
 }
 
 /**
@@ -151,8 +407,9 @@ BOOL wii_snapshot_handle_save(char* filename) {
  *          the current rom
  */
 void wii_snapshot_reset(BOOL setIndexToLatest) {
+    wii_snapshot_flush();
+    ss_write_status = SNAPSHOT_WRITE_IDLE;
     ss_index = 0;
-    wii_snapshot_refresh();
     if (setIndexToLatest) {
         int latest = get_latest_snapshot();
         if (latest > 0) {
@@ -179,10 +436,13 @@ int wii_snapshot_current_index(BOOL* isLatest) {
  * @return  The index that was moved to
  */
 int wii_snapshot_next() {
-    if (++ss_index == MAX_SNAPSHOTS) {
+    load_index(wii_last_rom);
+    if (++ss_index >= get_slot_count()) {
         ss_index = 0;
     }
-    wii_snapshot_refresh();  // force recheck
+    if (wii_snapshot_write_status() != SNAPSHOT_WRITE_PENDING) {
+        ss_write_status = SNAPSHOT_WRITE_IDLE;
+    }
 
     return ss_index;
 }
@@ -196,7 +456,7 @@ BOOL wii_start_snapshot() {
     if (!wii_last_rom) {
         return FALSE;
     }
-    wii_snapshot_refresh();  // force recheck
+    wii_snapshot_flush();  // the snapshot may still be being written
 
     savename[0] = '\0';
     wii_snapshot_handle_get_name(wii_last_rom, savename);
@@ -29,6 +29,12 @@
 #ifndef WII_COLECO_SNAPSHOT_H
 #define WII_COLECO_SNAPSHOT_H
 
+// Status of the background snapshot writer
+#define SNAPSHOT_WRITE_IDLE 0
+#define SNAPSHOT_WRITE_PENDING 1
+#define SNAPSHOT_WRITE_DONE 2
+#define SNAPSHOT_WRITE_FAILED 3
+
 /**
  * Starts emulation with the current snapshot
  *
@@ -73,4 +79,20 @@ BOOL wii_snapshot_current_exists();
  */
 int wii_snapshot_next();
 
+/**
+ * Returns the status of the latest snapshot written in the background
+ *
+ * @return  SNAPSHOT_WRITE_IDLE if no snapshot has been written,
+ *          SNAPSHOT_WRITE_PENDING while the writer thread is running,
+ *          SNAPSHOT_WRITE_DONE if the snapshot was written, or
+ *          SNAPSHOT_WRITE_FAILED if writing it failed
+ */
+int wii_snapshot_write_status();
+
+/**
+ * Waits for the snapshot being written in the background (if any). Blocks
+ * until the writer thread is idle.
+ */
+void wii_snapshot_flush();
+
 #endif